@@ -0,0 +1,86 @@
+// Iterations per second of a builtin-only 'while' loop, which runs every pass
+// from its parsed form, against the same body submitted as a new line each
+// iteration: validated and parsed again every time (a parse cache miss), or
+// fetched from the parse cache (a line repeated at the prompt). Each pass
+// reads one line of a scratch file, so all three do the same work.
+//
+// Usage: loop_bench.out [iterations]
+
+#include "cmdparse.h"
+#include "events.h"
+#include "executor.h"
+#include "jobs.h"
+#include "parsecache.h"
+#include "parser.h"
+#include "state.h"
+#include "vars.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOOP "while read L; do test -n \"$L\"; X=$L; done"
+#define BODY "read L; test -n \"$L\"; X=$L"
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Scratch file of n lines as the shell's stdin, from its start
+static int open_input(long n) {
+	char path[] = "/tmp/loop_benchXXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0) return -1;
+	unlink(path);
+	FILE *f = fdopen(dup(fd), "w");
+	if (!f) return -1;
+	for (long i = 0; i < n; ++i) fprintf(f, "line %ld\n", i);
+	fclose(f);
+	if (lseek(fd, 0, SEEK_SET) != 0 || dup2(fd, STDIN_FILENO) < 0) return -1;
+	return fd;
+}
+
+static void report(const char *name, long n, double secs) {
+	printf("%-28s %8ld passes in %6.3fs: %10.0f iterations/s\n", name, n, secs, secs > 0 ? (double)n / secs : 0.0);
+}
+
+int main(int argc, char **argv) {
+	long n = argc > 1 ? atol(argv[1]) : 100000;
+	events_init();
+	state_init();
+	vars_init();
+	jobs_init();
+	if (n <= 0 || open_input(n) < 0) {
+		perror("loop_bench");
+		return 1;
+	}
+
+	double start = now();
+	execute_shell_cmd(LOOP);
+	report("while loop (parsed once)", n, now() - start);
+
+	lseek(STDIN_FILENO, 0, SEEK_SET);
+	start = now();
+	for (long i = 0; i < n; ++i) {
+		CmdSequence *seq = parser_is_valid_command(BODY) ? parse_shell_cmd(BODY) : NULL;
+		execute_parsed_cmd(seq);
+		free_cmd_sequence(seq);
+	}
+	report("new line, re-parsed", n, now() - start);
+
+	lseek(STDIN_FILENO, 0, SEEK_SET);
+	start = now();
+	for (long i = 0; i < n; ++i) {
+		CmdSequence *seq = parse_cache_acquire(BODY);
+		execute_parsed_cmd(seq);
+		parse_cache_release(seq);
+	}
+	report("new line, parse cache hit", n, now() - start);
+
+	jobs_cleanup();
+	return 0;
+}
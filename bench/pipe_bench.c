@@ -0,0 +1,75 @@
+// Throughput of a three-stage pipeline with the default pipe capacity against
+// 'set pipesize=1M': 'head -c SIZE /dev/zero | cat | cat > /dev/null', run
+// through the executor like a line typed at the prompt. Larger pipes mean
+// fewer wakeups, which shows in the stages' voluntary context switches.
+//
+// Usage: pipe_bench.out [size (K/M/G suffix)] [runs]
+
+#include "events.h"
+#include "executor.h"
+#include "jobs.h"
+#include "state.h"
+#include "vars.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static double parse_bytes(const char *text) {
+	char *end;
+	double n = strtod(text, &end);
+	if (*end == 'K' || *end == 'k') n *= 1024.0;
+	else if (*end == 'M' || *end == 'm') n *= 1024.0 * 1024.0;
+	else if (*end == 'G' || *end == 'g') n *= 1024.0 * 1024.0 * 1024.0;
+	return n;
+}
+
+static long child_switches(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_CHILDREN, &ru);
+	return ru.ru_nvcsw;
+}
+
+static void run(const char *label, const char *line, double bytes, int runs) {
+	for (int r = 0; r < runs; ++r) {
+		long switches = child_switches();
+		double start = now();
+		execute_shell_cmd(line);
+		double secs = now() - start;
+		printf("%-8s %6.2fs %8.0f MB/s %8ld voluntary ctx switches\n", label, secs,
+		       secs > 0 ? bytes / secs / 1e6 : 0.0, child_switches() - switches);
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *size = argc > 1 ? argv[1] : "2G";
+	int runs = argc > 2 ? atoi(argv[2]) : 3;
+	double bytes = parse_bytes(size);
+	if (bytes <= 0 || runs <= 0) {
+		fprintf(stderr, "Usage: pipe_bench.out [size] [runs]\n");
+		return 1;
+	}
+	events_init();
+	state_init();
+	vars_init();
+	jobs_init();
+
+	char line[128];
+	snprintf(line, sizeof(line), "head -c %s /dev/zero | cat | cat > /dev/null", size);
+	printf("%s\n", line);
+	run("default", line, bytes, runs);
+	execute_shell_cmd("set pipesize=1M");
+	if (state_get_pipe_size() != 1024 * 1024) return 1;
+	run("1M", line, bytes, runs);
+
+	jobs_cleanup();
+	return 0;
+}
@@ -0,0 +1,89 @@
+// Random-input check that the validator (parser.c) and the builder
+// (cmdparse.c) accept exactly the same lines. Lines are glued together from
+// fragments of the grammar, so most of them are near misses of valid input.
+//
+// Usage: parse_fuzz.out [iterations] [seed]
+// Exits 1 after printing the lines the two disagree on.
+
+#include "cmdparse.h"
+#include "parser.h"
+
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PIECES 24
+#define MAX_REPORTS 20
+
+static const char *const pieces[] = {
+	" ", " ", " ", "\t", "a", "b", "echo", "x=1", "$X", "${X}", "*.c", "2", "-n",
+	"'", "\"", "\\", "'q w'", "\"$X y\"", "\\;",
+	"|", "||", "&", "&&", ";", "<", ">", ">>", "<<", "<<-", "<<<", "&>", "&>>",
+	"2>", "2>&1", ">&-", "<&0", "(", ")", "{", "}", "$(", "`", "<(", ">(",
+	"if", "then", "elif", "else", "fi", "while", "until", "do", "done", "for", "in",
+	"f()", "=",
+};
+
+#define PIECE_COUNT (sizeof(pieces) / sizeof(pieces[0]))
+
+// Lines are parsed inside a scratch directory, so whatever file one of them
+// names never lands in the tree
+static char scratch[] = "/tmp/parse_fuzzXXXXXX";
+
+static void remove_scratch(void) {
+	DIR *d = opendir(scratch);
+	if (d) {
+		struct dirent *e;
+		while ((e = readdir(d)) != NULL) {
+			if (strcmp(e->d_name, ".") != 0 && strcmp(e->d_name, "..") != 0) unlinkat(dirfd(d), e->d_name, 0);
+		}
+		closedir(d);
+	}
+	rmdir(scratch);
+}
+
+static void random_line(char *buf, size_t size) {
+	size_t len = 0;
+	int n = 1 + rand() % MAX_PIECES;
+	buf[0] = '\0';
+	for (int k = 0; k < n; ++k) {
+		const char *piece = pieces[(size_t)rand() % PIECE_COUNT];
+		size_t plen = strlen(piece);
+		if (len + plen + 1 > size) break;
+		memcpy(buf + len, piece, plen + 1);
+		len += plen;
+	}
+}
+
+int main(int argc, char **argv) {
+	long iterations = argc > 1 ? atol(argv[1]) : 200000;
+	unsigned seed = argc > 2 ? (unsigned)strtoul(argv[2], NULL, 10) : (unsigned)time(NULL);
+	srand(seed);
+	if (!mkdtemp(scratch) || chdir(scratch) != 0) {
+		perror("parse_fuzz");
+		return 1;
+	}
+
+	char line[512];
+	int mismatches = 0;
+	for (long it = 0; it < iterations; ++it) {
+		random_line(line, sizeof(line));
+		bool valid = parser_is_valid_command(line);
+		CmdSequence *seq = parse_shell_cmd(line);
+		if (valid != (seq != NULL)) {
+			if (mismatches < MAX_REPORTS) {
+				printf("%s by the validator, %s by the builder: [%s]\n", valid ? "accepted" : "rejected",
+				       seq ? "accepted" : "rejected", line);
+			}
+			mismatches++;
+		}
+		free_cmd_sequence(seq);
+	}
+	printf("parse_fuzz: %ld lines, seed %u, %d mismatches\n", iterations, seed, mismatches);
+	remove_scratch();
+	return mismatches > 0 ? 1 : 0;
+}
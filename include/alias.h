@@ -0,0 +1,26 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Aliases, kept in a small hash table. They are expanded textually by
+// cmd_expand_aliases() before a line is parsed.
+
+// Returns 0, or -1 when name is not a plain word or on OOM
+int alias_set(const char *name, const char *value);
+
+// Returns false when there was no such alias
+bool alias_unset(const char *name);
+void alias_clear(void);
+
+// Value of the alias named name[0..len), or NULL
+const char *alias_get_n(const char *name, size_t len);
+size_t alias_count(void);
+
+// Print one alias, or every alias sorted by name, in 'alias name='value'' form.
+// alias_print returns false when there is no such alias.
+bool alias_print(const char *name);
+void alias_print_all(void);
+
+#endif
@@ -2,9 +2,18 @@
 #define BUILTINS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
-// Try to handle a builtin. Returns true if handled (and nothing else should run).
-bool try_handle_builtin(char **argv, int argc);
+// Try to handle a builtin. Returns true if handled (and nothing else should run);
+// the builtin's exit status is stored in *status when status is non-NULL.
+bool try_handle_builtin(char **argv, int argc, int *status);
+
+// True for a builtin that only writes output and leaves the shell's state
+// alone, e.g. echo or printf; a command substitution runs those in-process
+bool builtin_is_pure(const char *name);
+
+// Name of the index-th builtin, or NULL past the end (used by completion)
+const char *builtin_name(size_t index);
 
 #endif
 
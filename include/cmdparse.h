@@ -2,26 +2,135 @@
 #define CMDPARSE_H
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "wildcard.h"
+
+// Per-word expansion flags
+#define WORD_GLOB  0x01   // has glob magic; compiled into Cmd.globs
+#define WORD_PARAM 0x02   // contains $NAME / ${NAME} references
+#define WORD_QUOTED 0x04  // still has quotes/escapes to remove during expansion
+
+// REDIR_HEREDOC flags
+#define HERE_LITERAL    0x01 // quoted delimiter: body is not expanded
+#define HERE_STRIP_TABS 0x02 // '<<-': leading tabs are dropped from body lines
+
+// Flag of a file redirection (<, >, >>, &>, &>>)
+#define TARGET_PROC_SUBST 0x04 // target is <(...) or >(...), opened as the path it expands to
+#define TARGET_EXPAND     0x08 // target has parameters or substitutions, expanded when the command runs
+
+typedef enum {
+	CMD_SIMPLE,   // words, assignments and redirections
+	CMD_SUBSHELL, // ( list ): runs in a forked child
+	CMD_BRACE,    // { list; }: runs in the shell itself unless piped or backgrounded
+	CMD_FUNCDEF,  // name() compound: argv[0] is the name, body the compound alone
+	CMD_IF,       // if cond; then body; else alt; fi ('elif' nests an if in alt)
+	CMD_WHILE,    // while cond; do body; done
+	CMD_UNTIL,    // until cond; do body; done
+	CMD_FOR       // for loop_var in argv; do body; done
+} CmdKind;
+
+// Redirection actions. Every '<', '>', '<<' ... of a command is recorded in
+// order; nothing is opened until the command runs.
+#define REDIR_IN         1 // n<path
+#define REDIR_OUT        2 // n>path
+#define REDIR_APPEND     3 // n>>path
+#define REDIR_DUP        4 // n>&m or n<&m: fd becomes a copy of src
+#define REDIR_CLOSE      5 // n>&- or n<&-
+#define REDIR_OUT_ALL    6 // &>path: stdout and stderr
+#define REDIR_APPEND_ALL 7 // &>>path
+#define REDIR_HEREDOC    8 // <<WORD: lines after the command line up to WORD
+#define REDIR_HERESTRING 9 // <<<word: the expanded word plus a newline
 
 typedef struct {
-	char **argv;      // NULL-terminated
-	char *in_file;    // optional, malloc'd, may be NULL
-	char *out_file;   // optional, malloc'd, may be NULL
-	int out_append;   // 0 for trunc, 1 for append
+	unsigned char op;    // REDIR_*
+	unsigned char flags; // HERE_* bits of a REDIR_HEREDOC, TARGET_* bits of a file
+	int fd;              // descriptor being redirected
+	int src;             // REDIR_DUP source descriptor
+	char *path;          // file, '<<' delimiter (quotes removed) or '<<<' word as written
+	char *body;          // REDIR_HEREDOC body (owned), set by cmd_sequence_read_heredocs
+} Redirect;
+
+struct CmdSequence;
+
+// All strings in a Cmd are slices of the text owned by the enclosing
+// CmdSequence (or standalone CmdPipeline); only the arrays are allocated.
+typedef struct {
+	CmdKind kind;
+	struct CmdSequence *body; // grouped commands, function or loop body, 'then' branch; else NULL
+	struct CmdSequence *cond; // if / while / until condition, else NULL
+	struct CmdSequence *alt;  // 'else' branch of an if, else NULL
+	char *loop_var;   // for: the variable assigned each word
+	char **argv;      // NULL-terminated, words as written (for: the word list); NULL for grouped commands
+	unsigned char *word_flags; // per-word WORD_* bits; NULL when every word is literal
+	WildcardPattern **globs; // per-word compiled pattern (NULL entry = literal); NULL if no word has magic
+	char **assigns;   // leading NAME=value words, NULL-terminated; NULL if none
+	unsigned char *assign_flags; // WORD_* bits per assignment; NULL when all are literal
+	Redirect *redirs; // in the order written; NULL if none
+	int redir_count;
+	char *exec_path;  // owned; PATH lookup of a literal command name cached by parsecache, else NULL
 } Cmd;
 
+// How a group is joined to the group before it
+typedef enum {
+	CONNECT_SEQ, // first group, or after ';' / '&': always runs
+	CONNECT_AND, // after '&&': runs only when the previous status is 0
+	CONNECT_OR   // after '||': runs only when the previous status is non-zero
+} GroupConnector;
+
 typedef struct {
 	Cmd *cmds; // array of commands in a pipeline
 	int count; // number of commands
     bool run_in_background; // whether this group should run in background
+	GroupConnector connector; // operator before this group within a CmdSequence
+	char *text; // backing text when parsed standalone (parse_first_cmd_group), else NULL
 } CmdPipeline;
 
-typedef struct {
-	CmdPipeline *groups; // array of command groups (separated by ; or &)
+typedef struct CmdSequence {
+	CmdPipeline *groups; // array of command groups (separated by ; & && or ||)
 	int count; // number of groups
 	bool is_background; // true if command ends with & (legacy trailing)
+	char *text; // private copy of the input line backing every word; NULL for a group's body
+	int refs;   // owners besides the one that parsed it (a defined function, a running call)
 } CmdSequence;
 
+// Words of a Cmd after expansion, built right before the command runs.
+// When nothing needed expanding, argv simply borrows the Cmd's own array.
+typedef struct {
+	char **argv;      // NULL-terminated
+	int argc;
+	int cap;          // 0 while argv is borrowed
+	char **env;       // expanded NAME=value assignments for this command
+	int env_count;
+	char **targets;   // per redirection: its expanded target (TARGET_* flags), else NULL; NULL if none
+	char **chunks;    // string storage for expanded words
+	int chunk_count;
+	size_t chunk_used;
+	size_t chunk_size;
+} ArgvList;
+
+// Expand a command's words (parameters, field splitting, pathname expansion),
+// its NAME=value prefix assignments and its file redirection targets.
+// Returns 0 on success, -1 on OOM, when a substitution cannot start or when a
+// target is an ambiguous redirect (reported on stderr).
+int cmd_expand_argv(const Cmd *cmd, ArgvList *out);
+void argv_list_free(ArgvList *list);
+
+// Supplies the next input line (malloc'd, without its newline), or NULL at EOF
+typedef char *(*HeredocReader)(void *ctx);
+
+// Read the body of every '<<' in seq, in the order they appear, from the lines
+// that follow the command line. Returns 0, or -1 on OOM.
+int cmd_sequence_read_heredocs(CmdSequence *seq, HeredocReader read_more, void *ctx);
+
+// The bytes a '<<' / '<<<' redirection feeds to its descriptor, parameters
+// expanded. Returns a malloc'd buffer (length in *len), or NULL on OOM.
+char *cmd_here_payload(const Redirect *r, size_t *len);
+
+// The line with aliases in command position replaced by their values, or NULL
+// when no alias applies (or none is defined). The result is malloc'd.
+char *cmd_expand_aliases(const char *line);
+
 // Parse only the first cmd_group from input. Returns NULL on failure.
 CmdPipeline *parse_first_cmd_group(const char *input);
 
@@ -29,6 +138,7 @@ CmdPipeline *parse_first_cmd_group(const char *input);
 CmdSequence *parse_shell_cmd(const char *input);
 
 void free_cmd_pipeline(CmdPipeline *p);
+// Drops one reference: frees s once refs is back at zero
 void free_cmd_sequence(CmdSequence *s);
 
 #endif
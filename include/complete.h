@@ -0,0 +1,22 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+#include <stddef.h>
+
+// Tab completion for the line editor. The word ending at the cursor is
+// completed as a command name (builtins and $PATH executables), a job number
+// (arguments of fg/bg) or a file path, depending on where it appears.
+
+typedef struct {
+	char **items;      // sorted, unescaped candidates; directories end with '/'
+	size_t count;
+	size_t cap;
+	size_t word_start; // byte offset of the word being completed
+	size_t prefix_len; // length of the word once quotes/escapes are removed
+} Completion;
+
+// Collect candidates for the word ending at line[pos]. Returns the candidate count.
+size_t complete_line(const char *line, size_t pos, Completion *out);
+void completion_free(Completion *c);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+// The shell takes no asynchronous signals. SIGINT, SIGTSTP and SIGCHLD stay
+// blocked and are read from a signalfd wherever the shell waits: for terminal
+// input, for a foreground child, or between commands. Forwarding Ctrl-C/Ctrl-Z
+// to the foreground job and reaping background jobs thus run as ordinary code.
+// SIGPIPE is blocked and read along with them, i.e. discarded.
+
+// Process group of the foreground job (0 when the shell itself is in front)
+extern pid_t foreground_pgid;
+// Set when Ctrl-C / Ctrl-Z reaches the shell or its foreground job; ends loops
+extern bool interrupt_received;
+
+typedef enum {
+	EVENT_READY,   // the fd is readable (or at EOF / in error)
+	EVENT_HANDLED, // signals or timers arrived and were handled first
+	EVENT_TIMEOUT,
+	EVENT_ERROR
+} EventResult;
+
+// Block the signals above and open the signalfd. Call first thing in main().
+void events_init(void);
+
+// In a freshly forked child: unblock the signals again and drop the signalfd
+void events_child_reset(void);
+
+// Handle every pending signal and expired timer without waiting
+void events_dispatch(void);
+
+// events_dispatch(), then whether an interrupt has been received
+bool events_interrupted(void);
+
+// Wait until fd is readable, handling signals and timers as they arrive.
+// timeout_ms < 0 waits indefinitely. Returns after the first batch of them so
+// the caller can react (e.g. to jobs that finished).
+EventResult events_wait_fd(int fd, int timeout_ms);
+
+// Same over any set of fds, whose revents are filled in. Pending signals and
+// timers are handled first and make it return EVENT_HANDLED.
+EventResult events_poll(struct pollfd *fds, size_t n, int timeout_ms);
+
+// wait4() for one child that keeps handling signals and timers while it blocks
+pid_t events_wait_child(pid_t pid, int *status, int options, struct rusage *ru);
+
+// A pidfd for a child (readable once it exits), or -1 where unsupported
+int events_pidfd_open(pid_t pid);
+
+// One-shot timer on a timerfd: fn(arg) runs from whichever wait or dispatch
+// of this loop first sees it expire. Returns an id > 0, or -1 on failure.
+typedef void (*EventTimerFn)(void *arg);
+int events_timer_start(double seconds, EventTimerFn fn, void *arg);
+
+// Disarm a pending timer and hand back its arg. Returns NULL when it has
+// already fired (or never existed), so whoever owns arg can tell the two apart.
+void *events_timer_cancel(int id);
+
+// Watch an fd from every wait of this loop: fn(fd, revents, arg) runs when
+// one of events (or an error / hangup) is reported for it. Unlike signals and
+// timers this does not end the wait it happened in. The fd stays the caller's,
+// except that a child's events_child_reset() closes it and then calls fn with
+// POLLNVAL, so shell-side ends of pipes never linger in pipeline stages.
+typedef void (*EventFdFn)(int fd, short revents, void *arg);
+int events_fd_watch(int fd, short events, EventFdFn fn, void *arg);
+// Change what a watched fd is polled for
+void events_fd_modify(int fd, short events);
+void events_fd_unwatch(int fd);
+
+#endif
@@ -3,6 +3,9 @@
 
 #include <stdbool.h>
 
+#include "cmdparse.h"
+#include "jobs.h"
+
 // Execute only the first atomic of the first cmd_group from a valid input string.
 // Returns true if something was executed/handled, false otherwise.
 bool execute_first_atomic(const char *input);
@@ -13,5 +16,43 @@ bool execute_first_group_pipeline(const char *input);
 // Execute entire shell_cmd with sequential execution (;)
 bool execute_shell_cmd(const char *input);
 
+// Same, for a line already obtained from parse_cache_acquire()
+bool execute_parsed_cmd(CmdSequence *seq);
+
+// Size later pipelines' pipes to bytes (0: the kernel's default). Returns the
+// capacity the kernel rounds it to, or -1 with errno set if it refuses it
+// (e.g. EPERM above /proc/sys/fs/pipe-max-size).
+int execute_set_pipe_size(int bytes);
+
+// What a launcher builtin ('timeout', 'run') puts on the job it starts
+typedef struct {
+    double timeout;          // seconds until the job's process group gets timeout_sig; 0 for none
+    int timeout_sig;
+    const JobLimits *limits; // applied in the child before exec, or NULL
+} GroupLaunch;
+
+// Run argv (already expanded) as a job set up as launch says: in the
+// background when the builtin itself was given '&'. Returns its status, 124
+// if it timed out, or 0 once a background job is started.
+int execute_launch(char **argv, int argc, const GroupLaunch *launch);
+
+// Run seq with stdout and stderr collected into *out (malloc'd, NUL-terminated,
+// NULL when empty; length in *len). Returns the resulting $?. Heredoc bodies
+// are not read.
+int execute_captured(CmdSequence *seq, char **out, size_t *len);
+
+// Output of the command substitution text (the inside of $(...)), NUL-terminated
+// with its length in *len, or NULL on failure. The caller frees it. A lone
+// builtin that only prints runs in the shell, writing straight into the buffer;
+// anything else runs in a subshell. $? is set to its status.
+char *execute_substitution(const char *text, size_t *len);
+
+// Start text (the inside of <(...) or >(...)) connected to a pipe and return
+// the shell's end, which the command being expanded is to open as /dev/fd/N:
+// for reading when command_reads, else for writing. The process joins that
+// command's process group and job, and is waited for along with it.
+// Returns -1 on failure.
+int execute_process_subst(const char *text, bool command_reads);
+
 #endif
 
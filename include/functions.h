@@ -0,0 +1,15 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include "cmdparse.h"
+
+// Shell functions defined with 'name() compound'. A function keeps the body
+// parsed with its definition (one reference to it); calls run that tree.
+
+// Define or replace name. Returns 0, or -1 on OOM.
+int functions_define(const char *name, CmdSequence *body);
+
+// Body of the function called name, or NULL
+CmdSequence *functions_get(const char *name);
+
+#endif
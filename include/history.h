@@ -4,6 +4,23 @@
 // Persist up to 15 commands, skip consecutive duplicates and skip commands where any atomic is 'log'
 void history_maybe_store(const char *line);
 
-#endif
+// Stored commands, oldest first (index 0 .. history_count()-1); used for line-editor recall
+int history_count(void);
+const char *history_get(int index);
+
+// Empty the log file and the in-memory copy
+void history_clear(void);
+
+// Append one executed pipeline to the binary stats sidecar (.mini_shell_history.stats)
+// and fold it into the in-memory aggregates. Times are in microseconds; start_us is
+// wall-clock, exit_status is the exit code (128+N when killed by signal N).
+void history_record_stats(const char *command, long long start_us, long long duration_us,
+                          int exit_status, long max_rss_kb);
 
+// Print the 'log stats' report: slowest commands, p50/p95 per command name, failure rates
+void history_print_stats(void);
 
+// Drop all recorded stats (used by 'log purge')
+void history_purge_stats(void);
+
+#endif
@@ -3,9 +3,11 @@
 
 #include <stddef.h>
 
-// Reads a line from stdin. Returns a malloc'd string without trailing newline.
-// Returns NULL on EOF or error.
-char *read_line(void);
+// Shows prompt and reads a line from stdin. On a terminal this runs the raw-mode
+// line editor (cursor movement, history recall, Ctrl-R search); otherwise it
+// falls back to getline. Returns a malloc'd string without trailing newline,
+// or NULL on EOF or error.
+char *read_line(const char *prompt);
 
 #endif
 
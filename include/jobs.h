@@ -4,36 +4,129 @@
 #include <sys/types.h>
 #include <stdbool.h>
 
-#define MAX_JOBS 16
+#include "pipemon.h"
 
 typedef enum {
     JOB_RUNNING,
     JOB_STOPPED,
-    JOB_COMPLETED
+    JOB_QUEUED,    // started but held (stopped) until admission lets it run
+    JOB_DONE,      // exited and reaped, not yet reported
+    JOB_COMPLETED  // free slot
 } JobState;
 
+// Order in which queued background jobs are admitted, and how nice they run
+typedef enum {
+    JOB_PRIO_LOW,    // nice 10
+    JOB_PRIO_NORMAL,
+    JOB_PRIO_HIGH    // admitted first
+} JobPriority;
+
+// What 'run' sets up for a job: applied by each of its processes between fork
+// and exec, and listed by 'activities'
+#define JOB_MAX_CPUS 1024
+typedef struct {
+    unsigned long cpus[JOB_MAX_CPUS / (8 * sizeof(unsigned long))]; // affinity mask, used with cpus_spec
+    char *cpus_spec;  // the CPU list as given ("0-3,8"), or NULL to inherit
+    bool set_nice;
+    int nice;
+    long long mem;    // RLIMIT_AS in bytes, or 0 to inherit
+} JobLimits;
+
+// One process of a job's pipeline
 typedef struct {
-    int job_number;
     pid_t pid;
+    int pidfd;     // readable once the process exits; -1 if pidfds are unavailable
+    bool reaped;
+} JobProc;
+
+typedef struct {
+    int job_number;
+    pid_t pid;               // process group, i.e. the first process of the pipeline
+    JobProc *procs;
+    int nprocs;
+    int nlive;               // processes not yet reaped
     char *command;
     JobState state;
     bool is_background;
+    bool waited;             // exit status already returned by 'wait'
+    int wait_status;         // of the last process, once JOB_DONE
+    long max_rss_kb;
+    long long start_wall_us; // for 'log stats'
+    long long start_mono_us;
+    int timer_id;            // events timer of a 'timeout' still armed for it, or 0
+    PipeMon *monitor;        // relay between its stages under 'set -o pipemon', or NULL
+    int priority;            // JobPriority
+    JobLimits *limits;       // set up by 'run', or NULL
 } Job;
 
-// Job management functions
+// Job management functions. The table grows as needed; job numbers keep
+// increasing and slots of removed jobs are reused.
 void jobs_init(void);
-int jobs_add(pid_t pid, const char *command, bool is_background);
+// pgid is the job's process group; pids are its processes still to be waited for
+int jobs_add(pid_t pgid, const pid_t *pids, int npids, const char *command, bool is_background);
 void jobs_remove(int job_number);
 Job *jobs_get(int job_number);
+// Job with pid as its process group or one of its processes, including a done one
 Job *jobs_get_by_pid(pid_t pid);
-void jobs_check_completed(void);
+// Number of running or stopped jobs
+int jobs_count(void);
+// Fill out with the numbers of live jobs in ascending order; returns how many
+int jobs_list_numbers(int *out, int max);
+// Reap processes of jobs that have exited (on SIGCHLD). A job whose processes
+// are all gone stays listed as JOB_DONE until jobs_report_completed() prints
+// and removes it.
+void jobs_reap(void);
+bool jobs_have_completed(void);
+void jobs_report_completed(void);
 void jobs_print_job(int job_number, pid_t pid);
 int jobs_get_next_number(void);
 void jobs_cleanup(void);
 void jobs_kill_all(void);
 
+// Block until the given jobs have exited (every running job when count is 0),
+// or with any set until the next one not yet waited for exits. Sleeps in
+// poll() on the jobs' pidfds. Returns the exit status of the last job waited
+// for, 127 when a job is unknown (or none is left for any), or 130 on Ctrl-C.
+int jobs_wait(const int *job_numbers, int count, bool any);
+
+// Background job admission ('set maxjobs=', 'maxload=', 'minmem='). A job
+// that may not start yet is forked with every process stopping itself before
+// exec, added, and then queued; jobs_admit() continues the best queued ones
+// (highest priority, then oldest) whenever a job finishes, the limits change,
+// or, with a load or memory limit, once a second while any are queued.
+bool jobs_admission_full(void);
+void jobs_set_queued(int job_number, int priority);
+void jobs_admit(void);
+// Queued jobs in admission order
+void jobs_print_queue(void);
+int jobs_set_priority(int job_number, int priority);
+int jobs_priority_nice(int priority);
+const char *jobs_priority_name(int priority);
+// JobPriority for "low" / "normal" / "high", or -1
+int jobs_parse_priority(const char *name);
+
+// Keep a copy of what the job's processes were started with
+void jobs_set_limits(int job_number, const JobLimits *limits);
+
+// Columns 'activities' can sort by, each applied where the previous ones tie.
+// Command, pid and state sort ascending; cpu, rss and time (elapsed) largest
+// first, summed (or, for time, the longest) over a job's processes.
+typedef enum {
+    ACT_SORT_COMMAND,
+    ACT_SORT_PID,
+    ACT_SORT_STATE,
+    ACT_SORT_CPU,
+    ACT_SORT_RSS,
+    ACT_SORT_TIME
+} ActivitySort;
+#define ACT_MAX_SORT_KEYS 8
+// "cpu,cmd" into keys; returns how many, or -1 on an unknown column
+int jobs_parse_sort_keys(const char *text, ActivitySort *keys, int max);
+
 // Part E functions
-void jobs_list_activities(void);
+// Live jobs sorted by keys (by command when nkeys is 0). detailed adds each
+// process's state, CPU%, RSS, threads and elapsed time (see procstat.h).
+void jobs_list_activities(const ActivitySort *keys, int nkeys, bool detailed);
 int jobs_send_signal(int job_number, int signal_num);
 int jobs_bring_to_foreground(int job_number);
 int jobs_resume_background(int job_number);
@@ -41,4 +134,4 @@ int jobs_get_most_recent_job(void);
 void jobs_set_stopped(int job_number);
 void jobs_set_running(int job_number);
 
-#endif // JOBS_H
\ No newline at end of file
+#endif // JOBS_H
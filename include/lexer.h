@@ -0,0 +1,56 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Word scanning shared by the validator (parser.c) and the builder (cmdparse.c)
+// so both agree on where a word ends once quotes and escapes are involved.
+
+#define LEX_QUOTED 0x01  // word contains quotes or backslash escapes
+#define LEX_PARAM  0x02  // '$' outside single quotes
+#define LEX_GLOB   0x04  // unquoted '*', '?' or '['
+#define LEX_SUBST  0x08  // $(...), `...` or a leading <(...) / >(...) (LEX_PARAM is set too)
+#define LEX_ERROR  0x80  // unterminated quote
+
+// True for characters that end an unquoted word
+bool lex_is_delim(char c);
+
+// Scan the word starting at s[i]. Returns the index one past its end (== i when
+// there is no word) and stores LEX_* bits in *flags.
+size_t lex_scan_word(const char *s, size_t i, unsigned *flags);
+
+// The substitution opening at s[i] ("$(", "<(", ">(" or a backquote), which
+// may itself contain quotes and further substitutions. Returns the index past
+// its closing ')' or backquote, or i when it is unterminated.
+size_t lex_scan_subst(const char *s, size_t i);
+
+// True when a process substitution <(...) or >(...) opens at s[i]. It only
+// counts at the start of a word, where it is not a redirection.
+bool lex_at_proc_subst(const char *s, size_t i);
+
+// A descriptor number (1 to 9 digits) at s[i], as in 2>file or >&1. Returns the
+// index past it and stores its value in *fd, or returns i when there is none.
+size_t lex_scan_fd(const char *s, size_t i, int *fd);
+
+// Reserved words such as '{' and '}' only count when they stand alone and
+// unquoted. Returns the index past kw if s[i..] is exactly that word, else i.
+size_t lex_match_keyword(const char *s, size_t i, const char *kw);
+
+// Same for any of the space-separated words in kws
+size_t lex_match_keywords(const char *s, size_t i, const char *kws);
+
+// Reserved words that end a list and so can never start a command
+#define LEX_CLOSING_WORDS "} then else elif fi do done"
+
+// True when a compound command starts at s[i]: '(' or { if while until for
+bool lex_starts_compound(const char *s, size_t i);
+
+// 'name ( )' opening a function definition, name being a plain word that is
+// not an assignment. Returns the index past ')', or i when s[i..] is not one.
+size_t lex_match_funcdef(const char *s, size_t i);
+
+// Remove quotes and escapes from a NUL-terminated word in place; returns the new length
+size_t lex_dequote(char *w);
+
+#endif
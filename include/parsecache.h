@@ -0,0 +1,31 @@
+#ifndef PARSECACHE_H
+#define PARSECACHE_H
+
+#include <stdbool.h>
+
+#include "cmdparse.h"
+
+// Bounded LRU cache of parsed command lines, keyed by a hash of the line.
+// A hit returns the validated CmdSequence of an earlier identical line with no
+// tokenizing or allocation. Entries also remember the PATH lookup of literal
+// command names (Cmd.exec_path); they are all dropped when PATH changes.
+// Variables need no invalidation: words are expanded only when a command runs.
+// Aliases are expanded before parsing, so changing one calls parse_cache_invalidate().
+// Lines with '<<' are parsed every time, since their bodies follow the line.
+
+// Parsed form of a line, or NULL when it is not valid syntax. The sequence may
+// be shared with the cache: do not modify it (beyond reading heredoc bodies
+// into an uncached one) and hand it back with parse_cache_release().
+CmdSequence *parse_cache_acquire(const char *line);
+void parse_cache_release(CmdSequence *seq);
+
+// Program to exec for a cached command, or NULL when PATH has to be searched
+const char *parse_cache_exec_path(const Cmd *c);
+
+// Forget every entry not currently in use
+void parse_cache_invalidate(void);
+
+// Print entry count, hits, misses and hit rate (the 'stats' builtin)
+void parse_cache_print_stats(void);
+
+#endif
@@ -2,10 +2,15 @@
 #define PARSER_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
 // Returns true if the input matches the grammar, false otherwise.
 bool parser_is_valid_command(const char *input);
 
+// True when every $(...), `...` and leading <(...) / >(...) of the word
+// s[i..end) holds a valid line (or a blank one)
+bool parser_valid_substitutions(const char *s, size_t i, size_t end);
+
 #endif
 
 
@@ -0,0 +1,17 @@
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <stddef.h>
+
+// In-memory trie of the executable names found in the $PATH directories, used
+// for command-name completion. The trie is built on first use; afterwards each
+// lookup stats the PATH directories and rescans only those whose mtime changed
+// (or that were added to PATH), removing their previous names first.
+
+// Called once per matching name in sorted order. Return non-zero to stop.
+typedef int (*PathIndexEmit)(void *ctx, const char *name, size_t len);
+
+// Visit every executable name starting with prefix[0..len). Returns the number visited.
+int path_index_complete(const char *prefix, size_t len, PathIndexEmit emit, void *ctx);
+
+#endif
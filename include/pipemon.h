@@ -0,0 +1,29 @@
+#ifndef PIPEMON_H
+#define PIPEMON_H
+
+// 'set -o pipemon': the shell sits between the stages of a pipeline and
+// splice()s each stage's output on to the next, counting the bytes and the
+// time every link spends with nothing to pass on (the writer is the slower
+// side) or unable to pass it on (the reader is). The relay runs from the
+// events loop, so it keeps going whatever the shell waits for.
+
+typedef struct PipeMon PipeMon;
+
+PipeMon *pipemon_new(void);
+
+// Relay from upstream (the shell's read end of the pipe one stage writes to)
+// into downstream (the shell's write end of the next stage's input). Takes
+// over both fds; from / to name the two stages. Returns 0, or -1 leaving the
+// fds to the caller.
+int pipemon_add_link(PipeMon *mon, int upstream, int downstream, const char *from, const char *to);
+
+// One line per link with its rate since the previous call (for 'activities')
+void pipemon_print_rates(PipeMon *mon, const char *indent);
+
+// Once the pipeline has exited: pass on what is left, close the links and
+// print the per-link summary
+void pipemon_finish(PipeMon *mon);
+
+void pipemon_free(PipeMon *mon);
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef PROCSTAT_H
+#define PROCSTAT_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// Sampler for 'activities -l'. Each process's /proc/<pid>/stat stays open
+// between samples and is re-read with pread(), and CPU use is the delta of
+// its tick counts since the previous sample.
+
+typedef struct {
+	pid_t pid;
+	char comm[16];
+	char state;         // R, S, D, T, Z, ...
+	double cpu_percent; // since the previous sample (over its lifetime on the first)
+	long rss_kb;
+	int threads;
+	double elapsed;     // seconds since the process started
+} ProcSample;
+
+// false once the process is gone (its fd is then closed)
+bool procstat_sample(pid_t pid, ProcSample *out);
+
+// Close the fds of processes not sampled since the previous sweep
+void procstat_sweep(void);
+
+#endif
@@ -2,8 +2,14 @@
 #define PROMPT_H
 
 #include <sys/types.h>
+#include <stddef.h>
+#include <limits.h>
+
+#define PROMPT_MAX (PATH_MAX + 300)
 
 void init_shell_home(void);
+// Write the "<user@host:path> " prompt into out
+void prompt_format(char *out, size_t out_sz);
 void show_prompt(void);
 
 #endif
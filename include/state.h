@@ -2,12 +2,44 @@
 #define STATE_H
 
 #include <stddef.h>
+#include <stdbool.h>
 
 void state_init(void);
 const char *state_get_home(void);
 const char *state_get_prev_cwd(void);
 void state_set_prev_cwd(const char *path);
 
+// Exit status of the last foreground pipeline or builtin ($?)
+int state_get_last_status(void);
+void state_set_last_status(int status);
+
+// 'set -o pipefail': a pipeline's status is that of its last failing stage
+bool state_get_pipefail(void);
+void state_set_pipefail(bool on);
+
+// 'set -o pipemon': relay and measure the links of later pipelines (see pipemon.h)
+bool state_get_pipemon(void);
+void state_set_pipemon(bool on);
+
+// 'set pipesize=N': capacity of the pipes between pipeline stages, 0 for the
+// kernel's default
+int state_get_pipe_size(void);
+void state_set_pipe_size(int bytes);
+
+// Admission of background jobs: at most 'set maxjobs=' running at once, and
+// none started while the 1-minute load average is at or above 'maxload=' or
+// MemAvailable is below 'minmem=' bytes. 0 turns each check off.
+int state_get_max_jobs(void);
+void state_set_max_jobs(int n);
+double state_get_max_load(void);
+void state_set_max_load(double load);
+long long state_get_min_mem(void);
+void state_set_min_mem(long long bytes);
+
+// 'set jobprio=': the JobPriority new background jobs get
+int state_get_job_priority(void);
+void state_set_job_priority(int level);
+
 #endif
 
 
@@ -0,0 +1,41 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Shell variables and the exported environment, kept in one hashed store.
+// Children get a packed envp that is rebuilt only after an exported variable changes.
+
+// Import the process environment (all imported variables are exported)
+void vars_init(void);
+
+// Returns the value or NULL if unset
+const char *vars_get(const char *name);
+const char *vars_get_n(const char *name, size_t len);
+
+// Set a variable; an already exported variable stays exported
+int vars_set(const char *name, const char *value);
+
+// Set from a "NAME=value" word
+int vars_assign(const char *assignment);
+
+// Mark a variable exported, optionally assigning a value (value may be NULL)
+int vars_export(const char *name, const char *value);
+
+// True if s[0..len) is a valid variable name
+bool vars_is_valid_name(const char *s, size_t len);
+
+// Packed NAME=value array of exported variables. The same array is returned
+// until an export changes; callers must not modify it.
+char **vars_environ(void);
+
+// envp for one command: the exported environment with NAME=value overrides on
+// top. Returns vars_environ() itself when there are no overrides. Meant to be
+// called in a freshly forked child.
+char **vars_environ_with(char *const *overrides, int count);
+
+// Print exported variables in 'export NAME=value' form
+void vars_print_exported(void);
+
+#endif
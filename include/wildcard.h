@@ -0,0 +1,39 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Pathname expansion for '*', '?' and '[...]' words. Patterns are compiled once
+// (at parse time) and matched against directory listings read with getdents64.
+// Listings are cached per directory for the duration of one command line.
+
+typedef struct WildcardPattern WildcardPattern;
+
+// Called once per match, in sorted order. Return non-zero to abort expansion.
+typedef int (*WildcardEmit)(void *ctx, const char *path, size_t len);
+
+// True if the word contains a glob metacharacter not escaped by a backslash
+bool wildcard_has_magic(const char *word);
+
+// Compile a word into a matcher. Returns NULL if the word has no magic or on OOM.
+WildcardPattern *wildcard_compile(const char *word);
+void wildcard_free(WildcardPattern *pat);
+
+// Expand a compiled pattern. Returns the number of matches (0 means the caller
+// should keep the word literally), or -1 if emit aborted.
+int wildcard_expand(const WildcardPattern *pat, WildcardEmit emit, void *ctx);
+
+// Called per directory entry by wildcard_list_dir. Return non-zero to stop.
+typedef int (*WildcardListEmit)(void *ctx, const char *name, size_t len, bool is_dir);
+
+// Visit the entries of dir ("" for the cwd, otherwise ending in '/') whose names
+// start with prefix, in sorted order, from the cached listing. '.' and '..' are
+// never reported. Returns the number visited or -1 if dir cannot be read.
+int wildcard_list_dir(const char *dir, const char *prefix, size_t prefix_len,
+                      WildcardListEmit emit, void *ctx);
+
+// Drop all cached directory listings (called once a command line has finished)
+void wildcard_cache_reset(void);
+
+#endif
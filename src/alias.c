@@ -0,0 +1,124 @@
+#include "alias.h"
+#include "lexer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Alias {
+	char *name;
+	char *value;
+	struct Alias *next;
+} Alias;
+
+#define ALIAS_BUCKETS 64 // power of two
+
+static Alias *buckets[ALIAS_BUCKETS];
+static size_t count = 0;
+
+static size_t bucket_of(const char *s, size_t len) {
+	uint64_t h = 1469598103934665603ULL;
+	for (size_t i = 0; i < len; ++i) { h ^= (unsigned char)s[i]; h *= 1099511628211ULL; }
+	return (size_t)h & (ALIAS_BUCKETS - 1);
+}
+
+static Alias **find(const char *name, size_t len) {
+	Alias **link = &buckets[bucket_of(name, len)];
+	while (*link && !(strncmp((*link)->name, name, len) == 0 && (*link)->name[len] == '\0')) link = &(*link)->next;
+	return link;
+}
+
+const char *alias_get_n(const char *name, size_t len) {
+	if (count == 0) return NULL;
+	Alias *a = *find(name, len);
+	return a ? a->value : NULL;
+}
+
+size_t alias_count(void) {
+	return count;
+}
+
+int alias_set(const char *name, const char *value) {
+	// Only a word that is looked up as written can ever match
+	unsigned flags = 0;
+	size_t len = strlen(name);
+	if (len == 0 || lex_scan_word(name, 0, &flags) != len || flags != 0 || strchr(name, '=')) return -1;
+	char *nv = strdup(value);
+	if (!nv) return -1;
+	Alias **link = find(name, len);
+	if (*link) {
+		free((*link)->value);
+		(*link)->value = nv;
+		return 0;
+	}
+	Alias *a = (Alias *)calloc(1, sizeof(Alias));
+	if (!a || !(a->name = strdup(name))) {
+		free(a);
+		free(nv);
+		return -1;
+	}
+	a->value = nv;
+	*link = a;
+	count++;
+	return 0;
+}
+
+bool alias_unset(const char *name) {
+	Alias **link = find(name, strlen(name));
+	Alias *a = *link;
+	if (!a) return false;
+	*link = a->next;
+	free(a->name);
+	free(a->value);
+	free(a);
+	count--;
+	return true;
+}
+
+void alias_clear(void) {
+	for (size_t i = 0; i < ALIAS_BUCKETS; ++i) {
+		while (buckets[i]) {
+			Alias *a = buckets[i];
+			buckets[i] = a->next;
+			free(a->name);
+			free(a->value);
+			free(a);
+		}
+	}
+	count = 0;
+}
+
+// Single-quoted so the output can be read back in
+static void print_alias(const Alias *a) {
+	printf("alias %s='", a->name);
+	for (const char *p = a->value; *p; ++p) {
+		if (*p == '\'') fputs("'\\''", stdout);
+		else putchar(*p);
+	}
+	printf("'\n");
+}
+
+bool alias_print(const char *name) {
+	Alias *a = *find(name, strlen(name));
+	if (!a) return false;
+	print_alias(a);
+	return true;
+}
+
+static int compare_aliases(const void *x, const void *y) {
+	return strcmp((*(Alias *const *)x)->name, (*(Alias *const *)y)->name);
+}
+
+void alias_print_all(void) {
+	if (count == 0) return;
+	Alias **all = (Alias **)malloc(count * sizeof(Alias *));
+	if (!all) return;
+	size_t n = 0;
+	for (size_t i = 0; i < ALIAS_BUCKETS; ++i) {
+		for (Alias *a = buckets[i]; a; a = a->next) all[n++] = a;
+	}
+	qsort(all, n, sizeof(Alias *), compare_aliases);
+	for (size_t i = 0; i < n; ++i) print_alias(all[i]);
+	free(all);
+}
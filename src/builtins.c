@@ -1,8 +1,15 @@
 #include "builtins.h"
+#include "alias.h"
+#include "events.h"
 #include "state.h"
 #include "executor.h"
 #include "jobs.h"
+#include "history.h"
+#include "parsecache.h"
+#include "vars.h"
 
+#include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,6 +18,7 @@
 #include <sys/stat.h>
 #include <limits.h>
 #include <signal.h>
+#include <sys/resource.h>
 
 static int compare_names(const void *a, const void *b) {
 	const char *const *sa = (const char *const *)a;
@@ -22,7 +30,7 @@ static int list_directory(const char *path, int flag_a, int flag_l) {
 	DIR *d = opendir(path ? path : ".");
 	if (!d) {
 		printf("No such directory!\n");
-		return 0;
+		return 1;
 	}
 	char **names = NULL;
 	size_t cap = 0, len = 0;
@@ -67,7 +75,7 @@ static int builtin_hop(int argc, char **argv) {
 
 	if (argc == 1) {
 		state_set_prev_cwd(cwd);
-		return chdir(state_get_home());
+		return chdir(state_get_home()) == 0 ? 0 : 1;
 	}
 	for (int i = 1; i < argc; ++i) {
 		const char *arg = argv[i];
@@ -93,14 +101,14 @@ static int builtin_hop(int argc, char **argv) {
 			state_set_prev_cwd(cwd);
 			if (chdir(state_get_home()) != 0) {
 				printf("No such directory!\n");
-				return 0;
+				return 1;
 			}
 			if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
 		} else {
 			state_set_prev_cwd(cwd);
 			if (chdir(arg) != 0) {
 				printf("No such directory!\n");
-				return 0;
+				return 1;
 			}
 			if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
 		}
@@ -129,7 +137,7 @@ static int builtin_reveal(int argc, char **argv) {
 	// Check for too many path arguments
 	if (path_count > 1) {
 		printf("reveal: Invalid Syntax!\n");
-		return 0;
+		return 1;
 	}
 	char target[PATH_MAX];
 	if (!path || strcmp(path, ".") == 0) {
@@ -150,7 +158,7 @@ static int builtin_reveal(int argc, char **argv) {
 		const char *prev = state_get_prev_cwd();
 		if (!prev || prev[0] == '\0') {
 			printf("No such directory!\n");
-			return 0;
+			return 1;
 		} else {
 			strncpy(target, prev, sizeof(target) - 1);
 			target[sizeof(target) - 1] = '\0';
@@ -183,10 +191,8 @@ static void history_print(void) {
 }
 
 static void history_purge(void) {
-    char path[PATH_MAX];
-    get_history_file(path, sizeof(path));
-    FILE *f = fopen(path, "w");
-    if (f) fclose(f);
+    history_clear();
+    history_purge_stats();
 }
 
 static int history_execute_index(int index) {
@@ -231,6 +237,10 @@ static int builtin_log(int argc, char **argv) {
         history_purge();
         return 0;
     }
+    if (argc == 2 && strcmp(argv[1], "stats") == 0) {
+        history_print_stats();
+        return 0;
+    }
     if (argc == 3 && strcmp(argv[1], "execute") == 0) {
         int idx = atoi(argv[2]);
         return history_execute_index(idx);
@@ -240,46 +250,96 @@ static int builtin_log(int argc, char **argv) {
 
 // Part E builtins
 
+static double parse_duration(const char *text);
+
+static void activities_tick(void *arg) {
+	*(bool *)arg = true;
+}
+
+// activities [-l] [-s COL[,COL...]] [-w [-n SEC]]: list the live jobs. -l adds
+// per-process CPU%, RSS, threads and elapsed time, -s sorts by the columns
+// (cmd, pid, state, cpu, rss, time), and -w redraws the list every SEC
+// seconds (1 by default) until Ctrl-C.
 static int builtin_activities(int argc, char **argv) {
-	if (argc != 1) {
-		return 0; // Wrong number of arguments
+	bool detailed = false, live = false;
+	double interval = 1;
+	ActivitySort keys[ACT_MAX_SORT_KEYS];
+	int nkeys = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-l") == 0) {
+			detailed = true;
+		} else if (strcmp(argv[i], "-w") == 0) {
+			live = true;
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			nkeys = jobs_parse_sort_keys(argv[++i], keys, ACT_MAX_SORT_KEYS);
+			if (nkeys < 0) {
+				printf("activities: invalid sort columns: %s\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			interval = parse_duration(argv[++i]);
+			if (interval <= 0) {
+				printf("activities: invalid interval\n");
+				return 1;
+			}
+		} else {
+			printf("Usage: activities [-l] [-s COL[,COL...]] [-w [-n SEC]]\n");
+			return 1;
+		}
+	}
+	if (!live) {
+		jobs_list_activities(keys, nkeys, detailed);
+		return 0;
+	}
+	bool tty = isatty(STDOUT_FILENO);
+	while (!interrupt_received) {
+		bool due = false;
+		int timer = events_timer_start(interval, activities_tick, &due);
+		if (timer < 0) return 1;
+		if (tty) printf("\x1b[H\x1b[2J");
+		printf("Every %.1fs: activities\n\n", interval);
+		jobs_list_activities(keys, nkeys, detailed);
+		fflush(stdout);
+		while (!due && !interrupt_received) {
+			if (events_poll(NULL, 0, -1) == EVENT_ERROR) interrupt_received = true;
+		}
+		if (!due) events_timer_cancel(timer);
 	}
-	jobs_list_activities();
 	return 0;
 }
 
 static int builtin_ping(int argc, char **argv) {
 	if (argc != 3) {
 		printf("Invalid syntax!\n");
-		return 0;
+		return 1;
 	}
 
 	// Validate signal number is a valid integer
 	const char *sig_str = argv[2];
-	if (*sig_str == '\0') { printf("Invalid syntax!\n"); return 0; }
+	if (*sig_str == '\0') { printf("Invalid syntax!\n"); return 1; }
 	for (const char *q = sig_str; *q; ++q) {
-		if (*q < '0' || *q > '9') { printf("Invalid syntax!\n"); return 0; }
+		if (*q < '0' || *q > '9') { printf("Invalid syntax!\n"); return 1; }
 	}
 	long sig_long = strtol(sig_str, NULL, 10);
-	if (sig_long < 0) { printf("Invalid syntax!\n"); return 0; }
+	if (sig_long < 0) { printf("Invalid syntax!\n"); return 1; }
 	int signal_num = (int)sig_long;
 	int actual_signal = signal_num % 32;
 
 	// Parse PID (accept decimal only). If invalid, treat as no such process.
 	const char *pid_str = argv[1];
-	if (*pid_str == '\0') { printf("No such process found\n"); return 0; }
+	if (*pid_str == '\0') { printf("No such process found\n"); return 1; }
 	for (const char *q = pid_str; *q; ++q) {
-		if (*q < '0' || *q > '9') { printf("No such process found\n"); return 0; }
+		if (*q < '0' || *q > '9') { printf("No such process found\n"); return 1; }
 	}
 	long pid_long = strtol(pid_str, NULL, 10);
-	if (pid_long <= 0) { printf("No such process found\n"); return 0; }
+	if (pid_long <= 0) { printf("No such process found\n"); return 1; }
 	pid_t pid = (pid_t)pid_long;
 
-	if (kill(pid, actual_signal) == 0) {
-		printf("Sent signal %d to process with pid %d\n", signal_num, (int)pid);
-	} else {
+	if (kill(pid, actual_signal) != 0) {
 		printf("No such process found\n");
+		return 1;
 	}
+	printf("Sent signal %d to process with pid %d\n", signal_num, (int)pid);
 	return 0;
 }
 
@@ -291,21 +351,21 @@ static int builtin_fg(int argc, char **argv) {
 		job_number = jobs_get_most_recent_job();
 		if (job_number == -1) {
 			printf("No such job\n");
-			return 0;
+			return 1;
 		}
 	} else if (argc == 2) {
 		job_number = atoi(argv[1]);
 		if (job_number <= 0) {
 			printf("No such job\n");
-			return 0;
+			return 1;
 		}
 	} else {
 		printf("Invalid syntax!\n");
-		return 0;
+		return 1;
 	}
 	
-	jobs_bring_to_foreground(job_number);
-	return 0;
+	int status = jobs_bring_to_foreground(job_number);
+	return status < 0 ? 1 : status;
 }
 
 static int builtin_bg(int argc, char **argv) {
@@ -316,55 +376,1113 @@ static int builtin_bg(int argc, char **argv) {
 		job_number = jobs_get_most_recent_job();
 		if (job_number == -1) {
 			printf("No such job\n");
-			return 0;
+			return 1;
 		}
 	} else if (argc == 2) {
 		job_number = atoi(argv[1]);
 		if (job_number <= 0) {
 			printf("No such job\n");
-			return 0;
+			return 1;
 		}
 	} else {
 		printf("Invalid syntax!\n");
-		return 0;
+		return 1;
 	}
 	
-	jobs_resume_background(job_number);
+	return jobs_resume_background(job_number) < 0 ? 1 : 0;
+}
+
+// queue [-p low|normal|high N]: list the background jobs waiting to be
+// admitted, in the order they will start, or change the priority of job N
+static int builtin_queue(int argc, char **argv) {
+	if (argc == 1) {
+		jobs_print_queue();
+		return 0;
+	}
+	if (argc != 4 || strcmp(argv[1], "-p") != 0) {
+		printf("Invalid syntax!\n");
+		return 1;
+	}
+	int level = jobs_parse_priority(argv[2]);
+	if (level < 0) {
+		printf("queue: invalid priority: %s\n", argv[2]);
+		return 1;
+	}
+	int job_number = atoi(argv[3][0] == '%' ? argv[3] + 1 : argv[3]);
+	if (job_number <= 0 || jobs_set_priority(job_number, level) != 0) {
+		printf("No such job\n");
+		return 1;
+	}
 	return 0;
 }
 
-bool try_handle_builtin(char **argv, int argc) {
-	if (argc <= 0 || !argv || !argv[0]) return false;
-	if (strcmp(argv[0], "hop") == 0) {
-		builtin_hop(argc, argv);
-		return true;
+// wait [-n] [%job | pid ...]: block until the named jobs have exited (every
+// running job when none is named); with -n, until the next one does
+static int builtin_wait(int argc, char **argv) {
+	bool any = false;
+	int first = 1;
+	if (first < argc && strcmp(argv[first], "-n") == 0) {
+		any = true;
+		first++;
+	}
+	int count = argc - first;
+	int *numbers = (int *)malloc((size_t)(count ? count : 1) * sizeof(int));
+	if (!numbers) return 1;
+	for (int i = 0; i < count; ++i) {
+		const char *arg = argv[first + i];
+		// %N names a job (jobs_wait checks it exists), a bare number one of its processes
+		bool is_spec = arg[0] == '%';
+		const char *digits = is_spec ? arg + 1 : arg;
+		char *end;
+		long v = strtol(digits, &end, 10);
+		bool valid = *digits && *end == '\0' && v > 0 && v <= INT_MAX;
+		if (valid && !is_spec) {
+			Job *job = jobs_get_by_pid((pid_t)v);
+			valid = job != NULL;
+			if (job) v = job->job_number;
+		}
+		if (!valid) {
+			printf("wait: %s: no such job\n", arg);
+			free(numbers);
+			return 127;
+		}
+		numbers[i] = (int)v;
+	}
+	int status = jobs_wait(numbers, count, any);
+	free(numbers);
+	return status;
+}
+
+static int builtin_export(int argc, char **argv) {
+	if (argc == 1) {
+		vars_print_exported();
+		return 0;
 	}
-	if (strcmp(argv[0], "reveal") == 0) {
-		builtin_reveal(argc, argv);
-		return true;
+	int status = 0;
+	for (int i = 1; i < argc; ++i) {
+		const char *eq = strchr(argv[i], '=');
+		size_t len = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+		char *name = strndup(argv[i], len);
+		if (!name) return 1;
+		if (vars_export(name, eq ? eq + 1 : NULL) != 0) {
+			printf("export: not a valid identifier: %s\n", argv[i]);
+			status = 1;
+		}
+		free(name);
 	}
-	if (strcmp(argv[0], "log") == 0) {
-		builtin_log(argc, argv);
-		return true;
+	return status;
+}
+
+// "64K", "1M", "2G" or plain bytes, at most max; "default" / "none" is 0.
+// Returns -1 when malformed.
+static long long parse_size(const char *text, long long max) {
+	if (strcmp(text, "default") == 0 || strcmp(text, "none") == 0) return 0;
+	char *end = NULL;
+	errno = 0;
+	long long value = strtoll(text, &end, 10);
+	if (errno != 0 || end == text || value < 0 || !isdigit((unsigned char)text[0])) return -1;
+	long long scale = 1;
+	const char *units = "KMG";
+	const char *u = *end ? strchr(units, toupper((unsigned char)*end)) : NULL;
+	if (u) {
+		for (const char *k = units; k <= u; ++k) scale *= 1024;
+		end++;
 	}
-	// Part E builtins
-	if (strcmp(argv[0], "activities") == 0) {
-		builtin_activities(argc, argv);
-		return true;
+	if (*end != '\0' || value > max / scale) return -1;
+	return value * scale;
+}
+
+static void print_size(const char *name, long long bytes, const char *zero) {
+	const long long g = 1024LL * 1024 * 1024, m = 1024 * 1024, k = 1024;
+	if (bytes == 0) printf("%s\t%s\n", name, zero);
+	else if (bytes % g == 0) printf("%s\t%lldG\n", name, bytes / g);
+	else if (bytes % m == 0) printf("%s\t%lldM\n", name, bytes / m);
+	else if (bytes % k == 0) printf("%s\t%lldK\n", name, bytes / k);
+	else printf("%s\t%lld\n", name, bytes);
+}
+
+// 'set name=value' for the settings that take one
+static int set_value(const char *name, const char *value) {
+	if (strcmp(name, "pipesize") == 0) {
+		long long bytes = parse_size(value, INT_MAX);
+		if (bytes < 0) {
+			printf("set: pipesize: invalid size: %s\n", value);
+			return 1;
+		}
+		if (execute_set_pipe_size((int)bytes) < 0) {
+			printf("set: pipesize: %s: %s\n", value, strerror(errno));
+			return 1;
+		}
+		return 0;
+	}
+	if (strcmp(name, "minmem") == 0) {
+		long long bytes = parse_size(value, LLONG_MAX);
+		if (bytes < 0) {
+			printf("set: minmem: invalid size: %s\n", value);
+			return 1;
+		}
+		state_set_min_mem(bytes);
+		jobs_admit();
+		return 0;
+	}
+	if (strcmp(name, "maxjobs") == 0) {
+		char *end = NULL;
+		long n = strtol(value, &end, 10);
+		if (strcmp(value, "none") == 0) n = 0;
+		else if (!isdigit((unsigned char)value[0]) || *end || n > INT_MAX) {
+			printf("set: maxjobs: invalid number: %s\n", value);
+			return 1;
+		}
+		state_set_max_jobs((int)n);
+		jobs_admit();
+		return 0;
+	}
+	if (strcmp(name, "maxload") == 0) {
+		char *end = NULL;
+		double load = strtod(value, &end);
+		if (strcmp(value, "none") == 0) load = 0.0;
+		else if (!isdigit((unsigned char)value[0]) || *end) {
+			printf("set: maxload: invalid load: %s\n", value);
+			return 1;
+		}
+		state_set_max_load(load);
+		jobs_admit();
+		return 0;
+	}
+	if (strcmp(name, "jobprio") == 0) {
+		int level = jobs_parse_priority(value);
+		if (level < 0) {
+			printf("set: jobprio: invalid priority: %s\n", value);
+			return 1;
+		}
+		state_set_job_priority(level);
+		return 0;
 	}
-	if (strcmp(argv[0], "ping") == 0) {
-		builtin_ping(argc, argv);
-		return true;
+	printf("set: invalid option: %s\n", name);
+	return 1;
+}
+
+static int builtin_set(int argc, char **argv) {
+	if (argc == 1 || (argc == 2 && strcmp(argv[1], "-o") == 0)) {
+		printf("pipefail\t%s\n", state_get_pipefail() ? "on" : "off");
+		printf("pipemon\t\t%s\n", state_get_pipemon() ? "on" : "off");
+		print_size("pipesize", state_get_pipe_size(), "default");
+		if (state_get_max_jobs() > 0) printf("maxjobs\t\t%d\n", state_get_max_jobs());
+		else printf("maxjobs\t\tnone\n");
+		if (state_get_max_load() > 0) printf("maxload\t\t%.2f\n", state_get_max_load());
+		else printf("maxload\t\tnone\n");
+		print_size("minmem\t", state_get_min_mem(), "none");
+		printf("jobprio\t\t%s\n", jobs_priority_name(state_get_job_priority()));
+		return 0;
+	}
+	const char *eq = argc == 2 ? strchr(argv[1], '=') : NULL;
+	if (eq) {
+		char *name = strndup(argv[1], (size_t)(eq - argv[1]));
+		if (!name) return 1;
+		int status = set_value(name, eq + 1);
+		free(name);
+		return status;
+	}
+	if (argc == 3 && (strcmp(argv[1], "-o") == 0 || strcmp(argv[1], "+o") == 0)) {
+		if (strcmp(argv[2], "pipefail") == 0) {
+			state_set_pipefail(argv[1][0] == '-');
+			return 0;
+		}
+		if (strcmp(argv[2], "pipemon") == 0) {
+			state_set_pipemon(argv[1][0] == '-');
+			return 0;
+		}
+	}
+	printf("set: invalid option: %s\n", argc > 2 ? argv[2] : argv[1]);
+	return 1;
+}
+
+static int builtin_alias(int argc, char **argv) {
+	if (argc == 1) {
+		alias_print_all();
+		return 0;
+	}
+	int status = 0;
+	bool changed = false;
+	for (int i = 1; i < argc; ++i) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq) {
+			if (!alias_print(argv[i])) {
+				printf("alias: %s: not found\n", argv[i]);
+				status = 1;
+			}
+			continue;
+		}
+		char *name = strndup(argv[i], (size_t)(eq - argv[i]));
+		if (!name) return 1;
+		if (alias_set(name, eq + 1) != 0) {
+			printf("alias: invalid alias name: %s\n", name);
+			status = 1;
+		} else {
+			changed = true;
+		}
+		free(name);
 	}
-	if (strcmp(argv[0], "fg") == 0) {
-		builtin_fg(argc, argv);
-		return true;
+	// Cached parses were made with the old definitions
+	if (changed) parse_cache_invalidate();
+	return status;
+}
+
+static int builtin_unalias(int argc, char **argv) {
+	if (argc == 1) {
+		printf("unalias: usage: unalias [-a] name ...\n");
+		return 1;
+	}
+	int status = 0;
+	if (strcmp(argv[1], "-a") == 0) {
+		alias_clear();
+	} else {
+		for (int i = 1; i < argc; ++i) {
+			if (!alias_unset(argv[i])) {
+				printf("unalias: %s: not found\n", argv[i]);
+				status = 1;
+			}
+		}
 	}
-	if (strcmp(argv[0], "bg") == 0) {
-		builtin_bg(argc, argv);
-		return true;
+	parse_cache_invalidate();
+	return status;
+}
+
+static int builtin_stats(int argc, char **argv) {
+	if (argc != 1) {
+		printf("stats: too many arguments\n");
+		return 1;
+	}
+	parse_cache_print_stats();
+	return 0;
+}
+
+// Scripting primitives below run in the shell (or the pipeline stage's child)
+// instead of costing a fork and exec each. They write to stdout through stdio;
+// the executor flushes it before forking and around in-shell redirections.
+
+static int builtin_true(int argc, char **argv) {
+	return 0;
+}
+
+static int builtin_false(int argc, char **argv) {
+	return 1;
+}
+
+// Backslash escape of echo -e, printf formats and %b, with s just past the
+// backslash. Stores the byte in *out and returns how many characters of s it
+// used; 0 means the backslash stands for itself. Returns -1 for \c.
+static int decode_escape(const char *s, char *out) {
+	static const char names[] = "abefnrtv\\";
+	static const char bytes[] = "\a\b\033\f\n\r\t\v\\";
+	const char *hit = *s ? strchr(names, *s) : NULL;
+	if (hit) {
+		*out = bytes[hit - names];
+		return 1;
+	}
+	if (*s == 'c') return -1;
+	int used = 0, value = 0;
+	if (*s == 'x') {
+		for (used = 1; used < 3 && isxdigit((unsigned char)s[used]); ++used) {
+			value = value * 16 + (isdigit((unsigned char)s[used]) ? s[used] - '0' : tolower((unsigned char)s[used]) - 'a' + 10);
+		}
+		if (used == 1) used = 0;
+	} else if (*s >= '0' && *s <= '7') {
+		// \0nnn as echo writes it, or \nnn as printf does
+		int max = *s == '0' ? 4 : 3;
+		for (; used < max && s[used] >= '0' && s[used] <= '7'; ++used) value = value * 8 + (s[used] - '0');
+	}
+	*out = used ? (char)value : '\\';
+	return used;
+}
+
+// Write s with its escapes decoded; returns false once a \c stops all output
+static bool put_escaped(const char *s) {
+	while (*s) {
+		if (*s != '\\') {
+			putchar(*s++);
+			continue;
+		}
+		char ch;
+		int used = decode_escape(s + 1, &ch);
+		if (used < 0) return false;
+		putchar(ch);
+		s += 1 + used;
+	}
+	return true;
+}
+
+static int builtin_echo(int argc, char **argv) {
+	bool newline = true, escapes = false;
+	int i = 1;
+	// Only words made entirely of n, e and E count as options
+	for (; i < argc && argv[i][0] == '-' && argv[i][1] && !argv[i][1 + strspn(argv[i] + 1, "neE")]; ++i) {
+		for (const char *f = argv[i] + 1; *f; ++f) {
+			if (*f == 'n') newline = false;
+			else escapes = *f == 'e';
+		}
+	}
+	for (int first = i; i < argc; ++i) {
+		if (i > first) putchar(' ');
+		if (!escapes) fputs(argv[i], stdout);
+		else if (!put_escaped(argv[i])) return 0;
+	}
+	if (newline) putchar('\n');
+	return 0;
+}
+
+// printf's numeric argument: decimal, 0x hex, 0 octal, or 'c for a character code
+static long long printf_number(const char *arg, int *status) {
+	if (!arg || !*arg) return 0;
+	if (arg[0] == '\'' || arg[0] == '"') return (unsigned char)arg[1];
+	char *end;
+	errno = 0;
+	long long v = strtoll(arg, &end, 0);
+	if (errno != 0 || *end != '\0') {
+		printf("printf: %s: invalid number\n", arg);
+		*status = 1;
+	}
+	return v;
+}
+
+// printf format [arguments]: %[flags][width][.precision] with d i o u x X c s b
+// and %%. The format is reused while arguments remain; missing ones read as
+// empty or zero.
+static int builtin_printf(int argc, char **argv) {
+	if (argc < 2) {
+		printf("printf: usage: printf format [arguments]\n");
+		return 1;
+	}
+	const char *fmt = argv[1];
+	int next = 2, status = 0;
+	for (;;) {
+		int pass_start = next;
+		for (const char *p = fmt; *p;) {
+			if (*p == '\\') {
+				char ch;
+				int used = decode_escape(p + 1, &ch);
+				if (used < 0) return status;
+				putchar(ch);
+				p += 1 + used;
+				continue;
+			}
+			if (*p != '%' || p[1] == '%') {
+				putchar(*p);
+				p += *p == '%' ? 2 : 1;
+				continue;
+			}
+			const char *q = p + 1;
+			q += strspn(q, "-+ #0");
+			q += strspn(q, "0123456789");
+			if (*q == '.') q += 1 + strspn(q + 1, "0123456789");
+			char spec[32];
+			size_t speclen = (size_t)(q - p);
+			if (*q == '\0' || !strchr("diouxXcsb", *q) || speclen + 4 > sizeof(spec)) {
+				printf("printf: %.*s: invalid format\n", (int)(speclen + (*q != '\0')), p);
+				return 1;
+			}
+			const char *arg = next < argc ? argv[next++] : NULL;
+			memcpy(spec, p, speclen);
+			switch (*q) {
+			case 'd':
+			case 'i':
+				memcpy(spec + speclen, "lld", 4);
+				printf(spec, printf_number(arg, &status));
+				break;
+			case 'o':
+			case 'u':
+			case 'x':
+			case 'X':
+				spec[speclen] = 'l';
+				spec[speclen + 1] = 'l';
+				spec[speclen + 2] = *q;
+				spec[speclen + 3] = '\0';
+				printf(spec, (unsigned long long)printf_number(arg, &status));
+				break;
+			case 'c': {
+				char one[2] = { arg ? arg[0] : '\0', '\0' };
+				memcpy(spec + speclen, "s", 2);
+				printf(spec, one);
+				break;
+			}
+			case 's':
+				memcpy(spec + speclen, "s", 2);
+				printf(spec, arg ? arg : "");
+				break;
+			default: // 'b': an argument with escapes; width and precision are ignored
+				if (arg && !put_escaped(arg)) return status;
+				break;
+			}
+			p = q + 1;
+		}
+		// Another pass only while it keeps consuming arguments
+		if (next >= argc || next == pass_start) break;
+	}
+	return status;
+}
+
+// test expression over argv[pos..argc), evaluated by recursive descent:
+// -o binds looser than -a, which binds looser than '!'; '(' ')' group.
+typedef struct {
+	const char *name;
+	char **argv;
+	int argc;
+	int pos;
+	bool error;
+} TestExpr;
+
+static bool test_or(TestExpr *t);
+
+static bool test_is_unary(const char *s) {
+	return s[0] == '-' && s[1] && !s[2] && strchr("bcdefghknprsStuwxzL", s[1]);
+}
+
+static bool test_is_binary(const char *s) {
+	static const char *const ops[] = { "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt",
+	                                   "-ge", "-nt", "-ot", "-ef", NULL };
+	for (int i = 0; ops[i]; ++i) {
+		if (strcmp(s, ops[i]) == 0) return true;
 	}
 	return false;
 }
 
+static long long test_integer(TestExpr *t, const char *s) {
+	char *end;
+	errno = 0;
+	long long v = strtoll(s, &end, 10);
+	while (*end == ' ' || *end == '\t') ++end;
+	if (errno != 0 || end == s || *end != '\0') {
+		if (!t->error) printf("%s: %s: integer expression expected\n", t->name, s);
+		t->error = true;
+	}
+	return v;
+}
+
+static bool test_unary(char op, const char *arg) {
+	struct stat st;
+	switch (op) {
+	case 'n': return arg[0] != '\0';
+	case 'z': return arg[0] == '\0';
+	case 't': return isatty(atoi(arg));
+	case 'r': return access(arg, R_OK) == 0;
+	case 'w': return access(arg, W_OK) == 0;
+	case 'x': return access(arg, X_OK) == 0;
+	case 'h':
+	case 'L': return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+	default: break;
+	}
+	if (stat(arg, &st) != 0) return false;
+	switch (op) {
+	case 'b': return S_ISBLK(st.st_mode);
+	case 'c': return S_ISCHR(st.st_mode);
+	case 'd': return S_ISDIR(st.st_mode);
+	case 'f': return S_ISREG(st.st_mode);
+	case 'p': return S_ISFIFO(st.st_mode);
+	case 'S': return S_ISSOCK(st.st_mode);
+	case 's': return st.st_size > 0;
+	case 'g': return (st.st_mode & S_ISGID) != 0;
+	case 'u': return (st.st_mode & S_ISUID) != 0;
+	case 'k': return (st.st_mode & S_ISVTX) != 0;
+	default: return true; // -e
+	}
+}
+
+static bool test_binary(TestExpr *t, const char *a, const char *op, const char *b) {
+	if (op[0] != '-') {
+		int cmp = strcmp(a, b);
+		if (op[0] == '!') return cmp != 0;
+		if (op[0] == '<') return cmp < 0;
+		if (op[0] == '>') return cmp > 0;
+		return cmp == 0;
+	}
+	if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+		struct stat sa, sb;
+		bool ha = stat(a, &sa) == 0, hb = stat(b, &sb) == 0;
+		if (op[1] == 'e') return ha && hb && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+		if (!ha || !hb) return op[1] == 'n' ? ha : hb; // an existing file is newer than a missing one
+		struct timespec ta = sa.st_mtim, tb = sb.st_mtim;
+		if (op[1] == 'o') {
+			ta = sb.st_mtim;
+			tb = sa.st_mtim;
+		}
+		return ta.tv_sec > tb.tv_sec || (ta.tv_sec == tb.tv_sec && ta.tv_nsec > tb.tv_nsec);
+	}
+	long long x = test_integer(t, a), y = test_integer(t, b);
+	if (strcmp(op, "-eq") == 0) return x == y;
+	if (strcmp(op, "-ne") == 0) return x != y;
+	if (strcmp(op, "-lt") == 0) return x < y;
+	if (strcmp(op, "-le") == 0) return x <= y;
+	if (strcmp(op, "-gt") == 0) return x > y;
+	return x >= y;
+}
+
+static bool test_primary(TestExpr *t) {
+	if (t->pos >= t->argc) {
+		if (!t->error) printf("%s: argument expected\n", t->name);
+		t->error = true;
+		return false;
+	}
+	char **v = t->argv + t->pos;
+	int left = t->argc - t->pos;
+	// "a = b" wins over the other readings of its first word, e.g. "-n = x"
+	if (left >= 3 && test_is_binary(v[1])) {
+		t->pos += 3;
+		return test_binary(t, v[0], v[1], v[2]);
+	}
+	if (left >= 2 && strcmp(v[0], "(") == 0) {
+		t->pos++;
+		bool r = test_or(t);
+		if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")") != 0) {
+			if (!t->error) printf("%s: ')' expected\n", t->name);
+			t->error = true;
+			return false;
+		}
+		t->pos++;
+		return r;
+	}
+	if (left >= 2 && test_is_unary(v[0])) {
+		t->pos += 2;
+		return test_unary(v[0][1], v[1]);
+	}
+	t->pos++;
+	return v[0][0] != '\0';
+}
+
+static bool test_not(TestExpr *t) {
+	if (t->pos + 1 < t->argc && strcmp(t->argv[t->pos], "!") == 0 &&
+	    !(t->pos + 2 < t->argc && test_is_binary(t->argv[t->pos + 1]))) {
+		t->pos++;
+		return !test_not(t);
+	}
+	return test_primary(t);
+}
+
+static bool test_and(TestExpr *t) {
+	bool r = test_not(t);
+	while (!t->error && t->pos + 1 < t->argc && strcmp(t->argv[t->pos], "-a") == 0) {
+		t->pos++;
+		r = test_not(t) && r;
+	}
+	return r;
+}
+
+static bool test_or(TestExpr *t) {
+	bool r = test_and(t);
+	while (!t->error && t->pos + 1 < t->argc && strcmp(t->argv[t->pos], "-o") == 0) {
+		t->pos++;
+		r = test_and(t) || r;
+	}
+	return r;
+}
+
+// test expr / [ expr ]: 0 when true, 1 when false, 2 on a malformed expression
+static int builtin_test(int argc, char **argv) {
+	if (strcmp(argv[0], "[") == 0) {
+		if (strcmp(argv[argc - 1], "]") != 0) {
+			printf("[: missing ']'\n");
+			return 2;
+		}
+		argc--;
+	}
+	if (argc == 1) return 1;
+	TestExpr t = { argv[0], argv, argc, 1, false };
+	bool r = test_or(&t);
+	if (!t.error && t.pos < argc) {
+		printf("%s: %s: unexpected argument\n", t.name, argv[t.pos]);
+		t.error = true;
+	}
+	return t.error ? 2 : r ? 0 : 1;
+}
+
+// Append one byte to the line read so far
+static int read_push(char **buf, bool **lit, size_t *len, size_t *cap, char ch, bool literal) {
+	if (*len == *cap) {
+		size_t ncap = *cap ? *cap * 2 : 128;
+		char *nb = (char *)realloc(*buf, ncap);
+		if (!nb) return -1;
+		*buf = nb;
+		bool *nl = (bool *)realloc(*lit, ncap * sizeof(bool));
+		if (!nl) return -1;
+		*lit = nl;
+		*cap = ncap;
+	}
+	(*buf)[*len] = ch;
+	(*lit)[*len] = literal;
+	(*len)++;
+	return 0;
+}
+
+static bool is_field_sep(const char *ifs, char ch, bool literal) {
+	return !literal && ch != '\0' && strchr(ifs, ch) != NULL;
+}
+
+// read [-r] [name ...]: one line of standard input, split on IFS characters
+// into the names, the last one taking the rest of the line; with no names the
+// whole line goes to REPLY. Without -r a backslash quotes the next character
+// and joins lines. Bytes are read one at a time so that nothing after the
+// line is taken from a shared input. Returns 1 at end of input.
+static int builtin_read(int argc, char **argv) {
+	bool raw = false;
+	int first = 1;
+	if (first < argc && strcmp(argv[first], "-r") == 0) {
+		raw = true;
+		first++;
+	}
+	for (int i = first; i < argc; ++i) {
+		if (!vars_is_valid_name(argv[i], strlen(argv[i]))) {
+			printf("read: not a valid identifier: %s\n", argv[i]);
+			return 1;
+		}
+	}
+	// A prompt written just before must show before we block
+	fflush(stdout);
+	// Waiting goes through the event loop so Ctrl-C can end it; a regular
+	// file never blocks and is read directly
+	struct stat st;
+	bool can_block = fstat(STDIN_FILENO, &st) != 0 || !S_ISREG(st.st_mode);
+
+	char *line = NULL;
+	bool *lit = NULL;
+	size_t len = 0, cap = 0;
+	bool newline = false, escaped = false;
+	for (;;) {
+		if (can_block && events_wait_fd(STDIN_FILENO, -1) == EVENT_HANDLED) {
+			if (interrupt_received) break;
+			continue;
+		}
+		char ch;
+		ssize_t r = read(STDIN_FILENO, &ch, 1);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) break;
+		if (escaped) {
+			escaped = false;
+			if (ch == '\n') continue;
+			if (read_push(&line, &lit, &len, &cap, ch, true) != 0) break;
+			continue;
+		}
+		if (ch == '\n') {
+			newline = true;
+			break;
+		}
+		if (ch == '\\' && !raw) {
+			escaped = true;
+			continue;
+		}
+		if (read_push(&line, &lit, &len, &cap, ch, false) != 0) break;
+	}
+	if (interrupt_received) {
+		free(line);
+		free(lit);
+		return 1;
+	}
+
+	int status = newline ? 0 : 1;
+	if (first == argc) {
+		char *value = strndup(line ? line : "", len);
+		if (!value || vars_set("REPLY", value) != 0) status = 1;
+		free(value);
+	}
+	const char *ifs = vars_get("IFS");
+	if (!ifs) ifs = " \t\n";
+	size_t pos = 0;
+	for (int i = first; i < argc; ++i) {
+		size_t start = pos;
+		while (start < len && is_field_sep(ifs, line[start], lit[start])) start++;
+		size_t end = start;
+		if (i + 1 == argc) {
+			end = len;
+			while (end > start && is_field_sep(ifs, line[end - 1], lit[end - 1])) end--;
+		} else {
+			while (end < len && !is_field_sep(ifs, line[end], lit[end])) end++;
+		}
+		pos = end;
+		char *value = strndup(line ? line + start : "", end - start);
+		if (!value || vars_set(argv[i], value) != 0) status = 1;
+		free(value);
+	}
+	free(line);
+	free(lit);
+	return status;
+}
+
+// Seconds with an optional s, m, h or d suffix; -1 when malformed
+static double parse_duration(const char *text) {
+	char *end;
+	errno = 0;
+	double value = strtod(text, &end);
+	if (end == text || errno != 0 || value < 0) return -1;
+	double unit = 1;
+	switch (*end) {
+	case '\0':
+	case 's': break;
+	case 'm': unit = 60; break;
+	case 'h': unit = 3600; break;
+	case 'd': unit = 86400; break;
+	default: return -1;
+	}
+	if (*end && end[1]) return -1;
+	return value * unit;
+}
+
+static const struct {
+	const char *name;
+	int sig;
+} signal_names[] = {
+	{ "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT }, { "KILL", SIGKILL },
+	{ "USR1", SIGUSR1 }, { "USR2", SIGUSR2 }, { "ALRM", SIGALRM }, { "TERM", SIGTERM },
+	{ "CONT", SIGCONT }, { "STOP", SIGSTOP },
+};
+
+// Signal number or name, with or without the SIG prefix; -1 if unknown
+static int parse_signal(const char *text) {
+	if (isdigit((unsigned char)text[0])) {
+		char *end;
+		long n = strtol(text, &end, 10);
+		return *end == '\0' && n > 0 && n <= 64 ? (int)n : -1; // up to SIGRTMAX
+	}
+	if (strncmp(text, "SIG", 3) == 0) text += 3;
+	for (size_t i = 0; i < sizeof(signal_names) / sizeof(signal_names[0]); ++i) {
+		if (strcmp(text, signal_names[i].name) == 0) return signal_names[i].sig;
+	}
+	return -1;
+}
+
+// timeout [-s SIG] DURATION command [arg ...]: run the command as a job and
+// send its process group SIG (TERM by default) once DURATION has passed. The
+// deadline is a timer in the shell's event loop and stays with the job if it
+// is stopped. Returns 124 when it fired, 125 on a usage error.
+static int builtin_timeout(int argc, char **argv) {
+	int sig = SIGTERM;
+	int first = 1;
+	if (first < argc && strcmp(argv[first], "-s") == 0) {
+		if (first + 1 >= argc || (sig = parse_signal(argv[first + 1])) < 0) {
+			printf("timeout: invalid signal\n");
+			return 125;
+		}
+		first += 2;
+	}
+	if (argc - first < 2) {
+		printf("Usage: timeout [-s SIG] DURATION command [arg ...]\n");
+		return 125;
+	}
+	double seconds = parse_duration(argv[first]);
+	if (seconds < 0) {
+		printf("timeout: invalid duration: %s\n", argv[first]);
+		return 125;
+	}
+	// Zero disables the limit, as with coreutils
+	if (seconds == 0) seconds = 1e9;
+	GroupLaunch launch = { seconds, sig, NULL };
+	return execute_launch(argv + first + 1, argc - first - 1, &launch);
+}
+
+// "0-3,8" into the affinity mask; false when malformed or out of range
+static bool parse_cpu_list(const char *text, JobLimits *limits) {
+	const size_t bits = 8 * sizeof(unsigned long);
+	const char *p = text;
+	do {
+		char *end;
+		if (!isdigit((unsigned char)*p)) return false;
+		long lo = strtol(p, &end, 10), hi = lo;
+		if (*end == '-') {
+			p = end + 1;
+			if (!isdigit((unsigned char)*p)) return false;
+			hi = strtol(p, &end, 10);
+		}
+		if (lo > hi || hi >= JOB_MAX_CPUS) return false;
+		for (long cpu = lo; cpu <= hi; ++cpu) limits->cpus[cpu / bits] |= 1UL << (cpu % bits);
+		p = end;
+	} while (*p++ == ',');
+	return p[-1] == '\0';
+}
+
+// run [--cpus LIST] [--nice N] [--mem SIZE] command [arg ...]: run the command
+// as a job pinned to the CPUs in LIST (e.g. 0-3,8), at niceness N and with its
+// address space capped at SIZE (e.g. 2G). The child sets these up itself
+// between fork and exec, and 'activities' lists them. 125 on a usage error.
+static int builtin_run(int argc, char **argv) {
+	JobLimits limits;
+	memset(&limits, 0, sizeof(limits));
+	int first = 1;
+	while (first + 1 < argc && strncmp(argv[first], "--", 2) == 0) {
+		const char *opt = argv[first] + 2;
+		const char *value = argv[first + 1];
+		if (strcmp(opt, "cpus") == 0) {
+			memset(limits.cpus, 0, sizeof(limits.cpus));
+			if (!parse_cpu_list(value, &limits)) {
+				printf("run: invalid CPU list: %s\n", value);
+				return 125;
+			}
+			limits.cpus_spec = argv[first + 1];
+		} else if (strcmp(opt, "nice") == 0) {
+			char *end;
+			long n = strtol(value, &end, 10);
+			if (end == value || *end || n < -20 || n > 19) {
+				printf("run: invalid nice value: %s\n", value);
+				return 125;
+			}
+			limits.set_nice = true;
+			limits.nice = (int)n;
+		} else if (strcmp(opt, "mem") == 0) {
+			long long bytes = parse_size(value, LLONG_MAX);
+			if (bytes <= 0) {
+				printf("run: invalid size: %s\n", value);
+				return 125;
+			}
+			limits.mem = bytes;
+		} else {
+			break;
+		}
+		first += 2;
+	}
+	if (first >= argc || strncmp(argv[first], "--", 2) == 0) {
+		printf("Usage: run [--cpus LIST] [--nice N] [--mem SIZE] command [arg ...]\n");
+		return 125;
+	}
+	GroupLaunch launch = { 0, 0, &limits };
+	return execute_launch(argv + first, argc - first, &launch);
+}
+
+// Resources 'ulimit' knows; sizes are shown and given in units of scale bytes
+static const struct {
+	char opt;
+	int resource;
+	long long scale;
+	const char *desc;
+	const char *unit;
+} ulimit_table[] = {
+	{ 'c', RLIMIT_CORE, 1024, "core file size", "kbytes" },
+	{ 'd', RLIMIT_DATA, 1024, "data seg size", "kbytes" },
+	{ 'f', RLIMIT_FSIZE, 1024, "file size", "kbytes" },
+	{ 'l', RLIMIT_MEMLOCK, 1024, "max locked memory", "kbytes" },
+	{ 'n', RLIMIT_NOFILE, 1, "open files", "count" },
+	{ 's', RLIMIT_STACK, 1024, "stack size", "kbytes" },
+	{ 't', RLIMIT_CPU, 1, "cpu time", "seconds" },
+	{ 'u', RLIMIT_NPROC, 1, "max user processes", "count" },
+	{ 'v', RLIMIT_AS, 1024, "virtual memory", "kbytes" },
+};
+
+#define ULIMIT_COUNT (sizeof(ulimit_table) / sizeof(ulimit_table[0]))
+
+static void ulimit_print(size_t i, bool hard, bool labelled) {
+	struct rlimit rl;
+	if (getrlimit(ulimit_table[i].resource, &rl) != 0) return;
+	rlim_t v = hard ? rl.rlim_max : rl.rlim_cur;
+	if (labelled) printf("%-24s(%s, -%c) ", ulimit_table[i].desc, ulimit_table[i].unit, ulimit_table[i].opt);
+	if (v == RLIM_INFINITY) printf("unlimited\n");
+	else printf("%llu\n", (unsigned long long)v / (unsigned long long)ulimit_table[i].scale);
+}
+
+// ulimit [-H | -S] [-a | -RESOURCE [LIMIT | unlimited]]: show or set the
+// shell's resource limits, which everything it starts inherits. Without
+// -H / -S a new limit sets both; -f is the default resource.
+static int builtin_ulimit(int argc, char **argv) {
+	bool hard = false, soft = false, all = false;
+	size_t which = 2; // -f
+	int first = 1;
+	for (; first < argc && argv[first][0] == '-' && argv[first][1]; ++first) {
+		for (const char *o = argv[first] + 1; *o; ++o) {
+			if (*o == 'H') hard = true;
+			else if (*o == 'S') soft = true;
+			else if (*o == 'a') all = true;
+			else {
+				size_t i = 0;
+				while (i < ULIMIT_COUNT && ulimit_table[i].opt != *o) i++;
+				if (i == ULIMIT_COUNT) {
+					printf("ulimit: invalid option: -%c\n", *o);
+					return 1;
+				}
+				which = i;
+			}
+		}
+	}
+	if (all) {
+		for (size_t i = 0; i < ULIMIT_COUNT; ++i) ulimit_print(i, hard && !soft, true);
+		return 0;
+	}
+	if (first == argc) {
+		ulimit_print(which, hard && !soft, false);
+		return 0;
+	}
+	if (first + 1 != argc) {
+		printf("Invalid syntax!\n");
+		return 1;
+	}
+	rlim_t value;
+	if (strcmp(argv[first], "unlimited") == 0) {
+		value = RLIM_INFINITY;
+	} else {
+		char *end;
+		errno = 0;
+		unsigned long long n = strtoull(argv[first], &end, 10);
+		if (!isdigit((unsigned char)argv[first][0]) || *end || errno != 0 ||
+		    n > (unsigned long long)RLIM_INFINITY / (unsigned long long)ulimit_table[which].scale) {
+			printf("ulimit: invalid limit: %s\n", argv[first]);
+			return 1;
+		}
+		value = (rlim_t)(n * (unsigned long long)ulimit_table[which].scale);
+	}
+	struct rlimit rl;
+	if (getrlimit(ulimit_table[which].resource, &rl) != 0) rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+	if (!soft || hard) rl.rlim_max = value;
+	if (!hard || soft) rl.rlim_cur = value;
+	if (setrlimit(ulimit_table[which].resource, &rl) != 0) {
+		printf("ulimit: %s: %s\n", argv[first], strerror(errno));
+		return 1;
+	}
+	return 0;
+}
+
+static void watch_tick(void *arg) {
+	*(bool *)arg = true;
+}
+
+// Print output, highlighting the lines that differ from the same line of prev
+static void watch_show(const char *out, const char *prev, bool highlight) {
+	const char *p = out ? out : "";
+	const char *q = prev;
+	while (*p) {
+		const char *eol = strchr(p, '\n');
+		size_t n = eol ? (size_t)(eol - p) : strlen(p);
+		bool changed = false;
+		if (q) {
+			const char *qeol = strchr(q, '\n');
+			size_t qn = qeol ? (size_t)(qeol - q) : strlen(q);
+			changed = qn != n || memcmp(p, q, n) != 0;
+			q = qeol ? qeol + 1 : q + qn;
+		}
+		if (highlight && changed) printf("\x1b[7m%.*s\x1b[0m\n", (int)n, p);
+		else printf("%.*s\n", (int)n, p);
+		p += n + (eol ? 1 : 0);
+	}
+}
+
+// watch [-n SEC] command ...: run the command line every SEC seconds (2 by
+// default) until Ctrl-C. It is parsed once and rerun from its parsed form; on
+// a terminal the screen is redrawn each time, lines that changed since the
+// previous run shown in reverse video.
+static int builtin_watch(int argc, char **argv) {
+	double interval = 2;
+	int first = 1;
+	if (first < argc && strcmp(argv[first], "-n") == 0) {
+		if (first + 1 >= argc || (interval = parse_duration(argv[first + 1])) <= 0) {
+			printf("watch: invalid interval\n");
+			return 1;
+		}
+		first += 2;
+	}
+	if (first >= argc) {
+		printf("Usage: watch [-n SEC] command ...\n");
+		return 1;
+	}
+	size_t total = 0;
+	for (int i = first; i < argc; ++i) total += strlen(argv[i]) + 1;
+	char *line = (char *)malloc(total);
+	if (!line) return 1;
+	line[0] = '\0';
+	for (int i = first; i < argc; ++i) {
+		if (i > first) strcat(line, " ");
+		strcat(line, argv[i]);
+	}
+	CmdSequence *seq = parse_cache_acquire(line);
+	if (!seq || seq->count <= 0) {
+		printf("watch: invalid command: %s\n", line);
+		parse_cache_release(seq);
+		free(line);
+		return 1;
+	}
+
+	bool tty = isatty(STDOUT_FILENO);
+	char *prev = NULL;
+	int status = 0;
+	while (!interrupt_received) {
+		// The next run is due one interval after this one started
+		bool due = false;
+		int timer = events_timer_start(interval, watch_tick, &due);
+		if (timer < 0) {
+			status = 1;
+			break;
+		}
+		char *out = NULL;
+		size_t len = 0;
+		status = execute_captured(seq, &out, &len);
+		if (tty) printf("\x1b[H\x1b[2J");
+		printf("Every %.1fs: %s\n\n", interval, line);
+		watch_show(out, prev, tty && prev);
+		fflush(stdout);
+		free(prev);
+		prev = out ? out : strdup("");
+		while (!due && !interrupt_received) {
+			if (events_poll(NULL, 0, -1) == EVENT_ERROR) interrupt_received = true;
+		}
+		if (!due) events_timer_cancel(timer);
+	}
+	free(prev);
+	parse_cache_release(seq);
+	free(line);
+	return status;
+}
+
+typedef struct {
+	const char *name;
+	int (*run)(int argc, char **argv);
+	bool pure; // only prints: changes no shell state, so it needs no subshell
+} BuiltinEntry;
+
+static const BuiltinEntry builtin_table[] = {
+	{ "hop", builtin_hop, false },
+	{ "reveal", builtin_reveal, true },
+	{ "log", builtin_log, false },
+	// Part E builtins
+	// Not pure: -w redraws until Ctrl-C and -l keeps the sampler's state
+	{ "activities", builtin_activities, false },
+	{ "ping", builtin_ping, true },
+	{ "fg", builtin_fg, false },
+	{ "bg", builtin_bg, false },
+	{ "wait", builtin_wait, false },
+	{ "queue", builtin_queue, false },
+	{ "export", builtin_export, false },
+	{ "set", builtin_set, false },
+	{ "alias", builtin_alias, false },
+	{ "unalias", builtin_unalias, false },
+	{ "stats", builtin_stats, true },
+	{ "echo", builtin_echo, true },
+	{ "printf", builtin_printf, true },
+	{ "test", builtin_test, true },
+	{ "[", builtin_test, true },
+	{ "true", builtin_true, true },
+	{ "false", builtin_false, true },
+	{ ":", builtin_true, true },
+	{ "read", builtin_read, false },
+	{ "timeout", builtin_timeout, false },
+	{ "run", builtin_run, false },
+	{ "ulimit", builtin_ulimit, false },
+	{ "watch", builtin_watch, false },
+};
+
+#define BUILTIN_COUNT (sizeof(builtin_table) / sizeof(builtin_table[0]))
+
+bool try_handle_builtin(char **argv, int argc, int *status) {
+	if (argc <= 0 || !argv || !argv[0]) return false;
+	for (size_t i = 0; i < BUILTIN_COUNT; ++i) {
+		if (strcmp(argv[0], builtin_table[i].name) == 0) {
+			int rc = builtin_table[i].run(argc, argv);
+			if (status) *status = rc;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool builtin_is_pure(const char *name) {
+	for (size_t i = 0; i < BUILTIN_COUNT; ++i) {
+		if (strcmp(name, builtin_table[i].name) == 0) return builtin_table[i].pure;
+	}
+	return false;
+}
+
+const char *builtin_name(size_t index) {
+	return index < BUILTIN_COUNT ? builtin_table[index].name : NULL;
+}
+
 
@@ -1,137 +1,1092 @@
 #include "cmdparse.h"
+#include "alias.h"
+#include "executor.h"
+#include "parser.h"
+#include "state.h"
+#include "vars.h"
+#include "lexer.h"
 
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
 #include <unistd.h>
 
+#define WORD_ASSIGNMENT 0x80 // parse-time only: word has NAME=value form
+
+// Words are handed out as NUL-terminated slices of buf, a private copy of the
+// input taken once per parse, so plain words cost no allocation. Decisions are
+// always made on s; only buf is written to. A word written right against the
+// one before it (x<(cmd)) has lost its first byte to that word's terminator;
+// it is copied to the spare room past the text instead, from tail on.
 typedef struct {
 	const char *s;
+	char *buf;
 	size_t i;
+	size_t tail;
 } P;
 
+// buf for s: the text, then room for the copied words
+static char *text_copy(const char *s) {
+	size_t len = strlen(s);
+	char *buf = (char *)malloc(2 * len + 2);
+	if (buf) memcpy(buf, s, len + 1);
+	return buf;
+}
+
 static void skip_ws(P *p) {
 	while (p->s[p->i] == ' ' || p->s[p->i] == '\t' || p->s[p->i] == '\n' || p->s[p->i] == '\r') p->i++;
 }
 
-static char *parse_name(P *p) {
+// The next word as written (a NUL-terminated slice of p->buf), or NULL.
+// Like the validator, a substitution in it must hold a valid line.
+static char *scan_word(P *p, unsigned *lex) {
 	skip_ws(p);
 	size_t start = p->i;
-	while (p->s[p->i] != '\0') {
-		char c = p->s[p->i];
-		if (c == '|' || c == '&' || c == '>' || c == '<' || c == ';' || c == '\n' || c == '\r' || c == '\t' || c == ' ') break;
-		p->i++;
+	size_t end = lex_scan_word(p->s, start, lex);
+	if (end == start || (*lex & LEX_ERROR)) return NULL;
+	if ((*lex & LEX_SUBST) && !parser_valid_substitutions(p->s, start, end)) return NULL;
+	p->i = end;
+	char *w = p->buf + start;
+	if (*w == '\0') {
+		w = p->buf + p->tail;
+		memcpy(w, p->s + start, end - start);
+		p->tail += end - start + 1;
 	}
-	if (p->i == start) return NULL;
-	size_t len = p->i - start;
-	char *out = (char *)malloc(len + 1);
-	if (!out) return NULL;
-	memcpy(out, p->s + start, len);
-	out[len] = '\0';
-	return out;
+	w[end - start] = '\0';
+	return w;
 }
 
-static int append_argv(char ***argv, int *argc, char *tok) {
-	char **tmp = (char **)realloc(*argv, (size_t)(*argc + 2) * sizeof(char *));
-	if (!tmp) return -1;
-	*argv = tmp;
+// Returns a slice of p->buf, or NULL if there is no (well-formed) word here.
+// Quoted words that need no expansion are dequoted in place and come back literal.
+static char *parse_name(P *p, unsigned char *word_flags) {
+	skip_ws(p);
+	size_t start = p->i;
+	unsigned lex = 0;
+	char *w = scan_word(p, &lex);
+	if (!w) return NULL;
+	size_t end = p->i;
+
+	unsigned char flags = 0;
+	if (lex & LEX_PARAM) flags |= WORD_PARAM;
+	if ((lex & LEX_GLOB) && !(lex & LEX_PARAM)) flags |= WORD_GLOB;
+	if (lex & LEX_QUOTED) {
+		if (flags) flags |= WORD_QUOTED;
+		else lex_dequote(w);
+	}
+	// Decided on the raw text: a quoted name ('X'=1) is not an assignment
+	const char *eq = (const char *)memchr(p->s + start, '=', end - start);
+	if (eq && vars_is_valid_name(p->s + start, (size_t)(eq - (p->s + start)))) {
+		flags |= WORD_ASSIGNMENT;
+	}
+	if (word_flags) *word_flags = flags;
+	return w;
+}
+
+// A redirection target with parameters or substitutions is kept as written and
+// expanded when the command runs; other targets just lose their quoting now.
+// *target_flags gets the TARGET_* bits.
+static char *parse_target(P *p, unsigned char *target_flags) {
+	unsigned char flags = 0;
+	skip_ws(p);
+	bool proc_subst = lex_at_proc_subst(p->s, p->i);
+	char *w = parse_name(p, &flags);
+	*target_flags = proc_subst ? TARGET_PROC_SUBST : (flags & WORD_PARAM) ? TARGET_EXPAND : 0;
+	if (w && (flags & WORD_QUOTED) && !*target_flags) lex_dequote(w);
+	return w;
+}
+
+// Grows geometrically so long argument lists (e.g. large glob expansions) stay linear
+static int append_argv(char ***argv, int *argc, int *cap, char *tok) {
+	if (*argc + 2 > *cap) {
+		int ncap = *cap ? *cap * 2 : 8;
+		char **tmp = (char **)realloc(*argv, (size_t)ncap * sizeof(char *));
+		if (!tmp) return -1;
+		*argv = tmp;
+		*cap = ncap;
+	}
 	(*argv)[*argc] = tok;
 	(*argc)++;
 	(*argv)[*argc] = NULL;
 	return 0;
 }
 
+// Raw word -> glob pattern: quoted metacharacters become backslash-escaped
+static char *glob_pattern_from_word(const char *w) {
+	char *pat = (char *)malloc(strlen(w) * 2 + 1);
+	if (!pat) return NULL;
+	char *o = pat;
+	char quote = 0;
+	for (const char *q = w; *q; ++q) {
+		char c = *q;
+		if (!quote && (c == '\'' || c == '"')) { quote = c; continue; }
+		if (quote && c == quote) { quote = 0; continue; }
+		if (c == '\\' && quote != '\'' && q[1] != '\0') {
+			if (!quote || q[1] == '$' || q[1] == '`' || q[1] == '"' || q[1] == '\\') c = *++q;
+			*o++ = '\\';
+			*o++ = c;
+			continue;
+		}
+		if (quote && (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')) *o++ = '\\';
+		*o++ = c;
+	}
+	*o = '\0';
+	return pat;
+}
+
+static WildcardPattern *compile_word_glob(const char *w, unsigned char flags) {
+	if (!(flags & WORD_QUOTED)) return wildcard_compile(w);
+	char *pat = glob_pattern_from_word(w);
+	if (!pat) return NULL;
+	WildcardPattern *wp = wildcard_compile(pat);
+	free(pat);
+	return wp;
+}
+
+static int add_redirect(Cmd *cmd, unsigned char op, int fd, int src, char *path) {
+	Redirect *tmp = (Redirect *)realloc(cmd->redirs, (size_t)(cmd->redir_count + 1) * sizeof(Redirect));
+	if (!tmp) return -1;
+	cmd->redirs = tmp;
+	Redirect *r = &cmd->redirs[cmd->redir_count++];
+	r->op = op;
+	r->flags = 0;
+	r->fd = fd;
+	r->src = src;
+	r->path = path;
+	r->body = NULL;
+	return 0;
+}
+
+// [n]>&m, [n]<&m, [n]>&- and [n]<&- once the operator has been consumed
+static int parse_dup_redirect(P *p, Cmd *cmd, int fd) {
+	int src = -1;
+	size_t end = p->s[p->i] == '-' ? p->i + 1 : lex_scan_fd(p->s, p->i, &src);
+	if (end == p->i || !(p->s[end] == '\0' || lex_is_delim(p->s[end]))) return -1;
+	p->i = end;
+	return add_redirect(cmd, src < 0 ? REDIR_CLOSE : REDIR_DUP, fd, src, NULL) == 0 ? 1 : -1;
+}
+
+// <<WORD, <<-WORD and <<<word once the leading '<<' has been consumed
+static int parse_here_redirect(P *p, Cmd *cmd) {
+	unsigned lex = 0;
+	if (p->s[p->i] == '<') {
+		// <<<word: kept as written and expanded when the command runs
+		p->i++;
+		char *word = scan_word(p, &lex);
+		if (!word) return -1;
+		return add_redirect(cmd, REDIR_HERESTRING, STDIN_FILENO, -1, word) == 0 ? 1 : -1;
+	}
+	unsigned char flags = 0;
+	if (p->s[p->i] == '-') { flags |= HERE_STRIP_TABS; p->i++; }
+	char *word = scan_word(p, &lex);
+	if (!word) return -1;
+	if (lex & LEX_QUOTED) {
+		flags |= HERE_LITERAL;
+		lex_dequote(word);
+	}
+	if (add_redirect(cmd, REDIR_HEREDOC, STDIN_FILENO, -1, word) != 0) return -1;
+	cmd->redirs[cmd->redir_count - 1].flags = flags;
+	return 1;
+}
+
+// The target of <, >, >>, &> or &>> once the operator has been consumed
+static int add_file_redirect(P *p, Cmd *cmd, unsigned char kind, int fd) {
+	unsigned char flags = 0;
+	char *path = parse_target(p, &flags);
+	if (!path || add_redirect(cmd, kind, fd, -1, path) != 0) return -1;
+	cmd->redirs[cmd->redir_count - 1].flags = flags;
+	return 1;
+}
+
+// Parses one redirection into cmd. Returns 1 when one was consumed, 0 when
+// none is next and -1 when it is malformed (e.g. its target is missing).
+// Targets are only recorded here; they are opened in order when the command runs.
+static int parse_redirect(P *p, Cmd *cmd) {
+	size_t save = p->i;
+	skip_ws(p);
+	// A descriptor number counts only when written right against the operator
+	int fd = -1;
+	size_t op = lex_scan_fd(p->s, p->i, &fd);
+	bool numbered = op != p->i && (p->s[op] == '<' || p->s[op] == '>');
+	if (numbered) p->i = op;
+	char c = p->s[p->i];
+	if (c == '&' && p->s[p->i + 1] == '>' && !numbered) {
+		p->i += 2;
+		unsigned char kind = REDIR_OUT_ALL;
+		if (p->s[p->i] == '>') { kind = REDIR_APPEND_ALL; p->i++; }
+		return add_file_redirect(p, cmd, kind, STDOUT_FILENO);
+	}
+	// <(...) and >(...) are words
+	if ((c != '<' && c != '>') || lex_at_proc_subst(p->s, p->i)) { p->i = save; return 0; }
+	if (!numbered) fd = c == '<' ? STDIN_FILENO : STDOUT_FILENO;
+	p->i++;
+	if (p->s[p->i] == '&') {
+		p->i++;
+		return parse_dup_redirect(p, cmd, fd);
+	}
+	if (c == '<' && p->s[p->i] == '<') {
+		// Heredocs only feed stdin: like the validator, read the number as a word
+		if (numbered) { p->i = save; return 0; }
+		p->i++;
+		return parse_here_redirect(p, cmd);
+	}
+	unsigned char kind = c == '<' ? REDIR_IN : REDIR_OUT;
+	if (c == '>' && p->s[p->i] == '>') { kind = REDIR_APPEND; p->i++; }
+	return add_file_redirect(p, cmd, kind, fd);
+}
+
+// Globs are compiled now and matched when the command runs. Takes flags, the
+// WORD_* bits of cmd->argv's argc words.
+static int compile_words(Cmd *cmd, unsigned char *flags, int argc) {
+	bool any = false;
+	for (int i = 0; i < argc; ++i) {
+		flags[i] &= (unsigned char)~WORD_ASSIGNMENT;
+		if (!flags[i]) continue;
+		any = true;
+		if (!(flags[i] & WORD_GLOB)) continue;
+		if (!cmd->globs) {
+			cmd->globs = (WildcardPattern **)calloc((size_t)argc, sizeof(WildcardPattern *));
+			if (!cmd->globs) { free(flags); return -1; }
+		}
+		cmd->globs[i] = compile_word_glob(cmd->argv[i], flags[i]);
+	}
+	if (any) cmd->word_flags = flags;
+	else free(flags);
+	return 0;
+}
+
+static int parse_list(P *p, CmdSequence *seq, const char *close);
+
+// True when the closing token of the enclosing group is next: ')' or one of
+// the space-separated reserved words in close (NULL at the top level)
+static bool at_close(P *p, const char *close) {
+	skip_ws(p);
+	if (!close) return false;
+	if (close[0] == ')') return p->s[p->i] == ')';
+	return lex_match_keywords(p->s, p->i, close) != p->i;
+}
+
+static bool expect_keyword(P *p, const char *kw) {
+	skip_ws(p);
+	size_t end = lex_match_keyword(p->s, p->i, kw);
+	if (end == p->i) return false;
+	p->i = end;
+	return true;
+}
+
+// A list ending at one of the reserved words in close, into a new sequence
+static int parse_body(P *p, CmdSequence **out, const char *close) {
+	*out = (CmdSequence *)calloc(1, sizeof(CmdSequence));
+	if (!*out) return -1;
+	return parse_list(p, *out, close);
+}
+
+// A new sequence of one group holding one (zeroed) command, as a function
+// body or the 'elif' part of an if. Returns that command, or NULL on OOM.
+static Cmd *new_single_sequence(CmdSequence **out) {
+	CmdSequence *seq = (CmdSequence *)calloc(1, sizeof(CmdSequence));
+	if (!seq) return NULL;
+	*out = seq;
+	seq->groups = (CmdPipeline *)calloc(1, sizeof(CmdPipeline));
+	if (!seq->groups) return NULL;
+	seq->count = 1;
+	seq->groups[0].cmds = (Cmd *)calloc(1, sizeof(Cmd));
+	if (!seq->groups[0].cmds) return NULL;
+	seq->groups[0].count = 1;
+	return seq->groups[0].cmds;
+}
+
+// After 'if' (or 'elif', which shares the final 'fi')
+static int parse_if(P *p, Cmd *cmd) {
+	cmd->kind = CMD_IF;
+	if (parse_body(p, &cmd->cond, "then") != 0 || !expect_keyword(p, "then") ||
+	    parse_body(p, &cmd->body, "elif else fi") != 0) return -1;
+	if (expect_keyword(p, "elif")) {
+		Cmd *elif = new_single_sequence(&cmd->alt);
+		return elif ? parse_if(p, elif) : -1;
+	}
+	if (expect_keyword(p, "else") && parse_body(p, &cmd->alt, "fi") != 0) return -1;
+	return expect_keyword(p, "fi") ? 0 : -1;
+}
+
+// After 'for': the variable, an optional word list (expanded like a
+// command's words, once per run of the loop), then the body
+static int parse_for(P *p, Cmd *cmd) {
+	cmd->kind = CMD_FOR;
+	skip_ws(p);
+	size_t start = p->i;
+	unsigned lex = 0;
+	cmd->loop_var = scan_word(p, &lex);
+	if (!cmd->loop_var || lex != 0 || !vars_is_valid_name(p->s + start, p->i - start)) return -1;
+	int argc = 0, cap = 0;
+	unsigned char *flags = NULL;
+	if (expect_keyword(p, "in")) {
+		for (;;) {
+			size_t save = p->i;
+			unsigned char wf = 0;
+			char *w = parse_name(p, &wf);
+			if (!w) { p->i = save; break; }
+			int old_cap = cap;
+			if (append_argv(&cmd->argv, &argc, &cap, w) != 0) { free(flags); return -1; }
+			if (cap != old_cap) {
+				unsigned char *tmp = (unsigned char *)realloc(flags, (size_t)cap);
+				if (!tmp) { free(flags); return -1; }
+				flags = tmp;
+			}
+			flags[argc - 1] = wf;
+		}
+	}
+	if (!cmd->argv) {
+		cmd->argv = (char **)calloc(1, sizeof(char *));
+		if (!cmd->argv) return -1;
+	}
+	if (flags && compile_words(cmd, flags, argc) != 0) return -1;
+	skip_ws(p);
+	if (p->s[p->i] == ';') p->i++;
+	if (!expect_keyword(p, "do") || parse_body(p, &cmd->body, "done") != 0) return -1;
+	return expect_keyword(p, "done") ? 0 : -1;
+}
+
+// The compound forms, followed by redirections that apply to the whole command
+static int parse_compound(P *p, Cmd *cmd) {
+	size_t at = p->i, end;
+	int rc;
+	if (p->s[at] == '(') {
+		cmd->kind = CMD_SUBSHELL;
+		p->i++;
+		rc = parse_body(p, &cmd->body, ")");
+		if (rc == 0 && !at_close(p, ")")) rc = -1;
+		p->i++;
+	} else if ((end = lex_match_keyword(p->s, at, "{")) != at) {
+		cmd->kind = CMD_BRACE;
+		p->i = end;
+		rc = parse_body(p, &cmd->body, "}");
+		if (rc == 0 && !expect_keyword(p, "}")) rc = -1;
+	} else if ((end = lex_match_keyword(p->s, at, "if")) != at) {
+		p->i = end;
+		rc = parse_if(p, cmd);
+	} else if ((end = lex_match_keywords(p->s, at, "while until")) != at) {
+		cmd->kind = p->s[at] == 'w' ? CMD_WHILE : CMD_UNTIL;
+		p->i = end;
+		rc = parse_body(p, &cmd->cond, "do");
+		if (rc == 0 && !expect_keyword(p, "do")) rc = -1;
+		if (rc == 0) rc = parse_body(p, &cmd->body, "done");
+		if (rc == 0 && !expect_keyword(p, "done")) rc = -1;
+	} else if ((end = lex_match_keyword(p->s, at, "for")) != at) {
+		p->i = end;
+		rc = parse_for(p, cmd);
+	} else {
+		return -1;
+	}
+	if (rc != 0) return -1;
+	for (;;) {
+		rc = parse_redirect(p, cmd);
+		if (rc < 0) return -1;
+		if (rc == 0) return 0;
+	}
+}
+
+// name ( ) compound. The body is parsed into a sequence with its own copy of
+// the text, so a defined function can outlive the line that defined it.
+static int parse_funcdef(P *p, Cmd *cmd, size_t def) {
+	unsigned lex = 0;
+	cmd->kind = CMD_FUNCDEF;
+	cmd->argv = (char **)malloc(2 * sizeof(char *));
+	if (!cmd->argv) return -1;
+	cmd->argv[0] = scan_word(p, &lex);
+	cmd->argv[1] = NULL;
+	p->i = def;
+	skip_ws(p);
+	if (!lex_starts_compound(p->s, p->i)) return -1;
+	Cmd *compound = new_single_sequence(&cmd->body);
+	if (!compound || !(cmd->body->text = text_copy(p->s))) return -1;
+	P q = { p->s, cmd->body->text, p->i, strlen(p->s) + 1 };
+	int rc = parse_compound(&q, compound);
+	p->i = q.i;
+	return rc;
+}
+
 static int parse_atomic(P *p, Cmd *cmd) {
-	char *name = parse_name(p);
+	skip_ws(p);
+	if (lex_starts_compound(p->s, p->i)) return parse_compound(p, cmd);
+	if (lex_match_keywords(p->s, p->i, LEX_CLOSING_WORDS) != p->i) return -1; // ends a list
+	size_t def = lex_match_funcdef(p->s, p->i);
+	if (def != p->i) return parse_funcdef(p, cmd, def);
+	unsigned char first_flags = 0;
+	char *name = parse_name(p, &first_flags);
 	if (!name) return -1;
-	int argc = 0; char **argv = NULL;
-	if (append_argv(&argv, &argc, name) != 0) return -1;
+	int argc = 0, cap = 0; char **argv = NULL;
+	unsigned char *flags = NULL;
+	if (append_argv(&argv, &argc, &cap, name) != 0) return -1;
+	flags = (unsigned char *)malloc((size_t)cap);
+	if (!flags) { free(argv); return -1; }
+	flags[0] = first_flags;
+	bool assigning = (first_flags & WORD_ASSIGNMENT) != 0;
+	int nassign = assigning ? 1 : 0;
 
 	for (;;) {
-		size_t save = p->i;
-		char *tok = parse_name(p);
+		// Redirections first: '2' in "2>file" would otherwise scan as a word
+		int rc = parse_redirect(p, cmd);
+		if (rc < 0) { free(argv); free(flags); return -1; }
+		if (rc > 0) continue;
+		unsigned char wf = 0;
+		char *tok = parse_name(p, &wf);
 		if (tok) {
-			if (append_argv(&argv, &argc, tok) != 0) { free(tok); break; }
+			int old_cap = cap;
+			if (append_argv(&argv, &argc, &cap, tok) != 0) break;
+			if (cap != old_cap) {
+				unsigned char *tmp = (unsigned char *)realloc(flags, (size_t)cap);
+				if (!tmp) { argc--; argv[argc] = NULL; break; }
+				flags = tmp;
+			}
+			flags[argc - 1] = wf;
+			// Leading NAME=value words are assignments, not part of argv
+			if (assigning && (wf & WORD_ASSIGNMENT)) nassign++;
+			else assigning = false;
 			continue;
 		}
-		p->i = save;
-		skip_ws(p);
-		if (p->s[p->i] == '<') {
-			p->i++;
-			char *in = parse_name(p);
-			if (!in) { // invalid, but builder only fills until now
-				break;
+		break;
+	}
+
+	if (nassign > 0) {
+		cmd->assigns = (char **)malloc((size_t)(nassign + 1) * sizeof(char *));
+		if (!cmd->assigns) { free(argv); free(flags); return -1; }
+		memcpy(cmd->assigns, argv, (size_t)nassign * sizeof(char *));
+		cmd->assigns[nassign] = NULL;
+		for (int i = 0; i < nassign; ++i) {
+			flags[i] &= (unsigned char)~WORD_ASSIGNMENT;
+			if (!(flags[i] & (WORD_PARAM | WORD_QUOTED))) continue;
+			if (!cmd->assign_flags) {
+				cmd->assign_flags = (unsigned char *)calloc((size_t)nassign, 1);
+				if (!cmd->assign_flags) { free(argv); free(flags); return -1; }
 			}
-			// For multiple input redirects, check if the file exists
-			// If it doesn't exist, keep this as the error file
-			if (!cmd->in_file) {
-				cmd->in_file = in;
-			} else {
-				// Check if previous file exists, if not, keep it for error
-				FILE *test = fopen(cmd->in_file, "r");
-				if (test) {
-					fclose(test);
-					// Previous file exists, use new one
-					free(cmd->in_file);
-					cmd->in_file = in;
-				} else {
-					// Previous file doesn't exist, keep it for error
-					free(in);
-				}
+			cmd->assign_flags[i] = flags[i];
+		}
+		memmove(argv, argv + nassign, (size_t)(argc - nassign + 1) * sizeof(char *));
+		memmove(flags, flags + nassign, (size_t)(argc - nassign));
+		argc -= nassign;
+	}
+	cmd->argv = argv;
+	return compile_words(cmd, flags, argc);
+}
+
+static void free_cmd(Cmd *c) {
+	// Words and file names are slices of the owning sequence's text
+	free_cmd_sequence(c->body);
+	free_cmd_sequence(c->cond);
+	free_cmd_sequence(c->alt);
+	for (int j = 0; j < c->redir_count; ++j) free(c->redirs[j].body);
+	free(c->redirs);
+	if (c->globs) {
+		for (int j = 0; c->argv[j]; ++j) wildcard_free(c->globs[j]);
+	}
+	free(c->argv);
+	free(c->globs);
+	free(c->word_flags);
+	free(c->assigns);
+	free(c->assign_flags);
+	free(c->exec_path);
+}
+
+#define ARGV_CHUNK_MIN 4096
+
+static char *argv_list_store(ArgvList *l, const char *s, size_t len) {
+	if (l->chunk_count == 0 || l->chunk_used + len + 1 > l->chunk_size) {
+		size_t sz = len + 1 > ARGV_CHUNK_MIN ? len + 1 : ARGV_CHUNK_MIN;
+		// Double the chunk size as expansion grows so big globs need few allocations
+		if (l->chunk_size * 2 > sz) sz = l->chunk_size * 2;
+		char **tmp = (char **)realloc(l->chunks, (size_t)(l->chunk_count + 1) * sizeof(char *));
+		if (!tmp) return NULL;
+		l->chunks = tmp;
+		l->chunks[l->chunk_count] = (char *)malloc(sz);
+		if (!l->chunks[l->chunk_count]) return NULL;
+		l->chunk_count++;
+		l->chunk_size = sz;
+		l->chunk_used = 0;
+	}
+	char *dst = l->chunks[l->chunk_count - 1] + l->chunk_used;
+	memcpy(dst, s, len);
+	dst[len] = '\0';
+	l->chunk_used += len + 1;
+	return dst;
+}
+
+static int emit_glob_match(void *ctx, const char *path, size_t len) {
+	ArgvList *l = (ArgvList *)ctx;
+	char *word = argv_list_store(l, path, len);
+	if (!word) return -1;
+	return append_argv(&l->argv, &l->argc, &l->cap, word);
+}
+
+typedef struct {
+	char *s;
+	size_t len;
+	size_t cap;
+} StrBuf;
+
+static int strbuf_append(StrBuf *b, const char *s, size_t len) {
+	if (b->len + len + 1 > b->cap) {
+		size_t ncap = b->cap ? b->cap * 2 : 64;
+		while (ncap < b->len + len + 1) ncap *= 2;
+		char *tmp = (char *)realloc(b->s, ncap);
+		if (!tmp) return -1;
+		b->s = tmp;
+		b->cap = ncap;
+	}
+	memcpy(b->s + b->len, s, len);
+	b->len += len;
+	b->s[b->len] = '\0';
+	return 0;
+}
+
+// One field being assembled during word expansion. mask holds one byte per
+// text byte: 1 where the byte is unquoted (so glob characters are active).
+typedef struct {
+	StrBuf text;
+	StrBuf mask;
+	bool started;  // a field exists even when empty, e.g. ""
+	bool magic;    // an active glob character was seen
+	bool split;    // perform field splitting and pathname expansion
+	bool fields;   // split off: an unquoted expansion held blanks splitting would break at
+	ArgvList *out;
+	char *result;  // with split off: the single resulting string
+} WordExpansion;
+
+static int field_add(WordExpansion *we, const char *s, size_t len, bool active) {
+	if (strbuf_append(&we->text, s, len) != 0) return -1;
+	for (size_t i = 0; i < len; ++i) {
+		char m = active ? 1 : 0;
+		if (strbuf_append(&we->mask, &m, 1) != 0) return -1;
+		if (active && (s[i] == '*' || s[i] == '?' || s[i] == '[')) we->magic = true;
+	}
+	we->started = true;
+	return 0;
+}
+
+static int field_finish(WordExpansion *we) {
+	if (!we->started) return 0;
+	const char *text = we->text.s ? we->text.s : "";
+	int rc = 0;
+	if (!we->split) {
+		we->result = argv_list_store(we->out, text, we->text.len);
+		rc = we->result ? 0 : -1;
+	} else {
+		int matches = 0;
+		if (we->magic) {
+			StrBuf pat = { NULL, 0, 0 };
+			rc = strbuf_append(&pat, "", 0);
+			for (size_t i = 0; rc == 0 && i < we->text.len; ++i) {
+				char c = text[i];
+				if (!we->mask.s[i] && (c == '*' || c == '?' || c == '[' || c == ']' || c == '\\')) rc = strbuf_append(&pat, "\\", 1);
+				if (rc == 0) rc = strbuf_append(&pat, &c, 1);
 			}
-			continue;
+			if (rc == 0) {
+				WildcardPattern *wp = wildcard_compile(pat.s);
+				matches = wildcard_expand(wp, emit_glob_match, we->out);
+				wildcard_free(wp);
+				if (matches < 0) rc = -1;
+			}
+			free(pat.s);
 		}
-		if (p->s[p->i] == '>') {
-			p->i++;
-			int append = 0;
-			if (p->s[p->i] == '>') { append = 1; p->i++; }
-			char *out = parse_name(p);
-			if (!out) { break; }
-			// For multiple output redirects, check if the file can be created
-			// If it can't be created, keep this as the error file
-			if (!cmd->out_file) {
-				cmd->out_file = out;
-				cmd->out_append = append;
+		if (rc == 0 && matches == 0) {
+			char *field = argv_list_store(we->out, text, we->text.len);
+			rc = field ? append_argv(&we->out->argv, &we->out->argc, &we->out->cap, field) : -1;
+		}
+	}
+	we->text.len = 0;
+	we->mask.len = 0;
+	we->started = false;
+	we->magic = false;
+	return rc;
+}
+
+// Resolve the parameter reference at p ('$'). Returns its value (NULL when unset)
+// and sets *end past the reference; sets *end = p when it is not a reference.
+static const char *param_lookup(const char *p, const char **end, char *numbuf, size_t numbuf_sz) {
+	const char *q = p + 1;
+	*end = p;
+	// Special parameters: $$ is the shell's pid, $? the last exit status
+	bool braced = q[0] == '{' && (q[1] == '$' || q[1] == '?') && q[2] == '}';
+	char special = braced ? q[1] : *q;
+	if (special == '$' || special == '?') {
+		snprintf(numbuf, numbuf_sz, "%d", special == '$' ? (int)getpid() : state_get_last_status());
+		*end = q + (braced ? 3 : 1);
+		return numbuf;
+	}
+	if (*q == '{') {
+		const char *close = strchr(q + 1, '}');
+		if (!close || !vars_is_valid_name(q + 1, (size_t)(close - q - 1))) return NULL;
+		*end = close + 1;
+		return vars_get_n(q + 1, (size_t)(close - q - 1));
+	}
+	size_t nlen = 0;
+	while (vars_is_valid_name(q, nlen + 1)) nlen++;
+	if (nlen == 0) return NULL;
+	*end = q + nlen;
+	return vars_get_n(q, nlen);
+}
+
+static bool is_blank(char c) {
+	return c == ' ' || c == '\t' || c == '\n';
+}
+
+// Whether field splitting would make more than one field of s[0..len)
+static bool splits(const char *s, size_t len) {
+	while (len > 0 && is_blank(s[len - 1])) len--;
+	size_t i = 0;
+	while (i < len && is_blank(s[i])) i++;
+	for (; i < len; ++i) {
+		if (is_blank(s[i])) return true;
+	}
+	return false;
+}
+
+// Unquoted expansion results are split on blanks into separate fields
+static int add_expansion(WordExpansion *we, const char *val, bool quoted) {
+	if (!quoted && !we->split && splits(val, strlen(val))) we->fields = true;
+	if (quoted || !we->split) return field_add(we, val, strlen(val), !quoted);
+	while (*val) {
+		size_t run = strcspn(val, " \t\n");
+		if (run > 0 && field_add(we, val, run, true) != 0) return -1;
+		val += run;
+		if (*val) {
+			if (field_finish(we) != 0) return -1;
+			val += strspn(val, " \t\n");
+		}
+	}
+	return 0;
+}
+
+// Takes over buf (malloc'd) as one more string chunk of l. The chunk that
+// argv_list_store() is filling stays last.
+static int argv_list_adopt(ArgvList *l, char *buf) {
+	char **tmp = (char **)realloc(l->chunks, (size_t)(l->chunk_count + 1) * sizeof(char *));
+	if (!tmp) return -1;
+	l->chunks = tmp;
+	if (l->chunk_count > 0) {
+		l->chunks[l->chunk_count] = l->chunks[l->chunk_count - 1];
+		l->chunks[l->chunk_count - 1] = buf;
+	} else {
+		l->chunks[0] = buf;
+		l->chunk_used = l->chunk_size = 0; // full: the next store starts a chunk
+	}
+	l->chunk_count++;
+	return 0;
+}
+
+// Command text of the substitution sub[0..n): the inside of $(...), or of
+// `...` with its \$ \` and \\ escapes removed
+static char *subst_text(const char *sub, size_t n) {
+	if (sub[0] == '$') return strndup(sub + 2, n - 3);
+	char *text = strndup(sub + 1, n - 2);
+	if (!text) return NULL;
+	char *out = text;
+	for (const char *q = text; *q; ++q) {
+		if (*q == '\\' && (q[1] == '$' || q[1] == '`' || q[1] == '\\')) q++;
+		*out++ = *q;
+	}
+	*out = '\0';
+	return text;
+}
+
+// Output of the substitution sub[0..n) without its trailing newlines
+// (malloc'd, length in *len), or NULL on OOM
+static char *run_subst(const char *sub, size_t n, size_t *len) {
+	char *text = subst_text(sub, n);
+	if (!text) return NULL;
+	char *out = execute_substitution(text, len);
+	free(text);
+	if (!out) return NULL;
+	while (*len > 0 && out[*len - 1] == '\n') (*len)--;
+	out[*len] = '\0';
+	return out;
+}
+
+// The substitution sub[0..n), as part of a word. Unquoted output is split on
+// blanks inside the capture buffer itself, which becomes one of out's chunks:
+// a field standing alone (word_ends: nothing of the word follows) is
+// terminated in place and goes into argv without being copied.
+static int add_substitution(WordExpansion *we, const char *sub, size_t n, bool quoted, bool word_ends) {
+	size_t len = 0;
+	char *buf = run_subst(sub, n, &len);
+	if (!buf) return -1;
+	if (quoted || !we->split) {
+		if (!quoted && splits(buf, len)) we->fields = true;
+		int rc = field_add(we, buf, len, !quoted);
+		free(buf);
+		return rc;
+	}
+	if (argv_list_adopt(we->out, buf) != 0) {
+		free(buf);
+		return -1;
+	}
+	int rc = 0;
+	size_t i = 0;
+	while (i < len && rc == 0) {
+		size_t e = i;
+		while (e < len && !is_blank(buf[e])) e++;
+		size_t next = e;
+		while (next < len && is_blank(buf[next])) next++;
+		if (e > i) {
+			bool alone = !we->started && (e < len || word_ends) && strcspn(buf + i, "*?[") >= e - i;
+			if (alone) {
+				buf[e] = '\0';
+				rc = append_argv(&we->out->argv, &we->out->argc, &we->out->cap, buf + i);
 			} else {
-				// Check if previous file can be created, if not, keep it for error
-				int flags = O_WRONLY | O_CREAT | (cmd->out_append ? O_APPEND : O_TRUNC);
-				int fd = open(cmd->out_file, flags, 0666);
-				if (fd >= 0) {
-					close(fd);
-					// Previous file can be created, use new one
-					free(cmd->out_file);
-					cmd->out_file = out;
-					cmd->out_append = append;
+				rc = field_add(we, buf + i, e - i, true);
+			}
+		}
+		if (e < len && rc == 0) rc = field_finish(we);
+		i = next;
+	}
+	return rc;
+}
+
+// <(...) or >(...) at sub (n bytes long): the command starts now, and the
+// word becomes the /dev/fd path of the shell's end of its pipe
+static int add_proc_subst(WordExpansion *we, const char *sub, size_t n) {
+	char *text = strndup(sub + 2, n - 3);
+	if (!text) return -1;
+	int fd = execute_process_subst(text, sub[0] == '<');
+	free(text);
+	if (fd < 0) return -1;
+	char path[32];
+	int len = snprintf(path, sizeof(path), "/dev/fd/%d", fd);
+	return field_add(we, path, (size_t)len, false);
+}
+
+static bool at_subst(const char *p) {
+	return *p == '`' || (*p == '$' && p[1] == '(');
+}
+
+// Full expansion of one raw word: quote removal, parameters, and (when split is
+// set) field splitting plus pathname expansion. With split off, *fields (when
+// given) tells whether splitting would have made several fields.
+static int expand_word(const char *w, ArgvList *out, bool split, char **result, bool *fields) {
+	WordExpansion we;
+	memset(&we, 0, sizeof(we));
+	we.split = split;
+	we.out = out;
+	char numbuf[24];
+	size_t n; // length of a command substitution
+	int rc = 0;
+	const char *p = w;
+	while (*p && rc == 0) {
+		if (*p == '\'') {
+			const char *close = strchr(p + 1, '\'');
+			size_t len = close ? (size_t)(close - p - 1) : strlen(p + 1);
+			rc = field_add(&we, p + 1, len, false);
+			p += len + 1 + (close ? 1 : 0);
+		} else if (*p == '"') {
+			p++;
+			we.started = true;
+			while (*p && *p != '"' && rc == 0) {
+				if (*p == '\\' && (p[1] == '$' || p[1] == '`' || p[1] == '"' || p[1] == '\\' || p[1] == '\n')) {
+					rc = field_add(&we, p + 1, 1, false);
+					p += 2;
+				} else if (at_subst(p) && (n = lex_scan_subst(p, 0)) > 0) {
+					rc = add_substitution(&we, p, n, true, false);
+					p += n;
+				} else if (*p == '$') {
+					const char *end;
+					const char *val = param_lookup(p, &end, numbuf, sizeof(numbuf));
+					if (end == p) { rc = field_add(&we, p, 1, false); p++; }
+					else { rc = val ? add_expansion(&we, val, true) : 0; p = end; }
 				} else {
-					// Previous file can't be created, keep it for error
-					free(out);
+					rc = field_add(&we, p, 1, false);
+					p++;
 				}
 			}
-			continue;
+			if (*p == '"') p++;
+		} else if (*p == '\\' && p[1] != '\0') {
+			rc = field_add(&we, p + 1, 1, false);
+			p += 2;
+		} else if (p == w && lex_at_proc_subst(p, 0) && (n = lex_scan_subst(p, 0)) > 0) {
+			rc = add_proc_subst(&we, p, n);
+			p += n;
+		} else if (at_subst(p) && (n = lex_scan_subst(p, 0)) > 0) {
+			rc = add_substitution(&we, p, n, false, p[n] == '\0');
+			p += n;
+		} else if (*p == '$') {
+			const char *end;
+			const char *val = param_lookup(p, &end, numbuf, sizeof(numbuf));
+			if (end == p) { rc = field_add(&we, p, 1, true); p++; }
+			else { rc = val ? add_expansion(&we, val, false) : 0; p = end; }
+		} else {
+			rc = field_add(&we, p, 1, true);
+			p++;
+		}
+	}
+	if (rc == 0 && !split) we.started = true; // assignments always yield a value
+	if (rc == 0) rc = field_finish(&we);
+	if (result) *result = we.result;
+	if (fields) *fields = we.fields;
+	free(we.text.s);
+	free(we.mask.s);
+	return rc;
+}
+
+// Heredoc bodies expand parameters and command substitutions; a backslash
+// escapes $ ` \ and newline
+static int expand_here_body(StrBuf *b, const char *p) {
+	char numbuf[24];
+	size_t n; // length of a command substitution
+	int rc = strbuf_append(b, "", 0);
+	while (*p && rc == 0) {
+		if (*p == '\\' && p[1] == '\n') {
+			p += 2;
+		} else if (*p == '\\' && (p[1] == '$' || p[1] == '`' || p[1] == '\\')) {
+			rc = strbuf_append(b, p + 1, 1);
+			p += 2;
+		} else if (at_subst(p) && (n = lex_scan_subst(p, 0)) > 0) {
+			size_t len = 0;
+			char *out = run_subst(p, n, &len);
+			rc = out ? strbuf_append(b, out, len) : -1;
+			free(out);
+			p += n;
+		} else if (*p == '$') {
+			const char *end;
+			const char *val = param_lookup(p, &end, numbuf, sizeof(numbuf));
+			if (end == p) { rc = strbuf_append(b, p, 1); p++; }
+			else { rc = val ? strbuf_append(b, val, strlen(val)) : 0; p = end; }
+		} else {
+			size_t run = strcspn(p, "\\$`");
+			if (run == 0) run = 1;
+			rc = strbuf_append(b, p, run);
+			p += run;
+		}
+	}
+	return rc;
+}
+
+char *cmd_here_payload(const Redirect *r, size_t *len) {
+	StrBuf b = { NULL, 0, 0 };
+	int rc = 0;
+	if (r->op == REDIR_HERESTRING) {
+		ArgvList tmp;
+		memset(&tmp, 0, sizeof(tmp));
+		char *word = NULL;
+		rc = expand_word(r->path, &tmp, false, &word, NULL);
+		if (rc == 0) rc = strbuf_append(&b, word, strlen(word));
+		if (rc == 0) rc = strbuf_append(&b, "\n", 1);
+		argv_list_free(&tmp);
+	} else {
+		const char *body = r->body ? r->body : "";
+		if (r->flags & HERE_LITERAL) rc = strbuf_append(&b, body, strlen(body));
+		else rc = expand_here_body(&b, body);
+	}
+	if (rc != 0) { free(b.s); return NULL; }
+	*len = b.len;
+	return b.s;
+}
+
+static int read_heredoc(Redirect *r, HeredocReader read_more, void *ctx) {
+	StrBuf body = { NULL, 0, 0 };
+	int rc = strbuf_append(&body, "", 0);
+	// An unterminated body simply ends at EOF
+	char *line;
+	while (rc == 0 && (line = read_more(ctx)) != NULL) {
+		const char *l = line;
+		if (r->flags & HERE_STRIP_TABS) l += strspn(l, "\t");
+		if (strcmp(l, r->path) == 0) { free(line); break; }
+		rc = strbuf_append(&body, l, strlen(l));
+		if (rc == 0) rc = strbuf_append(&body, "\n", 1);
+		free(line);
+	}
+	if (rc != 0) { free(body.s); return -1; }
+	free(r->body);
+	r->body = body.s;
+	return 0;
+}
+
+int cmd_sequence_read_heredocs(CmdSequence *seq, HeredocReader read_more, void *ctx) {
+	for (int i = 0; i < seq->count; ++i) {
+		CmdPipeline *group = &seq->groups[i];
+		for (int j = 0; j < group->count; ++j) {
+			Cmd *c = &group->cmds[j];
+			// A group's own redirections come after everything inside it, and
+			// a condition comes before the body and the 'else' branch
+			if (c->cond && cmd_sequence_read_heredocs(c->cond, read_more, ctx) != 0) return -1;
+			if (c->body && cmd_sequence_read_heredocs(c->body, read_more, ctx) != 0) return -1;
+			if (c->alt && cmd_sequence_read_heredocs(c->alt, read_more, ctx) != 0) return -1;
+			for (int k = 0; k < c->redir_count; ++k) {
+				Redirect *r = &c->redirs[k];
+				if (r->op == REDIR_HEREDOC && read_heredoc(r, read_more, ctx) != 0) return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+static int expand_assignments(const Cmd *cmd, ArgvList *out) {
+	int n = 0;
+	while (cmd->assigns[n]) n++;
+	out->env = (char **)malloc((size_t)n * sizeof(char *));
+	if (!out->env) return -1;
+	for (int i = 0; i < n; ++i) {
+		char *value = cmd->assigns[i];
+		if (cmd->assign_flags && cmd->assign_flags[i] && expand_word(cmd->assigns[i], out, false, &value, NULL) != 0) return -1;
+		out->env[out->env_count++] = value;
+	}
+	return 0;
+}
+
+// File targets are expanded without splitting, so each names one file; one
+// that comes out empty or would split into several is an ambiguous redirect.
+// Process substitutions as targets start along with the command.
+static int expand_targets(const Cmd *cmd, ArgvList *out) {
+	for (int i = 0; i < cmd->redir_count; ++i) {
+		const Redirect *r = &cmd->redirs[i];
+		if (r->op == REDIR_HEREDOC || !(r->flags & (TARGET_PROC_SUBST | TARGET_EXPAND))) continue;
+		if (!out->targets) {
+			out->targets = (char **)calloc((size_t)cmd->redir_count, sizeof(char *));
+			if (!out->targets) return -1;
+		}
+		bool fields = false;
+		if (expand_word(r->path, out, false, &out->targets[i], &fields) != 0) return -1;
+		if ((r->flags & TARGET_EXPAND) && (fields || out->targets[i][0] == '\0')) {
+			fprintf(stderr, "%s: ambiguous redirect\n", r->path);
+			return -1;
 		}
-		break;
 	}
-	cmd->argv = argv;
 	return 0;
 }
 
+int cmd_expand_argv(const Cmd *cmd, ArgvList *out) {
+	memset(out, 0, sizeof(*out));
+	int n = 0;
+	while (cmd->argv && cmd->argv[n]) n++;
+	if (cmd->assigns && expand_assignments(cmd, out) != 0) {
+		argv_list_free(out);
+		return -1;
+	}
+	if (expand_targets(cmd, out) != 0) {
+		argv_list_free(out);
+		return -1;
+	}
+	if (!cmd->word_flags) {
+		out->argv = cmd->argv;
+		out->argc = n;
+		return 0;
+	}
+	int rc = 0;
+	for (int i = 0; i < n && rc == 0; ++i) {
+		unsigned char flags = cmd->word_flags[i];
+		if (flags & WORD_PARAM) {
+			rc = expand_word(cmd->argv[i], out, true, NULL, NULL);
+			continue;
+		}
+		int matches = 0;
+		if ((flags & WORD_GLOB) && cmd->globs[i]) {
+			matches = wildcard_expand(cmd->globs[i], emit_glob_match, out);
+			if (matches < 0) rc = -1;
+		}
+		if (rc != 0 || matches > 0) continue;
+		char *word = cmd->argv[i];
+		if (flags & WORD_QUOTED) rc = expand_word(cmd->argv[i], out, false, &word, NULL);
+		if (rc == 0) rc = append_argv(&out->argv, &out->argc, &out->cap, word);
+	}
+	// Every word may have expanded to nothing; still hand back an empty argv
+	if (rc == 0 && !out->argv) {
+		out->argv = (char **)calloc(1, sizeof(char *));
+		if (out->argv) out->cap = 1;
+		else rc = -1;
+	}
+	if (rc != 0) argv_list_free(out);
+	return rc;
+}
+
+void argv_list_free(ArgvList *list) {
+	if (!list) return;
+	if (list->cap) free(list->argv);
+	free(list->env);
+	free(list->targets);
+	for (int i = 0; i < list->chunk_count; ++i) free(list->chunks[i]);
+	free(list->chunks);
+	memset(list, 0, sizeof(*list));
+}
+
+#define ALIAS_DEPTH_MAX 16
+
+// The alias value for w[0..len) when one applies, its own first word expanded
+// in turn unless that would repeat an alias already being expanded
+static int append_command_word(StrBuf *b, const char *w, size_t len, const char **used, int depth) {
+	const char *value = depth < ALIAS_DEPTH_MAX ? alias_get_n(w, len) : NULL;
+	for (int k = 0; value && k < depth; ++k) {
+		if (used[k] == value) value = NULL;
+	}
+	if (!value) return strbuf_append(b, w, len);
+	used[depth] = value;
+	size_t start = strspn(value, " \t");
+	unsigned lex = 0;
+	size_t end = lex_scan_word(value, start, &lex);
+	if (end == start || lex != 0) return strbuf_append(b, value, strlen(value));
+	int rc = strbuf_append(b, value, start);
+	if (rc == 0) rc = append_command_word(b, value + start, end - start, used, depth + 1);
+	if (rc == 0) rc = strbuf_append(b, value + end, strlen(value + end));
+	return rc;
+}
+
+// Aliases are textual: only a plain word where a command name may start is
+// looked up, after the line start, a separator, '(', a standalone '{' or one of
+// the reserved words a command follows (if, then, elif, else, while, until,
+// do), or leading NAME=value words. A function definition's name is left alone.
+// Nothing is copied until a word turns out to be an alias, so a line without
+// one costs a scan and no allocation.
+char *cmd_expand_aliases(const char *line) {
+	if (alias_count() == 0) return NULL;
+	StrBuf b = { NULL, 0, 0 };
+	const char *used[ALIAS_DEPTH_MAX];
+	bool command_pos = true;
+	int rc = 0;
+	size_t i = 0, copied = 0;
+	while (line[i] != '\0' && rc == 0) {
+		unsigned lex = 0;
+		size_t end = lex_scan_word(line, i, &lex);
+		if (end == i) {
+			char c = line[i];
+			if (c == ';' || c == '&' || c == '|' || c == '(') command_pos = true;
+			else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') command_pos = false;
+			i++;
+			continue;
+		}
+		const char *eq = (const char *)memchr(line + i, '=', end - i);
+		if (!command_pos || (eq && vars_is_valid_name(line + i, (size_t)(eq - (line + i))))
+		    || lex_match_keywords(line, i, "{ if then elif else while until do") != i) {
+			i = end;
+			continue;
+		}
+		if (lex == 0 && lex_match_funcdef(line, i) == i && alias_get_n(line + i, end - i)) {
+			rc = strbuf_append(&b, line + copied, i - copied);
+			if (rc == 0) rc = append_command_word(&b, line + i, end - i, used, 0);
+			copied = end;
+		}
+		command_pos = false;
+		i = end;
+	}
+	if (rc == 0 && b.s) rc = strbuf_append(&b, line + copied, i - copied);
+	if (rc != 0) {
+		free(b.s);
+		return NULL;
+	}
+	return b.s;
+}
+
 static CmdPipeline *parse_first_cmd_group_from_pos(P *p) {
 	CmdPipeline *cp = (CmdPipeline *)calloc(1, sizeof(CmdPipeline));
 	if (!cp) return NULL;
 
 	for (;;) {
 		Cmd cmd; memset(&cmd, 0, sizeof(cmd));
-		if (parse_atomic(p, &cmd) != 0) { free_cmd_pipeline(cp); return NULL; }
+		if (parse_atomic(p, &cmd) != 0) { free_cmd(&cmd); free_cmd_pipeline(cp); return NULL; }
 		Cmd *tmp = (Cmd *)realloc(cp->cmds, (size_t)(cp->count + 1) * sizeof(Cmd));
-		if (!tmp) { free_cmd_pipeline(cp); return NULL; }
+		if (!tmp) { free_cmd(&cmd); free_cmd_pipeline(cp); return NULL; }
 		cp->cmds = tmp;
 		cp->cmds[cp->count++] = cmd;
 
 		size_t save = p->i;
 		skip_ws(p);
-		if (p->s[p->i] == '|') {
+		if (p->s[p->i] == '|' && p->s[p->i + 1] != '|') {
 			p->i++;
 			continue;
 		}
@@ -143,77 +1098,97 @@ static CmdPipeline *parse_first_cmd_group_from_pos(P *p) {
 
 CmdPipeline *parse_first_cmd_group(const char *input) {
 	if (!input) return NULL;
-	P p = { input, 0 };
-	return parse_first_cmd_group_from_pos(&p);
+	char *buf = text_copy(input);
+	if (!buf) return NULL;
+	P p = { input, buf, 0, strlen(input) + 1 };
+	CmdPipeline *cp = parse_first_cmd_group_from_pos(&p);
+	if (!cp) { free(buf); return NULL; }
+	cp->text = buf;
+	return cp;
 }
 
 void free_cmd_pipeline(CmdPipeline *p) {
 	if (!p) return;
-	for (int i = 0; i < p->count; ++i) {
-		Cmd *c = &p->cmds[i];
-		if (c->argv) {
-			for (int j = 0; c->argv[j]; ++j) free(c->argv[j]);
-			free(c->argv);
-		}
-		free(c->in_file);
-		free(c->out_file);
-	}
+	for (int i = 0; i < p->count; ++i) free_cmd(&p->cmds[i]);
 	free(p->cmds);
+	free(p->text);
 	free(p);
 }
 
-CmdSequence *parse_shell_cmd(const char *input) {
-	if (!input) return NULL;
-	P p = { input, 0 };
-	CmdSequence *seq = (CmdSequence *)calloc(1, sizeof(CmdSequence));
-	if (!seq) return NULL;
-	seq->is_background = false; // Initialize trailing background flag
+// Moves group's contents into seq; the container is freed either way
+static int append_group(CmdSequence *seq, CmdPipeline *group, GroupConnector connector) {
+	CmdPipeline *tmp = (CmdPipeline *)realloc(seq->groups, (size_t)(seq->count + 1) * sizeof(CmdPipeline));
+	if (!tmp) { free_cmd_pipeline(group); return -1; }
+	seq->groups = tmp;
+	// Default each group's mode to foreground; will adjust based on separator seen after it
+	group->run_in_background = false;
+	group->connector = connector;
+	seq->groups[seq->count++] = *group;
+	free(group); // only free the container, not the contents
+	return 0;
+}
 
+// and_or -> cmd_group ((&& | ||) cmd_group)*. Mirrors the validator: an operator
+// not followed by a group is left for the separator loop to read as '&'s.
+static int parse_and_or(P *p, CmdSequence *seq) {
+	CmdPipeline *group = parse_first_cmd_group_from_pos(p);
+	if (!group || append_group(seq, group, CONNECT_SEQ) != 0) return -1;
 	for (;;) {
-		CmdPipeline *group = parse_first_cmd_group_from_pos(&p);
-		if (!group) { free_cmd_sequence(seq); return NULL; }
-		
-		CmdPipeline *tmp = (CmdPipeline *)realloc(seq->groups, (size_t)(seq->count + 1) * sizeof(CmdPipeline));
-		if (!tmp) { free_cmd_pipeline(group); free_cmd_sequence(seq); return NULL; }
-		seq->groups = tmp;
-		// Default each group's mode to foreground; will adjust based on separator seen after it
-		group->run_in_background = false;
-		seq->groups[seq->count++] = *group;
-		free(group); // only free the container, not the contents
+		size_t save = p->i;
+		skip_ws(p);
+		char c = p->s[p->i];
+		if ((c == '&' || c == '|') && p->s[p->i + 1] == c) {
+			p->i += 2;
+			group = parse_first_cmd_group_from_pos(p);
+			if (group) {
+				if (append_group(seq, group, c == '&' ? CONNECT_AND : CONNECT_OR) != 0) return -1;
+				continue;
+			}
+		}
+		p->i = save;
+		break;
+	}
+	return 0;
+}
+
+// list -> and_or ((& | ;) and_or)* &?. Inside a group (close != NULL) the last
+// and_or may also be followed by ';'. Mirrors the validator.
+static int parse_list(P *p, CmdSequence *seq, const char *close) {
+	for (;;) {
+		if (parse_and_or(p, seq) != 0) return -1;
 
 		// After a group, consume any '&' (mark previous as background),
 		// and a single ';' to indicate there is another group to parse.
 		// This allows patterns like "cmd & ; next".
-		bool has_semicolon = false;
+		size_t save = p->i;
+		bool saw_amp = false;
 		for (;;) {
-			skip_ws(&p);
-			if (p.s[p.i] == '&') {
-				seq->groups[seq->count - 1].run_in_background = true;
-				p.i++;
-				continue;
-			}
-			if (p.s[p.i] == ';') {
-				p.i++;
-				has_semicolon = true;
-			}
+			skip_ws(p);
+			if (p->s[p->i] == '&') { saw_amp = true; p->i++; continue; }
 			break;
 		}
-		if (has_semicolon) {
+		if (saw_amp) seq->groups[seq->count - 1].run_in_background = true;
+		if (p->s[p->i] == ';') {
+			p->i++;
+			if (at_close(p, close)) return 0;
 			continue;
 		}
-		break;
+		// Optional trailing &
+		if (!saw_amp) p->i = save;
+		return 0;
 	}
+}
 
-	// Optional trailing &
-	skip_ws(&p);
-	if (p.s[p.i] == '&') {
-		p.i++;
-		seq->is_background = true;
-		// Mark the last group to run in background as well
-		if (seq->count > 0) {
-			seq->groups[seq->count - 1].run_in_background = true;
-		}
-	}
+CmdSequence *parse_shell_cmd(const char *input) {
+	if (!input) return NULL;
+	CmdSequence *seq = (CmdSequence *)calloc(1, sizeof(CmdSequence));
+	if (!seq) return NULL;
+	seq->text = text_copy(input);
+	if (!seq->text) { free(seq); return NULL; }
+	P p = { input, seq->text, 0, strlen(input) + 1 };
+
+	if (parse_list(&p, seq, NULL) != 0) { free_cmd_sequence(seq); return NULL; }
+	seq->is_background = seq->groups[seq->count - 1].run_in_background;
 
 	// must consume all input (ignoring whitespace)
 	skip_ws(&p);
@@ -224,21 +1199,18 @@ CmdSequence *parse_shell_cmd(const char *input) {
 
 void free_cmd_sequence(CmdSequence *s) {
 	if (!s) return;
+	if (s->refs > 0) {
+		s->refs--;
+		return;
+	}
 	for (int i = 0; i < s->count; ++i) {
 		// Free the contents of each CmdPipeline (not the structure itself)
 		CmdPipeline *group = &s->groups[i];
-		for (int j = 0; j < group->count; ++j) {
-			Cmd *c = &group->cmds[j];
-			if (c->argv) {
-				for (int k = 0; c->argv[k]; ++k) free(c->argv[k]);
-				free(c->argv);
-			}
-			free(c->in_file);
-			free(c->out_file);
-		}
+		for (int j = 0; j < group->count; ++j) free_cmd(&group->cmds[j]);
 		free(group->cmds);
 	}
 	free(s->groups);
+	free(s->text);
 	free(s);
 }
 
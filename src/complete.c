@@ -0,0 +1,153 @@
+#include "complete.h"
+#include "builtins.h"
+#include "jobs.h"
+#include "lexer.h"
+#include "pathindex.h"
+#include "wildcard.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static void add_item(Completion *c, const char *dir, size_t dlen, const char *name, size_t nlen, bool slash) {
+	if (c->count == c->cap) {
+		size_t ncap = c->cap ? c->cap * 2 : 64;
+		char **ni = (char **)realloc(c->items, ncap * sizeof(char *));
+		if (!ni) return;
+		c->items = ni;
+		c->cap = ncap;
+	}
+	char *s = (char *)malloc(dlen + nlen + 2);
+	if (!s) return;
+	memcpy(s, dir, dlen);
+	memcpy(s + dlen, name, nlen);
+	if (slash) s[dlen + nlen++] = '/';
+	s[dlen + nlen] = '\0';
+	c->items[c->count++] = s;
+}
+
+static bool is_stage_break(char c) {
+	return c == '|' || c == ';' || c == '&' || c == '(';
+}
+
+static int emit_command(void *ctx, const char *name, size_t len) {
+	add_item((Completion *)ctx, "", 0, name, len, false);
+	return 0;
+}
+
+static void complete_command(Completion *c, const char *prefix, size_t len) {
+	for (size_t i = 0; builtin_name(i); ++i) {
+		const char *name = builtin_name(i);
+		if (strncmp(name, prefix, len) == 0) add_item(c, "", 0, name, strlen(name), false);
+	}
+	path_index_complete(prefix, len, emit_command, c);
+}
+
+static void complete_jobs(Completion *c, const char *prefix, size_t len) {
+	int max = jobs_count();
+	int *numbers = (int *)malloc((size_t)(max ? max : 1) * sizeof(int));
+	if (!numbers) return;
+	int n = jobs_list_numbers(numbers, max);
+	for (int i = 0; i < n; ++i) {
+		char num[16];
+		int nl = snprintf(num, sizeof(num), "%d", numbers[i]);
+		if (strncmp(num, prefix, len) == 0) add_item(c, "", 0, num, (size_t)nl, false);
+	}
+	free(numbers);
+}
+
+typedef struct {
+	Completion *c;
+	const char *dir;
+	size_t dlen;
+	bool show_hidden;
+	bool exec_only; // a command word containing '/': directories and executables
+} PathState;
+
+static int emit_path(void *ctx, const char *name, size_t len, bool is_dir) {
+	PathState *ps = (PathState *)ctx;
+	if (name[0] == '.' && !ps->show_hidden) return 0;
+	if (ps->exec_only && !is_dir) {
+		char full[PATH_MAX];
+		if (ps->dlen + len >= sizeof(full)) return 0;
+		memcpy(full, ps->dir, ps->dlen);
+		memcpy(full + ps->dlen, name, len + 1);
+		if (faccessat(AT_FDCWD, full, X_OK, 0) != 0) return 0;
+	}
+	add_item(ps->c, ps->dir, ps->dlen, name, len, is_dir);
+	return 0;
+}
+
+static void complete_path(Completion *c, const char *word, bool exec_only) {
+	const char *slash = strrchr(word, '/');
+	const char *base = slash ? slash + 1 : word;
+	char dir[PATH_MAX];
+	size_t dlen = slash ? (size_t)(slash - word) + 1 : 0;
+	if (dlen >= sizeof(dir)) return;
+	memcpy(dir, word, dlen);
+	dir[dlen] = '\0';
+	PathState ps;
+	ps.c = c;
+	ps.dir = dir;
+	ps.dlen = dlen;
+	ps.show_hidden = base[0] == '.';
+	ps.exec_only = exec_only;
+	wildcard_list_dir(dir, base, strlen(base), emit_path, &ps);
+}
+
+// True when the pipeline stage containing offset 'at' starts with fg or bg
+static bool stage_is_job_control(const char *line, size_t at) {
+	size_t k = at;
+	while (k > 0 && !is_stage_break(line[k - 1])) k--;
+	while (line[k] == ' ' || line[k] == '\t') k++;
+	unsigned flags;
+	size_t end = lex_scan_word(line, k, &flags);
+	return end - k == 2 && (strncmp(line + k, "fg", 2) == 0 || strncmp(line + k, "bg", 2) == 0);
+}
+
+static int compare_items(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+size_t complete_line(const char *line, size_t pos, Completion *out) {
+	memset(out, 0, sizeof(*out));
+	size_t start = pos;
+	while (start > 0 && !lex_is_delim(line[start - 1])) start--;
+	out->word_start = start;
+	char *word = strndup(line + start, pos - start);
+	if (!word) return 0;
+	size_t len = lex_dequote(word);
+	out->prefix_len = len;
+
+	size_t j = start;
+	while (j > 0 && (line[j - 1] == ' ' || line[j - 1] == '\t')) j--;
+	char prev = j > 0 ? line[j - 1] : '\0';
+	// A command also follows a reserved word such as '{', 'then' or 'do'
+	size_t k = j;
+	while (k > 0 && !lex_is_delim(line[k - 1])) k--;
+	if (k < j && lex_match_keywords(line, k, "{ if then else elif while until do") == j) prev = ';';
+	bool command_pos = prev == '\0' || is_stage_break(prev);
+	if (command_pos && !strchr(word, '/')) complete_command(out, word, len);
+	else if (!command_pos && prev != '<' && prev != '>' && stage_is_job_control(line, j)) complete_jobs(out, word, len);
+	else complete_path(out, word, command_pos);
+	free(word);
+
+	if (out->count > 1) qsort(out->items, out->count, sizeof(char *), compare_items);
+	size_t n = 0;
+	for (size_t i = 0; i < out->count; ++i) {
+		if (n > 0 && strcmp(out->items[n - 1], out->items[i]) == 0) free(out->items[i]);
+		else out->items[n++] = out->items[i];
+	}
+	out->count = n;
+	return n;
+}
+
+void completion_free(Completion *c) {
+	for (size_t i = 0; i < c->count; ++i) free(c->items[i]);
+	free(c->items);
+	memset(c, 0, sizeof(*c));
+}
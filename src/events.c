@@ -0,0 +1,319 @@
+#define _GNU_SOURCE // wait4(), syscall()
+
+#include "events.h"
+#include "jobs.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <time.h>
+
+pid_t foreground_pgid = 0;
+bool interrupt_received = false;
+
+static int signal_fd = -1;
+static sigset_t saved_mask;
+
+// Pending one-shot timers, each a timerfd polled along with the signalfd
+typedef struct {
+	int id;
+	int fd;
+	EventTimerFn fn;
+	void *arg;
+} Timer;
+
+static Timer *timers = NULL;
+static int timer_count = 0;
+static int timer_cap = 0;
+static int next_timer_id = 1;
+
+// Fds watched on behalf of other modules (see events_fd_watch())
+typedef struct {
+	int fd;
+	short events;
+	EventFdFn fn;
+	void *arg;
+} FdWatch;
+
+static FdWatch *watches = NULL;
+static int watch_count = 0;
+static int watch_cap = 0;
+
+// Scratch array for events_poll(): the caller's fds, the signalfd, the timers,
+// then the watched fds
+static struct pollfd *poll_all = NULL;
+static size_t poll_cap = 0;
+// The watched fds that fired in one poll, copied out before their callbacks
+// may add or remove watches
+static struct pollfd *fired = NULL;
+static int fired_cap = 0;
+
+int events_pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	return -1;
+#endif
+}
+
+int events_timer_start(double seconds, EventTimerFn fn, void *arg) {
+	if (timer_count == timer_cap) {
+		int ncap = timer_cap ? timer_cap * 2 : 4;
+		Timer *tmp = (Timer *)realloc(timers, (size_t)ncap * sizeof(Timer));
+		if (!tmp) return -1;
+		timers = tmp;
+		timer_cap = ncap;
+	}
+	int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0) return -1;
+	struct itimerspec its;
+	memset(&its, 0, sizeof(its));
+	if (seconds < 1e-9) seconds = 1e-9; // an all-zero value would disarm it
+	its.it_value.tv_sec = (time_t)seconds;
+	its.it_value.tv_nsec = (long)((seconds - (double)its.it_value.tv_sec) * 1e9);
+	if (timerfd_settime(fd, 0, &its, NULL) != 0) {
+		close(fd);
+		return -1;
+	}
+	timers[timer_count] = (Timer){ next_timer_id++, fd, fn, arg };
+	return timers[timer_count++].id;
+}
+
+static void timer_remove(int i) {
+	close(timers[i].fd);
+	timers[i] = timers[--timer_count];
+}
+
+void *events_timer_cancel(int id) {
+	for (int i = 0; i < timer_count; ++i) {
+		if (timers[i].id == id) {
+			void *arg = timers[i].arg;
+			timer_remove(i);
+			return arg;
+		}
+	}
+	return NULL;
+}
+
+// Fire every expired timer. A callback may start or cancel timers, so the
+// scan starts over after each one.
+static void run_expired_timers(void) {
+	for (int i = 0; i < timer_count; ++i) {
+		uint64_t expirations;
+		if (read(timers[i].fd, &expirations, sizeof(expirations)) != (ssize_t)sizeof(expirations)) continue;
+		EventTimerFn fn = timers[i].fn;
+		void *arg = timers[i].arg;
+		timer_remove(i);
+		fn(arg);
+		i = -1;
+	}
+}
+
+int events_fd_watch(int fd, short events, EventFdFn fn, void *arg) {
+	if (watch_count == watch_cap) {
+		int ncap = watch_cap ? watch_cap * 2 : 8;
+		FdWatch *tmp = (FdWatch *)realloc(watches, (size_t)ncap * sizeof(FdWatch));
+		if (!tmp) return -1;
+		watches = tmp;
+		watch_cap = ncap;
+	}
+	watches[watch_count++] = (FdWatch){ fd, events, fn, arg };
+	return 0;
+}
+
+void events_fd_modify(int fd, short events) {
+	for (int i = 0; i < watch_count; ++i) {
+		if (watches[i].fd == fd) watches[i].events = events;
+	}
+}
+
+void events_fd_unwatch(int fd) {
+	for (int i = 0; i < watch_count; ++i) {
+		if (watches[i].fd == fd) {
+			watches[i] = watches[--watch_count];
+			return;
+		}
+	}
+}
+
+static void run_fired_watches(int n) {
+	for (int k = 0; k < n; ++k) {
+		// An earlier callback may have dropped this one
+		for (int i = 0; i < watch_count; ++i) {
+			if (watches[i].fd == fired[k].fd) {
+				watches[i].fn(fired[k].fd, fired[k].revents, watches[i].arg);
+				break;
+			}
+		}
+	}
+}
+
+void events_init(void) {
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTSTP);
+	sigaddset(&set, SIGCHLD);
+	// Writing into a pipe whose reader left (the pipemon relay) must fail
+	// with EPIPE rather than kill the shell
+	sigaddset(&set, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &set, &saved_mask);
+	signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (signal_fd < 0) {
+		// Without the fd the shell still must not die or stop on Ctrl-C / Ctrl-Z
+		perror("signalfd");
+		signal(SIGINT, SIG_IGN);
+		signal(SIGTSTP, SIG_IGN);
+		sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+	}
+	// Prevent terminal background job signals from stopping the shell
+	signal(SIGTTIN, SIG_IGN);
+	signal(SIGTTOU, SIG_IGN);
+}
+
+void events_child_reset(void) {
+	// The parent's timers act on the parent's jobs
+	while (timer_count > 0) timer_remove(timer_count - 1);
+	while (watch_count > 0) {
+		FdWatch w = watches[--watch_count];
+		close(w.fd);
+		w.fn(w.fd, POLLNVAL, w.arg);
+	}
+	if (signal_fd < 0) return;
+	close(signal_fd);
+	signal_fd = -1;
+	sigprocmask(SIG_SETMASK, &saved_mask, NULL);
+}
+
+void events_dispatch(void) {
+	struct signalfd_siginfo info;
+	bool child_changed = false;
+	while (signal_fd >= 0 && read(signal_fd, &info, sizeof(info)) == (ssize_t)sizeof(info)) {
+		switch (info.ssi_signo) {
+		case SIGINT:
+			interrupt_received = true;
+			if (foreground_pgid > 0) kill(-foreground_pgid, SIGINT);
+			break;
+		case SIGTSTP:
+			if (foreground_pgid > 0) kill(-foreground_pgid, SIGTSTP);
+			// The job is marked stopped by whoever waits for it; keep the
+			// next output on a line of its own
+			printf("\n");
+			fflush(stdout);
+			break;
+		case SIGCHLD:
+			// One SIGCHLD may stand for several children
+			child_changed = true;
+			break;
+		default:
+			break;
+		}
+	}
+	if (child_changed) jobs_reap();
+	if (timer_count > 0) run_expired_timers();
+}
+
+bool events_interrupted(void) {
+	events_dispatch();
+	return interrupt_received;
+}
+
+static long long monotonic_ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+EventResult events_poll(struct pollfd *fds, size_t n, int timeout_ms) {
+	long long deadline = timeout_ms >= 0 ? monotonic_ms() + timeout_ms : -1;
+	for (;;) {
+		// A negative fd (no signalfd) is skipped by poll()
+		size_t own = n + 1 + (size_t)timer_count;
+		size_t total = own + (size_t)watch_count;
+		if (total > poll_cap) {
+			size_t ncap = poll_cap ? poll_cap * 2 : 16;
+			while (ncap < total) ncap *= 2;
+			struct pollfd *tmp = (struct pollfd *)realloc(poll_all, ncap * sizeof(*tmp));
+			if (!tmp) return EVENT_ERROR;
+			poll_all = tmp;
+			poll_cap = ncap;
+		}
+		if (watch_count > fired_cap) {
+			struct pollfd *tmp = (struct pollfd *)realloc(fired, (size_t)watch_cap * sizeof(*tmp));
+			if (!tmp) return EVENT_ERROR;
+			fired = tmp;
+			fired_cap = watch_cap;
+		}
+		if (n > 0) memcpy(poll_all, fds, n * sizeof(*fds));
+		poll_all[n] = (struct pollfd){ signal_fd, POLLIN, 0 };
+		for (int i = 0; i < timer_count; ++i) poll_all[n + 1 + (size_t)i] = (struct pollfd){ timers[i].fd, POLLIN, 0 };
+		for (int i = 0; i < watch_count; ++i) poll_all[own + (size_t)i] = (struct pollfd){ watches[i].fd, watches[i].events, 0 };
+		int wait_ms = deadline < 0 ? -1 : (int)(deadline > monotonic_ms() ? deadline - monotonic_ms() : 0);
+		int r;
+		do {
+			r = poll(poll_all, (nfds_t)total, wait_ms);
+		} while (r < 0 && errno == EINTR);
+		if (r < 0) return EVENT_ERROR;
+		if (r == 0) return EVENT_TIMEOUT;
+		int nfired = 0;
+		for (size_t i = own; i < total; ++i) {
+			if (poll_all[i].revents) fired[nfired++] = poll_all[i];
+		}
+		r -= nfired;
+		run_fired_watches(nfired);
+		// Only watched fds: keep waiting for what the caller asked for
+		if (r == 0) continue;
+		for (size_t i = 0; i < n; ++i) fds[i].revents = poll_all[i].revents;
+		for (size_t i = n; i < own; ++i) {
+			if (poll_all[i].revents) {
+				events_dispatch();
+				return EVENT_HANDLED;
+			}
+		}
+		return EVENT_READY;
+	}
+}
+
+EventResult events_wait_fd(int fd, int timeout_ms) {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	return events_poll(&pfd, 1, timeout_ms);
+}
+
+pid_t events_wait_child(pid_t pid, int *status, int options, struct rusage *ru) {
+	// Nothing else to watch: a plain blocking wait
+	if (signal_fd < 0 && timer_count == 0 && watch_count == 0) {
+		pid_t r;
+		do {
+			r = wait4(pid, status, options, ru);
+		} while (r < 0 && errno == EINTR);
+		return r;
+	}
+	// SIGCHLD stays queued on the signalfd, so a child exiting between the
+	// wait4() and the poll() still wakes us. Without one (in a forked
+	// subshell) a pidfd marks the exit; stops are not seen there anyway.
+	struct pollfd pfd = { -1, POLLIN, 0 };
+	if (signal_fd < 0) pfd.fd = events_pidfd_open(pid);
+	pid_t r;
+	for (;;) {
+		r = wait4(pid, status, options | WNOHANG, ru);
+		if (r < 0 && errno == EINTR) continue;
+		if (r != 0) break;
+		int timeout = signal_fd < 0 && pfd.fd < 0 ? 100 : -1;
+		if (events_poll(&pfd, 1, timeout) == EVENT_ERROR) {
+			r = -1;
+			break;
+		}
+	}
+	if (pfd.fd >= 0) close(pfd.fd);
+	return r;
+}
@@ -1,7 +1,17 @@
+#define _GNU_SOURCE // wait4(), memfd_create(), pipe2(), F_GETPIPE_SZ / F_SETPIPE_SZ, sched_setaffinity()
+
 #include "executor.h"
 #include "builtins.h"
 #include "cmdparse.h"
+#include "events.h"
+#include "functions.h"
 #include "jobs.h"
+#include "history.h"
+#include "input.h"
+#include "parsecache.h"
+#include "pipemon.h"
+#include "state.h"
+#include "vars.h"
 
 #include <ctype.h>
 #include <stdio.h>
@@ -12,38 +22,120 @@
 #include <sys/wait.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sched.h>
 
-// External reference to foreground process group
-extern pid_t foreground_pgid;
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool failed;
+} CmdText;
 
-static char *build_command_string(const CmdPipeline *group) {
-    // Build a simple string like: "cmd1 arg1 | cmd2 arg2"
-    size_t cap = 128;
-    char *buf = (char *)malloc(cap);
-    if (!buf) return NULL;
-    buf[0] = '\0';
-    size_t len = 0;
+static void text_append(CmdText *t, const char *s) {
+    size_t sl = strlen(s);
+    if (t->failed) return;
+    if (t->len + sl + 1 > t->cap) {
+        size_t ncap = (t->len + sl + 1) * 2;
+        char *nb = (char *)realloc(t->buf, ncap);
+        if (!nb) { t->failed = true; return; }
+        t->buf = nb;
+        t->cap = ncap;
+    }
+    memcpy(t->buf + t->len, s, sl + 1);
+    t->len += sl;
+}
+
+static void text_sequence(CmdText *t, const CmdSequence *seq);
+
+static void text_group(CmdText *t, const CmdPipeline *group) {
     for (int i = 0; i < group->count; ++i) {
-        if (i > 0) {
-            const char *sep = " | ";
-            size_t sl = strlen(sep);
-            if (len + sl + 1 > cap) { cap = (len + sl + 1) * 2; buf = (char *)realloc(buf, cap); if (!buf) return NULL; }
-            memcpy(buf + len, sep, sl); len += sl; buf[len] = '\0';
-        }
-        char **argv = group->cmds[i].argv;
-        for (int a = 0; argv && argv[a]; ++a) {
-            if (a > 0) {
-                if (len + 1 + 1 > cap) { cap = (len + 2) * 2; buf = (char *)realloc(buf, cap); if (!buf) return NULL; }
-                buf[len++] = ' ';
-                buf[len] = '\0';
+        if (i > 0) text_append(t, " | ");
+        const Cmd *c = &group->cmds[i];
+        if (c->kind == CMD_FUNCDEF) {
+            text_append(t, c->argv[0]);
+            text_append(t, "() ");
+            text_sequence(t, c->body);
+            continue;
+        }
+        if (c->kind == CMD_IF) {
+            text_append(t, "if ");
+            text_sequence(t, c->cond);
+            text_append(t, "; then ");
+            text_sequence(t, c->body);
+            if (c->alt) {
+                text_append(t, "; else ");
+                text_sequence(t, c->alt);
+            }
+            text_append(t, "; fi");
+            continue;
+        }
+        if (c->kind == CMD_WHILE || c->kind == CMD_UNTIL || c->kind == CMD_FOR) {
+            if (c->kind == CMD_FOR) {
+                text_append(t, "for ");
+                text_append(t, c->loop_var);
+                text_append(t, " in");
+                for (int a = 0; c->argv[a]; ++a) {
+                    text_append(t, " ");
+                    text_append(t, c->argv[a]);
+                }
+            } else {
+                text_append(t, c->kind == CMD_WHILE ? "while " : "until ");
+                text_sequence(t, c->cond);
             }
-            const char *tok = argv[a];
-            size_t tl = strlen(tok);
-            if (len + tl + 1 > cap) { cap = (len + tl + 1) * 2; buf = (char *)realloc(buf, cap); if (!buf) return NULL; }
-            memcpy(buf + len, tok, tl); len += tl; buf[len] = '\0';
+            text_append(t, "; do ");
+            text_sequence(t, c->body);
+            text_append(t, "; done");
+            continue;
+        }
+        if (c->kind != CMD_SIMPLE) {
+            text_append(t, c->kind == CMD_SUBSHELL ? "(" : "{ ");
+            text_sequence(t, c->body);
+            text_append(t, c->kind == CMD_SUBSHELL ? ")" : "; }");
+            continue;
+        }
+        for (int a = 0; c->argv && c->argv[a]; ++a) {
+            if (a > 0) text_append(t, " ");
+            text_append(t, c->argv[a]);
         }
     }
-    return buf;
+}
+
+static void text_sequence(CmdText *t, const CmdSequence *seq) {
+    for (int i = 0; i < seq->count; ++i) {
+        const CmdPipeline *group = &seq->groups[i];
+        if (i > 0) {
+            if (group->connector == CONNECT_AND) text_append(t, " && ");
+            else if (group->connector == CONNECT_OR) text_append(t, " || ");
+            else text_append(t, seq->groups[i - 1].run_in_background ? " & " : "; ");
+        }
+        text_group(t, group);
+    }
+    if (seq->count > 0 && seq->groups[seq->count - 1].run_in_background) text_append(t, " &");
+}
+
+static char *build_command_string(const CmdPipeline *group) {
+    // Build a simple string like: "cmd1 arg1 | cmd2 arg2"; grouped commands are
+    // written back in their ( ... ) / { ...; } form
+    CmdText t = { NULL, 0, 0, false };
+    text_append(&t, "");
+    text_group(&t, group);
+    if (t.failed) { free(t.buf); return NULL; }
+    return t.buf;
+}
+
+static long long clock_us(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static int status_to_exit_code(int status) {
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
 }
 
 static void skip_ws_idx(const char *s, size_t *i) {
@@ -105,7 +197,7 @@ bool execute_first_atomic(const char *input) {
 		return false;
 	}
 
-	if (try_handle_builtin(argv, argc)) {
+	if (try_handle_builtin(argv, argc, NULL)) {
 		for (int i = 0; i < argc; ++i) free(argv[i]);
 		free(argv);
 		return true;
@@ -113,6 +205,7 @@ bool execute_first_atomic(const char *input) {
 
 	pid_t pid = fork();
 	if (pid == 0) {
+		events_child_reset();
 		execvp(argv[0], argv);
 		perror("execvp");
 		exit(127);
@@ -127,40 +220,327 @@ bool execute_first_atomic(const char *input) {
 	return true;
 }
 
-static int setup_redirections(const Cmd *cmd) {
-    // Handle input redirection (only the last one if multiple)
-    if (cmd->in_file) {
-        int fd = open(cmd->in_file, O_RDONLY);
-        if (fd < 0) {
-            fprintf(stderr, "No such file or directory\n");
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t w = write(fd, data, len);
+        if (w < 0) {
+            if (errno == EINTR) continue;
             return -1;
         }
-        if (dup2(fd, STDIN_FILENO) < 0) {
+        data += w;
+        len -= (size_t)w;
+    }
+    return 0;
+}
+
+// A '<<' / '<<<' payload never touches the disk: it goes straight into a pipe
+// when it fits in the pipe buffer (so the write cannot block with no reader
+// yet), and into an in-memory file otherwise. Returns a readable fd or -1.
+static int open_here_input(const Redirect *r) {
+    size_t len = 0;
+    char *data = cmd_here_payload(r, &len);
+    if (!data) return -1;
+    int fd = -1;
+    int fds[2];
+    if (pipe(fds) == 0) {
+        int cap = fcntl(fds[1], F_GETPIPE_SZ);
+        if (cap > 0 && len <= (size_t)cap && write_all(fds[1], data, len) == 0) {
+            fd = fds[0];
+        } else {
+            close(fds[0]);
+        }
+        close(fds[1]);
+    }
+    if (fd < 0) {
+        fd = memfd_create("here-document", MFD_CLOEXEC);
+        if (fd >= 0 && (write_all(fd, data, len) != 0 || lseek(fd, 0, SEEK_SET) != 0)) {
             close(fd);
+            fd = -1;
+        }
+    }
+    free(data);
+    if (fd < 0) fprintf(stderr, "Unable to create here-document\n");
+    return fd;
+}
+
+// Open path as descriptor fd
+static int redirect_to_file(const char *path, int flags, int fd) {
+    int nfd = open(path, flags, 0666);
+    if (nfd < 0) {
+        if (!(flags & O_WRONLY)) {
+            fprintf(stderr, "No such file or directory\n");
+        } else if (errno == EACCES || errno == EPERM) {
+            fprintf(stderr, "Unable to create file for writing\n");
+        }
+        return -1;
+    }
+    if (nfd != fd) {
+        if (dup2(nfd, fd) < 0) {
+            close(nfd);
             return -1;
         }
-        close(fd);
+        close(nfd);
     }
-    
-    // Handle output redirection (only the last one if multiple)
-    if (cmd->out_file) {
-        int flags = O_WRONLY | O_CREAT | (cmd->out_append ? O_APPEND : O_TRUNC);
-        int fd = open(cmd->out_file, flags, 0666);
-        if (fd < 0) {
-            if (errno == EACCES || errno == EPERM) {
-                fprintf(stderr, "Unable to create file for writing\n");
-            }
+    return 0;
+}
+
+// path is the file target, expanded when it is a process substitution
+static int apply_redirect(const Redirect *r, const char *path) {
+    switch (r->op) {
+    case REDIR_IN:
+        return redirect_to_file(path, O_RDONLY, r->fd);
+    case REDIR_OUT:
+    case REDIR_APPEND:
+        return redirect_to_file(path, O_WRONLY | O_CREAT | (r->op == REDIR_APPEND ? O_APPEND : O_TRUNC), r->fd);
+    case REDIR_OUT_ALL:
+    case REDIR_APPEND_ALL:
+        if (redirect_to_file(path, O_WRONLY | O_CREAT | (r->op == REDIR_APPEND_ALL ? O_APPEND : O_TRUNC),
+                             STDOUT_FILENO) != 0) return -1;
+        return dup2(STDOUT_FILENO, STDERR_FILENO) < 0 ? -1 : 0;
+    case REDIR_DUP:
+        if (fcntl(r->src, F_GETFD) < 0 || (r->src != r->fd && dup2(r->src, r->fd) < 0)) {
+            fprintf(stderr, "%d: Bad file descriptor\n", r->src);
             return -1;
         }
-        if (dup2(fd, STDOUT_FILENO) < 0) {
+        return 0;
+    case REDIR_CLOSE:
+        close(r->fd);
+        return 0;
+    case REDIR_HEREDOC:
+    case REDIR_HERESTRING: {
+        int fd = open_here_input(r);
+        if (fd < 0) return -1;
+        if (fd != r->fd) {
+            int rc = dup2(fd, r->fd) < 0 ? -1 : 0;
             close(fd);
-            return -1;
+            return rc;
         }
-        close(fd);
+        return 0;
+    }
+    }
+    return -1;
+}
+
+// Redirections are resolved once, left to right, stopping at the first failure.
+// a holds the command's expanded words (NULL when nothing was expanded).
+static int setup_redirections(const Cmd *cmd, const ArgvList *a) {
+    for (int i = 0; i < cmd->redir_count; ++i) {
+        const char *path = a && a->targets && a->targets[i] ? a->targets[i] : cmd->redirs[i].path;
+        if (apply_redirect(&cmd->redirs[i], path) != 0) return -1;
     }
     return 0;
 }
 
+// Descriptors replaced while a builtin or brace group runs inside the shell
+typedef struct {
+    int fd;
+    int saved; // copy of the original, -1 when fd was closed
+} SavedFd;
+
+typedef struct {
+    SavedFd *fds;
+    int count;
+} FdBackup;
+
+static void backup_fd(FdBackup *b, int fd) {
+    for (int i = 0; i < b->count; ++i) {
+        if (b->fds[i].fd == fd) return;
+    }
+    b->fds[b->count].fd = fd;
+    b->fds[b->count].saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    b->count++;
+}
+
+// Apply a command's redirections to the shell itself, keeping what they
+// replace so restore_fds() can put it back afterwards
+static int redirect_in_shell(const Cmd *c, const ArgvList *a, FdBackup *b) {
+    b->count = 0;
+    b->fds = (SavedFd *)malloc((size_t)(2 * c->redir_count + 1) * sizeof(SavedFd));
+    if (!b->fds) return -1;
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = 0; i < c->redir_count; ++i) {
+        backup_fd(b, c->redirs[i].fd);
+        if (c->redirs[i].op == REDIR_OUT_ALL || c->redirs[i].op == REDIR_APPEND_ALL) backup_fd(b, STDERR_FILENO);
+    }
+    return setup_redirections(c, a);
+}
+
+static void restore_fds(FdBackup *b) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = b->count - 1; i >= 0; --i) {
+        if (b->fds[i].saved < 0) {
+            close(b->fds[i].fd);
+            continue;
+        }
+        dup2(b->fds[i].saved, b->fds[i].fd);
+        close(b->fds[i].saved);
+    }
+    free(b->fds);
+}
+
+
+// Set in forked children that run shell code (subshells and grouped pipeline
+// stages). Their commands stay in the child's process group and never take the
+// terminal, so job control keeps treating the whole group as one job.
+static bool in_subshell = false;
+
+static void enter_subshell(void) {
+    in_subshell = true;
+}
+
+static bool is_builtin(const char *name) {
+    for (size_t i = 0; builtin_name(i); ++i) {
+        if (strcmp(builtin_name(i), name) == 0) return true;
+    }
+    return false;
+}
+
+// exec_path is only set for a literal command name, so it names argv[0]
+static void exec_command(const Cmd *c, const ArgvList *a) {
+    const char *path = parse_cache_exec_path(c);
+    if (path) execv(path, a->argv);
+    execvp(a->argv[0], a->argv);
+}
+
+static int execute_sequence(CmdSequence *seq, bool exec_tail);
+
+// Brace group, if, while, until or for in the current process: the shell
+// itself, or the child running a pipeline stage. Bodies run straight from
+// their parsed form on every pass. A loop stops once an interrupt is seen,
+// i.e. Ctrl-C reached the shell or a foreground command was interrupted or stopped.
+static int run_compound(const Cmd *c, const ArgvList *a) {
+    int status = 0;
+    switch (c->kind) {
+    case CMD_IF:
+        if (execute_sequence(c->cond, false) == 0) return execute_sequence(c->body, false);
+        return c->alt ? execute_sequence(c->alt, false) : 0;
+    case CMD_WHILE:
+    case CMD_UNTIL:
+        while (!events_interrupted()) {
+            int cond = execute_sequence(c->cond, false);
+            if (interrupt_received || (cond == 0) != (c->kind == CMD_WHILE)) break;
+            status = execute_sequence(c->body, false);
+        }
+        return status;
+    case CMD_FOR:
+        for (int i = 0; i < a->argc && !events_interrupted(); ++i) {
+            if (vars_set(c->loop_var, a->argv[i]) != 0) return 1;
+            status = execute_sequence(c->body, false);
+        }
+        return status;
+    default:
+        return execute_sequence(c->body, false);
+    }
+}
+
+// Compound command outside a pipeline: runs in this process. Its redirections
+// are opened once and stay in place for every command inside.
+static int run_compound_in_shell(const Cmd *c, const ArgvList *a) {
+    FdBackup b;
+    int status = 1;
+    if (redirect_in_shell(c, a, &b) == 0) status = run_compound(c, a);
+    restore_fds(&b);
+    return status;
+}
+
+#define FUNCTION_DEPTH_MAX 256
+
+static int function_depth = 0;
+
+// Run a function body; the reference taken keeps it alive should the
+// function be redefined while it runs
+static int call_function(const char *name, CmdSequence *body) {
+    if (function_depth >= FUNCTION_DEPTH_MAX) {
+        fprintf(stderr, "%s: maximum function nesting level exceeded\n", name);
+        return 1;
+    }
+    body->refs++;
+    function_depth++;
+    int status = execute_sequence(body, false);
+    function_depth--;
+    free_cmd_sequence(body);
+    return status;
+}
+
+// Function call outside a pipeline: runs in this process, with the call's
+// redirections around the whole body
+static int run_function(const Cmd *c, const ArgvList *a, CmdSequence *body) {
+    FdBackup b;
+    int status = 1;
+    if (redirect_in_shell(c, a, &b) == 0) status = call_function(a->argv[0], body);
+    restore_fds(&b);
+    return status;
+}
+
+// Pipe between two pipeline stages. Close-on-exec, so a stage keeps only the
+// ends it dup2()s onto stdin / stdout, and sized as 'set pipesize' asks.
+static int open_stage_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    int size = state_get_pipe_size();
+    // Past the user's pipe buffer quota the kernel refuses; the default still works
+    if (size > 0) fcntl(fds[1], F_SETPIPE_SZ, size);
+    return 0;
+}
+
+// What a stage is called in pipemon's reports
+static const char *stage_name(const Cmd *c, const ArgvList *a) {
+    switch (c->kind) {
+    case CMD_SIMPLE: return a->argc > 0 ? a->argv[0] : "(assignment)";
+    case CMD_SUBSHELL: return "( )";
+    case CMD_BRACE: return "{ }";
+    case CMD_FUNCDEF: return c->argv[0];
+    case CMD_IF: return "if";
+    case CMD_WHILE: return "while";
+    case CMD_UNTIL: return "until";
+    case CMD_FOR: return "for";
+    }
+    return "?";
+}
+
+// The connection from stage j to stage j+1 of a group: one pipe, or under
+// pipemon two, with the shell relaying from the first into the second.
+// fds[1] is stage j's stdout and fds[0] the next stage's stdin either way.
+static int open_stage_link(PipeMon *mon, const CmdPipeline *group, const ArgvList *args, int j, int fds[2]) {
+    if (!mon) return open_stage_pipe(fds);
+    int up[2], down[2];
+    if (open_stage_pipe(up) != 0) return -1;
+    if (open_stage_pipe(down) != 0) {
+        close(up[0]);
+        close(up[1]);
+        return -1;
+    }
+    if (pipemon_add_link(mon, up[0], down[1], stage_name(&group->cmds[j], &args[j]),
+                         stage_name(&group->cmds[j + 1], &args[j + 1])) != 0) {
+        close(up[0]);
+        close(up[1]);
+        close(down[0]);
+        close(down[1]);
+        errno = ENOMEM;
+        return -1;
+    }
+    fds[0] = down[0];
+    fds[1] = up[1];
+    return 0;
+}
+
+int execute_set_pipe_size(int bytes) {
+    if (bytes == 0) {
+        state_set_pipe_size(0);
+        return 0;
+    }
+    // Try it out now rather than on every later pipeline
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    int size = fcntl(fds[1], F_SETPIPE_SZ, bytes);
+    int saved = errno;
+    close(fds[0]);
+    close(fds[1]);
+    errno = saved;
+    if (size > 0) state_set_pipe_size(size);
+    return size;
+}
 
 bool execute_first_group_pipeline(const char *input) {
     CmdPipeline *pipep = parse_first_cmd_group(input);
@@ -173,16 +553,17 @@ bool execute_first_group_pipeline(const char *input) {
     if (pipep->count == 1) {
         Cmd *c = &pipep->cmds[0];
         int argc = 0; while (c->argv && c->argv[argc]) argc++;
-        if (try_handle_builtin(c->argv, argc)) {
+        if (try_handle_builtin(c->argv, argc, NULL)) {
             // For builtins with redirection, we need to fork and handle redirection in child
-            if (c->in_file || c->out_file) {
+            if (c->redir_count > 0) {
                 pid_t pid = fork();
                 if (pid == 0) {
                     // Child process
-                    if (setup_redirections(c) != 0) {
+                    events_child_reset();
+                    if (setup_redirections(c, NULL) != 0) {
                         _exit(1);
                     }
-                    try_handle_builtin(c->argv, argc);
+                    try_handle_builtin(c->argv, argc, NULL);
                     _exit(0);
                 } else if (pid > 0) {
                     // Parent process
@@ -196,46 +577,41 @@ bool execute_first_group_pipeline(const char *input) {
     }
 
     int n = pipep->count;
-    int (*pipes)[2] = NULL;
-    if (n > 1) {
-        pipes = (int (*)[2])calloc((size_t)(n - 1), sizeof(int[2]));
-        if (!pipes) { free_cmd_pipeline(pipep); return false; }
-        for (int i = 0; i < n - 1; ++i) {
-            if (pipe(pipes[i]) < 0) {
-                // continue best-effort
-            }
-        }
-    }
-
     pid_t *pids = (pid_t *)calloc((size_t)n, sizeof(pid_t));
-    if (!pids) { free(pipes); free_cmd_pipeline(pipep); return false; }
+    if (!pids) { free_cmd_pipeline(pipep); return false; }
 
+    // Each pipe is made right before the stage writing into it
+    int prev_read = -1;
     for (int i = 0; i < n; ++i) {
+        int next[2] = { -1, -1 };
+        if (i < n - 1 && open_stage_pipe(next) != 0) {
+            perror("pipe");
+            break;
+        }
         pid_t pid = fork();
         if (pid == 0) {
             // child
+            events_child_reset();
             // connect pipes
-            if (n > 1) {
-                if (i > 0) {
-                    dup2(pipes[i - 1][0], STDIN_FILENO);
-                }
-                if (i < n - 1) {
-                    dup2(pipes[i][1], STDOUT_FILENO);
-                }
-                for (int k = 0; k < n - 1; ++k) {
-                    close(pipes[k][0]);
-                    close(pipes[k][1]);
-                }
+            if (prev_read >= 0) {
+                dup2(prev_read, STDIN_FILENO);
+                close(prev_read);
+            }
+            if (next[1] >= 0) {
+                dup2(next[1], STDOUT_FILENO);
+                close(next[1]);
+                close(next[0]);
             }
             // redirections
-            if (setup_redirections(&pipep->cmds[i]) != 0) {
+            if (setup_redirections(&pipep->cmds[i], NULL) != 0) {
                 _exit(1);
             }
             
             // Check if this is a builtin command
             int argc = 0; while (pipep->cmds[i].argv && pipep->cmds[i].argv[argc]) argc++;
-            if (try_handle_builtin(pipep->cmds[i].argv, argc)) {
-                _exit(0); // Builtin executed successfully
+            int builtin_status = 0;
+            if (try_handle_builtin(pipep->cmds[i].argv, argc, &builtin_status)) {
+                _exit(builtin_status);
             }
             
             execvp(pipep->cmds[i].argv[0], pipep->cmds[i].argv);
@@ -244,14 +620,11 @@ bool execute_first_group_pipeline(const char *input) {
             _exit(127);
         }
         pids[i] = pid;
+        if (prev_read >= 0) close(prev_read);
+        if (next[1] >= 0) close(next[1]);
+        prev_read = next[0];
     }
-
-    if (n > 1) {
-        for (int k = 0; k < n - 1; ++k) {
-            close(pipes[k][0]);
-            close(pipes[k][1]);
-        }
-    }
+    if (prev_read >= 0) close(prev_read);
 
     for (int i = 0; i < n; ++i) {
         int status = 0;
@@ -259,195 +632,695 @@ bool execute_first_group_pipeline(const char *input) {
     }
 
     free(pids);
-    free(pipes);
     free_cmd_pipeline(pipep);
     return true;
 }
 
-bool execute_shell_cmd(const char *input) {
-    CmdSequence *seq = parse_shell_cmd(input);
-    if (!seq || seq->count <= 0) {
-        free_cmd_sequence(seq);
-        return false;
+// A process started for <(...) or >(...), and the shell's end of its pipe
+typedef struct {
+    pid_t pid;
+    int fd;
+} ProcSubst;
+
+// The substitutions started while one group's words expand. Forked with the
+// group, they join its process group and its job; see execute_process_subst().
+typedef struct {
+    ProcSubst *procs;
+    int count;
+    int cap;
+    pid_t pgid; // process group of the first one, 0 inside a subshell
+} ProcSubstSet;
+
+static ProcSubstSet pending_substs;
+
+static void proc_substs_close(ProcSubstSet *set) {
+    for (int k = 0; k < set->count; ++k) {
+        if (set->procs[k].fd >= 0) close(set->procs[k].fd);
+        set->procs[k].fd = -1;
     }
+}
 
-    // Execute each group sequentially
-    for (int i = 0; i < seq->count; ++i) {
-        CmdPipeline *group = &seq->groups[i];
-        
-        // Single command without pipe: allow builtins
-        if (group->count == 1) {
-            Cmd *c = &group->cmds[0];
-            int argc = 0; while (c->argv && c->argv[argc]) argc++;
-            if (try_handle_builtin(c->argv, argc)) {
-                // For builtins with redirection, we need to fork and handle redirection in child
-                if (c->in_file || c->out_file) {
-                    pid_t pid = fork();
-                    if (pid == 0) {
-                        // Child process
-                        if (setup_redirections(c) != 0) {
-                            _exit(1);
-                        }
-                        try_handle_builtin(c->argv, argc);
-                        _exit(0);
-                    } else if (pid > 0) {
-                        // Parent process
-                        int status;
-                        waitpid(pid, &status, 0);
-                    }
-                }
-                continue; // builtin executed, move to next group
-            }
+// Those of a group that ran inside the shell (or did not run): once the
+// shell's ends are closed they finish, and are waited for in the foreground
+static void proc_substs_finish(ProcSubstSet *set) {
+    proc_substs_close(set);
+    if (set->count > 0 && set->pgid > 0) foreground_pgid = set->pgid;
+    for (int k = 0; k < set->count; ++k) {
+        int status = 0;
+        events_wait_child(set->procs[k].pid, &status, 0, NULL);
+    }
+    if (set->count > 0 && set->pgid > 0) foreground_pgid = 0;
+    free(set->procs);
+    memset(set, 0, sizeof(*set));
+}
+
+// Armed timer's argument, freed by whichever of firing or cancelling comes first
+typedef struct {
+    pid_t target; // -pgid, or a lone process inside a subshell
+    int sig;
+} TimeoutKill;
+
+// Whether the builtin running in the shell was given '&' (see execute_launch())
+static bool launch_in_background = false;
+
+// In a child about to exec: what 'run' asked for. Failing any of it fails the
+// command rather than running it unconstrained.
+static void apply_limits(const JobLimits *l) {
+    if (l->cpus_spec) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < JOB_MAX_CPUS && cpu < CPU_SETSIZE; ++cpu) {
+            if (l->cpus[cpu / (8 * sizeof(unsigned long))] & (1UL << (cpu % (8 * sizeof(unsigned long))))) CPU_SET(cpu, &set);
         }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+            fprintf(stderr, "run: cpus %s: %s\n", l->cpus_spec, strerror(errno));
+            _exit(125);
+        }
+    }
+    if (l->set_nice && setpriority(PRIO_PROCESS, 0, l->nice) != 0) {
+        fprintf(stderr, "run: nice %d: %s\n", l->nice, strerror(errno));
+        _exit(125);
+    }
+    if (l->mem > 0) {
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_AS, &rl) != 0) rl.rlim_max = RLIM_INFINITY;
+        rl.rlim_cur = (rlim_t)l->mem;
+        if (rl.rlim_max != RLIM_INFINITY && rl.rlim_cur > rl.rlim_max) rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_AS, &rl) != 0) {
+            fprintf(stderr, "run: mem: %s\n", strerror(errno));
+            _exit(125);
+        }
+    }
+}
 
-        // Execute as pipeline (handles both single commands and pipes)
-        int n = group->count;
-        int (*pipes)[2] = NULL;
-        if (n > 1) {
-            pipes = (int (*)[2])calloc((size_t)(n - 1), sizeof(int[2]));
-            if (!pipes) continue; // skip this group on error
-            for (int j = 0; j < n - 1; ++j) {
-                if (pipe(pipes[j]) < 0) {
-                    // continue best-effort
-                }
-            }
+static void timeout_expired(void *arg) {
+    TimeoutKill *t = (TimeoutKill *)arg;
+    kill(t->target, t->sig);
+    // A stopped job would only see the signal once continued
+    if (t->sig != SIGKILL && t->sig != SIGCONT) kill(t->target, SIGCONT);
+    free(t);
+}
+
+static int arm_timeout(const GroupLaunch *launch, pid_t target) {
+    TimeoutKill *t = (TimeoutKill *)malloc(sizeof(TimeoutKill));
+    if (!t) return 0;
+    t->target = target;
+    t->sig = launch->timeout_sig;
+    int id = events_timer_start(launch->timeout, timeout_expired, t);
+    if (id < 0) {
+        free(t);
+        return 0;
+    }
+    return id;
+}
+
+// Run one cmd_group (a pipeline) with its already-expanded argv lists.
+// Returns the group's exit status: 0 for background groups, otherwise the
+// last stage's status (or the rightmost failing one under pipefail).
+// A group started by a launcher builtin always forks, and with a timeout 124
+// means it ran out of time. A forked group takes over substs, the process
+// substitutions of its words.
+static int execute_group(CmdPipeline *group, const ArgvList *args, bool follows_previous,
+                         const GroupLaunch *launch, ProcSubstSet *substs) {
+    CmdKind kind = group->cmds[0].kind;
+    if (group->count == 1 && kind != CMD_SIMPLE && kind != CMD_SUBSHELL && kind != CMD_FUNCDEF &&
+        !group->run_in_background) {
+        return run_compound_in_shell(&group->cmds[0], &args[0]);
+    }
+    if (group->count == 1 && group->cmds[0].kind == CMD_FUNCDEF && !group->run_in_background) {
+        return functions_define(group->cmds[0].argv[0], group->cmds[0].body) == 0 ? 0 : 1;
+    }
+    // Single command without pipe: allow functions and builtins
+    if (group->count == 1 && group->cmds[0].kind == CMD_SIMPLE && !launch) {
+        Cmd *c = &group->cmds[0];
+        char **argv = args[0].argv;
+        int argc = args[0].argc;
+        // Bare NAME=value words set shell variables
+        if (argc == 0) {
+            for (int k = 0; k < args[0].env_count; ++k) vars_assign(args[0].env[k]);
+            return 0;
+        }
+        CmdSequence *fn = functions_get(argv[0]);
+        if (fn && !group->run_in_background) return run_function(c, &args[0], fn);
+        if (is_builtin(argv[0])) {
+            // Runs once, in the shell, with its redirections applied around it.
+            // A launcher builtin given '&' starts its job in the background.
+            int builtin_status = 1;
+            FdBackup b;
+            launch_in_background = group->run_in_background;
+            if (redirect_in_shell(c, &args[0], &b) == 0) try_handle_builtin(argv, argc, &builtin_status);
+            launch_in_background = false;
+            restore_fds(&b);
+            return builtin_status; // builtin executed, move to next group
         }
+    }
 
-        pid_t *pids = (pid_t *)calloc((size_t)n, sizeof(pid_t));
-        if (!pids) { free(pipes); continue; }
-
-        for (int j = 0; j < n; ++j) {
-            pid_t pid = fork();
-            if (pid == 0) {
-                // child
-                // Set process group for signal handling
-                setpgid(0, 0);
-                
-                // connect pipes
-                if (n > 1) {
-                    if (j > 0) {
-                        dup2(pipes[j - 1][0], STDIN_FILENO);
-                    }
-                    if (j < n - 1) {
-                        dup2(pipes[j][1], STDOUT_FILENO);
-                    }
-                    for (int k = 0; k < n - 1; ++k) {
-                        close(pipes[k][0]);
-                        close(pipes[k][1]);
-                    }
-                }
-                // redirections
-                if (setup_redirections(&group->cmds[j]) != 0) {
-                    _exit(1);
-                }
-                
-                // Check if this is a builtin command
-                int argc = 0; while (group->cmds[j].argv && group->cmds[j].argv[argc]) argc++;
-                if (try_handle_builtin(group->cmds[j].argv, argc)) {
-                    // Builtin executed successfully, exit with success
-                    _exit(0);
-                }
-                
-                execvp(group->cmds[j].argv[0], group->cmds[j].argv);
-                // On failure, print exact spec-required message
-                fprintf(stderr, "Command not found!\n");
-                _exit(127);
+    // Execute as pipeline (handles both single commands and pipes)
+    int n = group->count;
+    // The group's processes come first, then those of its substitutions
+    int nsubst = substs ? substs->count : 0;
+    int total = n + nsubst;
+    pid_t *pids = (pid_t *)calloc((size_t)total, sizeof(pid_t));
+    if (!pids) return 1; // skip this group on error
+    pid_t pgid = substs ? substs->pgid : 0;
+    // Each pipe is made right before the stage writing into it, so the shell
+    // holds at most three pipe fds however long the pipeline is
+    int prev_read = -1;
+    bool pipe_failed = false;
+    PipeMon *mon = n > 1 && state_get_pipemon() ? pipemon_new() : NULL;
+    // Background jobs past the admission limits are held until their turn;
+    // the others start right away at their priority's niceness
+    bool background_job = group->run_in_background && !in_subshell;
+    bool queued = background_job && jobs_admission_full();
+    int priority = state_get_job_priority();
+
+    long long start_wall_us = clock_us(CLOCK_REALTIME);
+    long long start_mono_us = clock_us(CLOCK_MONOTONIC);
+    // Children that run shell code would otherwise repeat pending output
+    fflush(stdout);
+    for (int j = 0; j < n; ++j) {
+        int next[2] = { -1, -1 };
+        if (j < n - 1 && open_stage_link(mon, group, args, j, next) != 0) {
+            perror("pipe");
+            pipe_failed = true;
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            // child
+            events_child_reset();
+            // Set process group for signal handling
+            if (!in_subshell) setpgid(0, pgid);
+            // Held here, before touching any file, until jobs_admit() continues it
+            if (queued) raise(SIGSTOP);
+            else if (background_job && jobs_priority_nice(priority) != 0) setpriority(PRIO_PROCESS, 0, jobs_priority_nice(priority));
+            if (launch && launch->limits) apply_limits(launch->limits);
+            
+            // connect pipes; a stage that runs shell code instead of exec'ing
+            // must not keep its own input's write end or its output's read end
+            if (prev_read >= 0) {
+                dup2(prev_read, STDIN_FILENO);
+                close(prev_read);
+            }
+            if (next[1] >= 0) {
+                dup2(next[1], STDOUT_FILENO);
+                close(next[1]);
+                close(next[0]);
+            }
+            // redirections
+            if (setup_redirections(&group->cmds[j], &args[j]) != 0) {
+                _exit(1);
             }
-            pids[j] = pid;
             
-            // Set process group for the first process in the pipeline
-            if (j == 0) {
-                setpgid(pid, pid);
-                foreground_pgid = pid;
-            } else {
-                setpgid(pid, pids[0]);
+            // Defining a function in a forked stage only affects that child
+            if (group->cmds[j].kind == CMD_FUNCDEF) _exit(0);
+            // A grouped stage runs its whole body in this one child
+            if (group->cmds[j].kind != CMD_SIMPLE) {
+                enter_subshell();
+                int status = group->cmds[j].kind == CMD_SUBSHELL ? execute_sequence(group->cmds[j].body, true)
+                                                                 : run_compound(&group->cmds[j], &args[j]);
+                fflush(stdout);
+                _exit(status);
             }
-        }
 
-        if (n > 1) {
-            for (int k = 0; k < n - 1; ++k) {
-                close(pipes[k][0]);
-                close(pipes[k][1]);
+            // Check if this is a builtin command
+            if (args[j].argc == 0) _exit(0);
+            CmdSequence *fn = functions_get(args[j].argv[0]);
+            if (fn) {
+                enter_subshell();
+                int status = call_function(args[j].argv[0], fn);
+                fflush(stdout);
+                _exit(status);
             }
+            int builtin_status = 0;
+            if (is_builtin(args[j].argv[0])) {
+                // Whatever it runs in turn ('timeout', 'watch') belongs to this job
+                enter_subshell();
+                try_handle_builtin(args[j].argv, args[j].argc, &builtin_status);
+                fflush(stdout);
+                _exit(builtin_status);
+            }
+            
+            environ = vars_environ_with(args[j].env, args[j].env_count);
+            exec_command(&group->cmds[j], &args[j]);
+            // On failure, print exact spec-required message
+            fprintf(stderr, "Command not found!\n");
+            _exit(127);
         }
-
-        // Handle background vs foreground execution per-group based on parsed separator
-        bool is_background_group = seq->groups[i].run_in_background;
+        pids[j] = pid;
+        if (prev_read >= 0) close(prev_read);
+        if (next[1] >= 0) close(next[1]);
+        prev_read = next[0];
+        if (in_subshell || pid < 0) continue;
         
-        // For sequential execution, ensure each group completes before the next
-        if (i > 0) {
-            // Small delay to ensure file system operations complete
-            // Use a lighter approach to ensure file system operations are visible
-            fsync(STDOUT_FILENO);
-            // Also ensure any pending I/O is flushed
-            fflush(stdout);
-            fflush(stderr);
-            // Small delay to ensure file system operations are visible
-            sleep(0); // Yield to scheduler
+        // The first process leads the group, unless substitutions already do
+        if (pgid == 0) pgid = pid;
+        setpgid(pid, pgid);
+        // Queued only once it has actually stopped, so no SIGCONT can come too early
+        if (queued) {
+            int status;
+            events_wait_child(pid, &status, WUNTRACED, NULL);
         }
-        
-        if (is_background_group) {
-            // Background execution: don't wait, add to job tracking
-            // For simplicity, we'll track the first process in the pipeline
-            if (n > 0 && pids[0] > 0) {
-                // Create a command string for job tracking (entire pipeline)
-                char *cmd_str = build_command_string(group);
-                if (!cmd_str) cmd_str = strdup("unknown");
-                // Add " &" to the command string for background jobs
-                char *bg_cmd = malloc(strlen(cmd_str) + 3);
-                strcpy(bg_cmd, cmd_str);
-                strcat(bg_cmd, " &");
-                int job_num = jobs_add(pids[0], bg_cmd, true);
-                if (job_num > 0) {
-                    jobs_print_job(job_num, pids[0]);
-                }
-                free(cmd_str);
-                free(bg_cmd);
+        if (j == 0 && !group->run_in_background) foreground_pgid = pgid;
+    }
+    if (pgid == 0) pgid = pids[0];
+    for (int k = 0; k < nsubst; ++k) pids[n + k] = substs->procs[k].pid;
+    if (nsubst > 0) {
+        proc_substs_close(substs);
+        substs->count = 0;
+    }
+    if (prev_read >= 0) close(prev_read);
+    // Half a pipeline is not what was asked for: stop what did start and
+    // collect it in the foreground
+    if (pipe_failed) {
+        for (int k = 0; k < total; ++k) {
+            if (pids[k] > 0) kill(pids[k], SIGKILL);
+        }
+    }
+
+    // Armed once every process exists; the signal goes to the whole group
+    int timer_id = 0;
+    if (launch && launch->timeout > 0 && !pipe_failed && n > 0 && pids[0] > 0) {
+        timer_id = arm_timeout(launch, in_subshell ? pids[0] : -pgid);
+    }
+
+    // Handle background vs foreground execution per-group based on parsed separator
+    bool is_background_group = group->run_in_background && !pipe_failed;
+    int group_status = 0;
+    
+    // For sequential execution, ensure each group completes before the next
+    if (follows_previous) {
+        // Small delay to ensure file system operations complete
+        // Use a lighter approach to ensure file system operations are visible
+        fsync(STDOUT_FILENO);
+        // Also ensure any pending I/O is flushed
+        fflush(stdout);
+        fflush(stderr);
+        // Small delay to ensure file system operations are visible
+        sleep(0); // Yield to scheduler
+    }
+    
+    if (is_background_group) {
+        // Background execution: don't wait, add to job tracking with every
+        // process of the pipeline
+        if (n > 0 && pids[0] > 0) {
+            // Create a command string for job tracking (entire pipeline)
+            char *cmd_str = build_command_string(group);
+            if (!cmd_str) cmd_str = strdup("unknown");
+            // Add " &" to the command string for background jobs
+            char *bg_cmd = malloc(strlen(cmd_str) + 3);
+            strcpy(bg_cmd, cmd_str);
+            strcat(bg_cmd, " &");
+            int job_num = jobs_add(pgid, pids, total, bg_cmd, true);
+            if (job_num > 0) {
+                jobs_print_job(job_num, pgid);
             }
-        } else {
-            // Foreground execution: give terminal to job's process group, then wait
-            if (n > 0 && pids[0] > 0) {
-                // Transfer terminal control to the foreground job's process group
-                tcsetpgrp(STDIN_FILENO, pids[0]);
+            Job *job = jobs_get(job_num);
+            if (job) {
+                job->timer_id = timer_id;
+                job->monitor = mon;
+                job->priority = priority;
+                if (launch) jobs_set_limits(job_num, launch->limits);
+                mon = NULL;
+                if (queued) {
+                    jobs_set_queued(job_num, priority);
+                    jobs_admit();
+                }
+            } else {
+                // Untracked, it cannot wait for its turn
+                if (queued) kill(-pgid, SIGCONT);
+                if (timer_id > 0) free(events_timer_cancel(timer_id));
             }
-            // Foreground execution: wait for all processes in this group to complete or stop
-            for (int j = 0; j < n; ++j) {
-                int status = 0;
-                if (pids[j] > 0) {
-                    pid_t result;
-                    for (;;) {
-                        result = waitpid(pids[j], &status, WUNTRACED);
-                        if (result == -1 && errno == EINTR) { continue; }
-                        break;
+            free(cmd_str);
+            free(bg_cmd);
+        }
+    } else {
+        // Foreground execution: give terminal to job's process group, then wait
+        if (n > 0 && pids[0] > 0 && !in_subshell) {
+            // Transfer terminal control to the foreground job's process group
+            tcsetpgrp(STDIN_FILENO, pgid);
+        }
+        // Foreground execution: wait for all processes in this group to complete or stop
+        bool stopped = false;
+        int stopped_job = 0;
+        int last_status = 0;
+        long max_rss_kb = 0;
+        for (int j = 0; j < total && !stopped; ++j) {
+            int status = 0;
+            if (pids[j] > 0) {
+                pid_t result;
+                struct rusage ru;
+                // A subshell stops along with its commands; only the shell tracks jobs
+                result = events_wait_child(pids[j], &status, in_subshell ? 0 : WUNTRACED, &ru);
+                if (result > 0 && !WIFSTOPPED(status)) {
+                    if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) interrupt_received = true;
+                    if (ru.ru_maxrss > max_rss_kb) max_rss_kb = ru.ru_maxrss;
+                    int code = status_to_exit_code(status);
+                    if (j == n - 1) last_status = code;
+                    if (j < n && (state_get_pipefail() ? code != 0 : j == n - 1)) group_status = code;
+                }
+                if (result > 0 && WIFSTOPPED(status)) {
+                    stopped = true;
+                    interrupt_received = true;
+                    group_status = 128 + WSTOPSIG(status);
+                    // Process was stopped (Ctrl-Z): the whole pipeline becomes a
+                    // stopped job holding the processes not yet waited for
+                    char *cmd_str = build_command_string(group);
+                    const char *cmd_name = group->cmds[j].kind == CMD_SIMPLE && group->cmds[j].argv ? group->cmds[j].argv[0] : cmd_str;
+                    if (!cmd_name) cmd_name = "unknown";
+                    int job_num = jobs_add(pgid, pids + j, total - j, cmd_str ? cmd_str : cmd_name, false);
+                    jobs_set_stopped(job_num);
+                    stopped_job = job_num;
+                    // The relay keeps running for the stopped job
+                    Job *job = jobs_get(job_num);
+                    if (job) {
+                        job->monitor = mon;
+                        mon = NULL;
+                        if (launch) jobs_set_limits(job_num, launch->limits);
                     }
-                    if (result > 0 && WIFSTOPPED(status)) {
-                        // Process was stopped (Ctrl-Z)
-                        const char *cmd_name = group->cmds[j].argv[0] ? group->cmds[j].argv[0] : "unknown";
-                        // Add to job tracking as stopped first to get proper job number (store full pipeline)
-                        char *cmd_str = build_command_string(group);
-                        if (!cmd_str) cmd_str = strdup(cmd_name);
-                        int job_num = jobs_add(pids[0], cmd_str, false);
-                        jobs_set_stopped(job_num);
-                        free(cmd_str);
-                        if (job_num > 0) {
-                            printf("[%d] Stopped %s\n", job_num, cmd_name);
-                            fflush(stdout);
-                        }
+                    if (job_num > 0) {
+                        printf("[%d] Stopped %s\n", job_num, cmd_name);
+                        fflush(stdout);
                     }
+                    free(cmd_str);
                 }
             }
-            // Restore terminal control back to the shell
-            tcsetpgrp(STDIN_FILENO, getpgrp());
-            // Clear foreground process group after the pipeline finishes or stops
-            foreground_pgid = 0;
         }
+        if (timer_id > 0) {
+            // A stopped job keeps its deadline; otherwise the timer is done with
+            Job *job = stopped ? jobs_get(stopped_job) : NULL;
+            if (job) {
+                job->timer_id = timer_id;
+            } else {
+                void *pending = events_timer_cancel(timer_id);
+                if (pending) free(pending);
+                else if (!stopped) group_status = 124;
+            }
+        }
+        // Restore terminal control back to the shell
+        if (!in_subshell) tcsetpgrp(STDIN_FILENO, getpgrp());
+        if (!stopped) {
+            char *cmd_str = build_command_string(group);
+            if (cmd_str) {
+                history_record_stats(cmd_str, start_wall_us, clock_us(CLOCK_MONOTONIC) - start_mono_us,
+                                     last_status, max_rss_kb);
+                free(cmd_str);
+            }
+        }
+        // Clear foreground process group after the pipeline finishes or stops
+        if (!in_subshell) foreground_pgid = 0;
+        if (mon && !stopped && !pipe_failed) {
+            fflush(stdout);
+            pipemon_finish(mon);
+        }
+    }
+
+    pipemon_free(mon);
+    free(pids);
+    return pipe_failed ? 1 : group_status;
+}
 
-        free(pids);
-        free(pipes);
+// Last group of a forked subshell: a plain external command replaces the
+// child instead of forking once more. Returns only when that does not apply.
+static void exec_tail_command(const CmdPipeline *group, const ArgvList *args, const ProcSubstSet *substs) {
+    const Cmd *c = &group->cmds[0];
+    // Substitutions still have to be waited for
+    if (group->count != 1 || c->kind != CMD_SIMPLE || group->run_in_background || substs->count > 0) return;
+    if (args[0].argc == 0 || is_builtin(args[0].argv[0]) || functions_get(args[0].argv[0])) return;
+    if (setup_redirections(c, &args[0]) != 0) _exit(1);
+    fflush(stdout);
+    environ = vars_environ_with(args[0].env, args[0].env_count);
+    exec_command(c, &args[0]);
+    fprintf(stderr, "Command not found!\n");
+    _exit(127);
+}
+
+// Run each group in order, honouring && / ||; returns the resulting $?.
+// exec_tail is set in a subshell child, whose last command may exec directly.
+static int execute_sequence(CmdSequence *seq, bool exec_tail) {
+    for (int i = 0; i < seq->count; ++i) {
+        CmdPipeline *group = &seq->groups[i];
+        // '&&' and '||' skip the group based on the status so far; a skipped
+        // group leaves $? alone, so 'a && b || c' runs c when a fails
+        int status = state_get_last_status();
+        if ((group->connector == CONNECT_AND && status != 0) ||
+            (group->connector == CONNECT_OR && status == 0)) continue;
+        ArgvList *args = (ArgvList *)calloc((size_t)group->count, sizeof(ArgvList));
+        if (!args) continue;
+        // Expand right before running so earlier groups' side effects are visible.
+        // Process substitutions started meanwhile are collected for this group;
+        // a group running inside the shell may expand further ones of its own.
+        ProcSubstSet outer = pending_substs;
+        memset(&pending_substs, 0, sizeof(pending_substs));
+        int expanded = 0;
+        while (expanded < group->count && cmd_expand_argv(&group->cmds[expanded], &args[expanded]) == 0) expanded++;
+        ProcSubstSet substs = pending_substs;
+        pending_substs = outer;
+        status = 1;
+        if (expanded == group->count) {
+            if (exec_tail && i == seq->count - 1) exec_tail_command(group, args, &substs);
+            status = execute_group(group, args, i > 0, NULL, &substs);
+        }
+        proc_substs_finish(&substs);
+        state_set_last_status(status);
+        for (int j = 0; j < expanded; ++j) argv_list_free(&args[j]);
+        free(args);
     }
+    return state_get_last_status();
+}
+
+// Heredoc bodies follow the command line in the input
+static char *read_heredoc_line(void *ctx) {
+    (void)ctx;
+    return read_line("> ");
+}
 
-    free_cmd_sequence(seq);
+bool execute_parsed_cmd(CmdSequence *seq) {
+    if (!seq || seq->count <= 0 || cmd_sequence_read_heredocs(seq, read_heredoc_line, NULL) != 0) return false;
+
+    interrupt_received = false;
+    execute_sequence(seq, false);
+
+    wildcard_cache_reset();
     return true;
 }
 
+bool execute_shell_cmd(const char *input) {
+    CmdSequence *seq = parse_cache_acquire(input);
+    bool ran = execute_parsed_cmd(seq);
+    parse_cache_release(seq);
+    return ran;
+}
+
+int execute_launch(char **argv, int argc, const GroupLaunch *launch) {
+    Cmd c;
+    memset(&c, 0, sizeof(c));
+    c.kind = CMD_SIMPLE;
+    c.argv = argv;
+    CmdPipeline group;
+    memset(&group, 0, sizeof(group));
+    group.cmds = &c;
+    group.count = 1;
+    // Only the builtin's own job goes to the background, not what it runs
+    group.run_in_background = launch_in_background;
+    launch_in_background = false;
+    // The words are already expanded; argv is only borrowed
+    ArgvList args;
+    memset(&args, 0, sizeof(args));
+    args.argv = argv;
+    args.argc = argc;
+    return execute_group(&group, &args, false, launch, NULL);
+}
 
+int execute_captured(CmdSequence *seq, char **out, size_t *len) {
+    *out = NULL;
+    *len = 0;
+    int fd = memfd_create("captured-output", MFD_CLOEXEC);
+    if (fd < 0) return 1;
+    FdBackup b;
+    b.count = 0;
+    b.fds = (SavedFd *)malloc(2 * sizeof(SavedFd));
+    if (!b.fds) {
+        close(fd);
+        return 1;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    backup_fd(&b, STDOUT_FILENO);
+    backup_fd(&b, STDERR_FILENO);
+    dup2(fd, STDOUT_FILENO);
+    dup2(fd, STDERR_FILENO);
+    int status = execute_sequence(seq, false);
+    restore_fds(&b);
+    off_t size = lseek(fd, 0, SEEK_END);
+    if (size > 0 && lseek(fd, 0, SEEK_SET) == 0) {
+        char *buf = (char *)malloc((size_t)size + 1);
+        ssize_t got = buf ? read(fd, buf, (size_t)size) : -1;
+        if (got >= 0) {
+            buf[got] = '\0';
+            *out = buf;
+            *len = (size_t)got;
+        } else {
+            free(buf);
+        }
+    }
+    close(fd);
+    wildcard_cache_reset();
+    return status;
+}
+
+#define CAPTURE_CHUNK 65536
+
+// A lone builtin that only prints, with plain words and no redirections
+static bool substitution_in_process(const CmdSequence *seq) {
+    if (seq->count != 1 || seq->groups[0].count != 1 || seq->groups[0].run_in_background) return false;
+    const Cmd *c = &seq->groups[0].cmds[0];
+    if (c->kind != CMD_SIMPLE || c->redir_count > 0 || c->assigns || !c->argv || !c->argv[0]) return false;
+    if (c->word_flags && c->word_flags[0]) return false;
+    return builtin_is_pure(c->argv[0]) && !functions_get(c->argv[0]);
+}
+
+// The builtin's stdio output goes straight into a memory stream
+static char *capture_builtin(const Cmd *c, size_t *len) {
+    ArgvList args;
+    if (cmd_expand_argv(c, &args) != 0) return NULL;
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *capture = open_memstream(&buf, &size);
+    if (!capture) {
+        argv_list_free(&args);
+        return NULL;
+    }
+    fflush(stdout);
+    FILE *saved = stdout;
+    stdout = capture;
+    int status = 0;
+    try_handle_builtin(args.argv, args.argc, &status);
+    stdout = saved;
+    argv_list_free(&args);
+    if (fclose(capture) != 0) {
+        free(buf);
+        return NULL;
+    }
+    state_set_last_status(status);
+    *len = size;
+    return buf;
+}
+
+// Anything else runs in a forked subshell writing into a pipe, read in large
+// blocks into a buffer that doubles as it fills
+static char *capture_forked(CmdSequence *seq, size_t *len) {
+    int fds[2];
+    if (pipe(fds) != 0) return NULL;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return NULL;
+    }
+    if (pid == 0) {
+        events_child_reset();
+        // Not a job of its own: nothing would continue it if stopped
+        signal(SIGTSTP, SIG_IGN);
+        close(fds[0]);
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[1]);
+        enter_subshell();
+        int status = execute_sequence(seq, true);
+        fflush(stdout);
+        _exit(status);
+    }
+    close(fds[1]);
+    size_t cap = CAPTURE_CHUNK;
+    size_t used = 0;
+    char *buf = (char *)malloc(cap);
+    while (buf) {
+        if (cap - used < CAPTURE_CHUNK / 2) {
+            char *tmp = (char *)realloc(buf, cap * 2);
+            if (!tmp) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        ssize_t r = read(fds[0], buf + used, cap - used - 1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        used += (size_t)r;
+    }
+    close(fds[0]);
+    int status = 0;
+    if (events_wait_child(pid, &status, 0, NULL) == pid) {
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT) interrupt_received = true;
+        state_set_last_status(status_to_exit_code(status));
+    }
+    if (buf) {
+        buf[used] = '\0';
+        *len = used;
+    }
+    return buf;
+}
+
+char *execute_substitution(const char *text, size_t *len) {
+    *len = 0;
+    CmdSequence *seq = parse_cache_acquire(text);
+    // Blank: no output
+    if (!seq) return strdup("");
+    char *out = substitution_in_process(seq) ? capture_builtin(&seq->groups[0].cmds[0], len)
+                                             : capture_forked(seq, len);
+    parse_cache_release(seq);
+    return out;
+}
+
+int execute_process_subst(const char *text, bool command_reads) {
+    ProcSubstSet *set = &pending_substs;
+    if (set->count == set->cap) {
+        int ncap = set->cap ? set->cap * 2 : 4;
+        ProcSubst *tmp = (ProcSubst *)realloc(set->procs, (size_t)ncap * sizeof(ProcSubst));
+        if (!tmp) return -1;
+        set->procs = tmp;
+        set->cap = ncap;
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+        perror("pipe");
+        return -1;
+    }
+    // The command reads what the process writes to the pipe, or the other way round
+    int keep = command_reads ? fds[0] : fds[1];
+    int give = command_reads ? fds[1] : fds[0];
+    CmdSequence *seq = parse_cache_acquire(text);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        events_child_reset();
+        if (!in_subshell) setpgid(0, set->pgid);
+        dup2(give, command_reads ? STDOUT_FILENO : STDIN_FILENO);
+        // Its own end would keep a >(...) reader from ever seeing EOF
+        close(keep);
+        for (int k = 0; k < set->count; ++k) close(set->procs[k].fd);
+        set->count = 0;
+        enter_subshell();
+        int status = seq ? execute_sequence(seq, true) : 0;
+        fflush(stdout);
+        _exit(status);
+    }
+    close(give);
+    parse_cache_release(seq);
+    if (pid < 0) {
+        perror("fork");
+        close(keep);
+        return -1;
+    }
+    if (!in_subshell) {
+        if (set->pgid == 0) set->pgid = pid;
+        setpgid(pid, set->pgid);
+    }
+    // Passed on to the command as /dev/fd/N
+    fcntl(keep, F_SETFD, 0);
+    set->procs[set->count++] = (ProcSubst){ pid, keep };
+    return keep;
+}
@@ -0,0 +1,55 @@
+#include "functions.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct Function {
+	char *name;
+	CmdSequence *body;
+	struct Function *next;
+} Function;
+
+#define FUNCTION_BUCKETS 64 // power of two
+
+static Function *buckets[FUNCTION_BUCKETS];
+static size_t count = 0;
+
+static size_t bucket_of(const char *s) {
+	uint64_t h = 1469598103934665603ULL;
+	for (; *s; ++s) { h ^= (unsigned char)*s; h *= 1099511628211ULL; }
+	return (size_t)h & (FUNCTION_BUCKETS - 1);
+}
+
+static Function *find(const char *name) {
+	for (Function *f = buckets[bucket_of(name)]; f; f = f->next) {
+		if (strcmp(f->name, name) == 0) return f;
+	}
+	return NULL;
+}
+
+CmdSequence *functions_get(const char *name) {
+	if (count == 0) return NULL;
+	Function *f = find(name);
+	return f ? f->body : NULL;
+}
+
+int functions_define(const char *name, CmdSequence *body) {
+	Function *f = find(name);
+	if (!f) {
+		f = (Function *)calloc(1, sizeof(Function));
+		if (!f || !(f->name = strdup(name))) {
+			free(f);
+			return -1;
+		}
+		size_t b = bucket_of(name);
+		f->next = buckets[b];
+		buckets[b] = f;
+		count++;
+	}
+	// Take the new reference first: redefining from the same parse is a no-op
+	body->refs++;
+	free_cmd_sequence(f->body);
+	f->body = body;
+	return 0;
+}
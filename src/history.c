@@ -1,17 +1,50 @@
 #include "history.h"
 #include "builtins.h"
 #include "state.h"
+#include "lexer.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
+#include <stdint.h>
 
 static void get_history_file(char *out, size_t out_sz) {
 	const char *home = state_get_home();
 	snprintf(out, out_sz, "%s/.mini_shell_history", home);
 }
 
+#define HISTORY_MAX 15
+
+// In-memory mirror of the log file, oldest first. Loaded on first use and kept
+// in sync on every store, so recall and duplicate checks never re-read the file.
+static char *entries[HISTORY_MAX];
+static int entry_count = 0;
+static int loaded = 0;
+
+static void history_load(void) {
+	if (loaded) return;
+	loaded = 1;
+	char path[PATH_MAX];
+	get_history_file(path, sizeof(path));
+	FILE *f = fopen(path, "r");
+	if (!f) return;
+	char *buf = NULL; size_t nb = 0; ssize_t r;
+	while ((r = getline(&buf, &nb, f)) != -1) {
+		if (r > 0 && buf[r - 1] == '\n') buf[r - 1] = '\0';
+		char *copy = strdup(buf);
+		if (!copy) break;
+		if (entry_count == HISTORY_MAX) {
+			free(entries[0]);
+			memmove(entries, entries + 1, (HISTORY_MAX - 1) * sizeof(char *));
+			entry_count--;
+		}
+		entries[entry_count++] = copy;
+	}
+	free(buf);
+	fclose(f);
+}
+
 void history_maybe_store(const char *line) {
 	if (!line || line[0] == '\0') return;
 	// Don't store if any atomic command name is 'log'. Scan the input for command names.
@@ -25,11 +58,14 @@ void history_maybe_store(const char *line) {
 			if (*p == '>' && *(p+1) == '>') p++;
 			p++;
 			while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') p++;
-			while (*p && *p!='|' && *p!='&' && *p!=';' && *p!='>' && *p!='<' && *p!=' ' && *p!='\t' && *p!='\n' && *p!='\r') p++;
+			unsigned flags;
+			p = line + lex_scan_word(line, (size_t)(p - line), &flags);
 			continue;
 		}
 		const char *start = p;
-		while (*p && *p!='|' && *p!='&' && *p!=';' && *p!='>' && *p!='<' && *p!=' ' && *p!='\t' && *p!='\n' && *p!='\r') p++;
+		unsigned flags;
+		p = line + lex_scan_word(line, (size_t)(p - line), &flags);
+		if (p == start) p++;
 		if (expecting_cmd_name) {
 			size_t len = (size_t)(p - start);
 			if (len == 3 && strncmp(start, "log", 3) == 0) return;
@@ -37,59 +73,440 @@ void history_maybe_store(const char *line) {
 		}
 	}
 
+	history_load();
+	if (entry_count > 0 && strcmp(entries[entry_count - 1], line) == 0) return;
+	char *copy = strdup(line);
+	if (!copy) return;
+
+	// Keep at most HISTORY_MAX entries, dropping the oldest
+	if (entry_count == HISTORY_MAX) {
+		free(entries[0]);
+		memmove(entries, entries + 1, (HISTORY_MAX - 1) * sizeof(char *));
+		entry_count--;
+	}
+	entries[entry_count++] = copy;
+
 	char path[PATH_MAX];
 	get_history_file(path, sizeof(path));
-	FILE *f = fopen(path, "r");
-	char *last = NULL; ssize_t r;
-	char *buf = NULL; size_t nb = 0;
-	int count = 0;
+	FILE *f = fopen(path, "w");
 	if (f) {
-		while ((r = getline(&buf, &nb, f)) != -1) {
-			if (r > 0 && buf[r - 1] == '\n') buf[r - 1] = '\0';
-			free(last);
-			last = strdup(buf);
-			count++;
-		}
-		free(buf);
+		for (int i = 0; i < entry_count; ++i) fprintf(f, "%s\n", entries[i]);
 		fclose(f);
 	}
-	if (last && strcmp(last, line) == 0) {
-		free(last);
-		return;
+}
+
+int history_count(void) {
+	history_load();
+	return entry_count;
+}
+
+const char *history_get(int index) {
+	history_load();
+	if (index < 0 || index >= entry_count) return NULL;
+	return entries[index];
+}
+
+void history_clear(void) {
+	for (int i = 0; i < entry_count; ++i) free(entries[i]);
+	entry_count = 0;
+	loaded = 1;
+	char path[PATH_MAX];
+	get_history_file(path, sizeof(path));
+	FILE *f = fopen(path, "w");
+	if (f) fclose(f);
+}
+
+
+// ---- Per-pipeline execution stats ----
+// The sidecar starts with a magic and a version, then holds tagged records with
+// every field written out little-endian: 'A' (one command name's aggregates)
+// and 'S' (one of the slowest commands) make up a snapshot, and 'R' (one
+// executed pipeline) is appended after it per run. It is read once (lazily) to
+// seed the aggregates. Once more than STATS_COMPACT_RUNS runs follow the
+// snapshot (or the file is unreadable) it is rewritten as a fresh snapshot, so
+// neither its size nor the startup read grows with the number of runs.
+
+#define STATS_MAGIC 0x5348534dU // "MSHS"
+#define STATS_VERSION 2
+#define STATS_TOP_N 10
+#define STATS_MAX_TEXT 255
+#define STATS_COMPACT_RUNS 512
+// Latency histogram: 8 linear buckets, then 8 sub-buckets per power of two (~12% error)
+#define STATS_BUCKETS 312
+// Largest encoded record: an 'A' with every bucket set
+#define STATS_RECORD_MAX (64 + STATS_MAX_TEXT + STATS_BUCKETS * 6)
+
+typedef struct {
+	char *name;
+	uint64_t runs;
+	uint64_t failures;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint32_t max_rss_kb;
+	uint32_t hist[STATS_BUCKETS];
+} CmdStats;
+
+typedef struct {
+	uint64_t duration_us;
+	int32_t status;
+	char cmd[STATS_MAX_TEXT + 1];
+} SlowEntry;
+
+static CmdStats *stats_table = NULL; // open addressing, keyed by name
+static size_t stats_cap = 0;
+static size_t stats_used = 0;
+static SlowEntry slowest[STATS_TOP_N];
+static int slowest_count = 0;
+static int stats_loaded = 0;
+static int stats_logged = 0; // runs appended after the snapshot
+
+static void get_stats_file(char *out, size_t out_sz) {
+	const char *home = state_get_home();
+	snprintf(out, out_sz, "%s/.mini_shell_history.stats", home);
+}
+
+static int latency_bucket(uint64_t us) {
+	if (us < 8) return (int)us;
+	int e = 3;
+	while (e < 63 && (us >> (e + 1)) != 0) e++;
+	int idx = (e - 2) * 8 + (int)((us >> (e - 3)) & 7);
+	return idx < STATS_BUCKETS ? idx : STATS_BUCKETS - 1;
+}
+
+// Midpoint of a bucket, used as the reported percentile value
+static uint64_t bucket_value(int idx) {
+	if (idx < 8) return (uint64_t)idx;
+	int e = idx / 8 + 2;
+	uint64_t lo = (uint64_t)(8 + idx % 8) << (e - 3);
+	uint64_t width = (uint64_t)1 << (e - 3);
+	return lo + width / 2;
+}
+
+static uint64_t hash_name(const char *s) {
+	uint64_t h = 1469598103934665603ULL;
+	while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ULL; }
+	return h;
+}
+
+static CmdStats *stats_slot(CmdStats *table, size_t cap, const char *name) {
+	size_t i = (size_t)hash_name(name) & (cap - 1);
+	while (table[i].name && strcmp(table[i].name, name) != 0) i = (i + 1) & (cap - 1);
+	return &table[i];
+}
+
+static CmdStats *stats_lookup(const char *name) {
+	if ((stats_used + 1) * 4 > stats_cap * 3) {
+		size_t ncap = stats_cap ? stats_cap * 2 : 32;
+		CmdStats *nt = (CmdStats *)calloc(ncap, sizeof(CmdStats));
+		if (!nt) return NULL;
+		for (size_t i = 0; i < stats_cap; ++i) {
+			if (stats_table[i].name) *stats_slot(nt, ncap, stats_table[i].name) = stats_table[i];
+		}
+		free(stats_table);
+		stats_table = nt;
+		stats_cap = ncap;
+	}
+	CmdStats *cs = stats_slot(stats_table, stats_cap, name);
+	if (!cs->name) {
+		cs->name = strdup(name);
+		if (!cs->name) return NULL;
+		stats_used++;
+	}
+	return cs;
+}
+
+// Keep the slowest list sorted descending; insertion into a tiny fixed array
+static void stats_note_slow(const char *cmd, uint64_t duration_us, int status) {
+	if (slowest_count == STATS_TOP_N && duration_us <= slowest[STATS_TOP_N - 1].duration_us) return;
+	int pos = slowest_count < STATS_TOP_N ? slowest_count++ : STATS_TOP_N - 1;
+	while (pos > 0 && slowest[pos - 1].duration_us < duration_us) {
+		slowest[pos] = slowest[pos - 1];
+		pos--;
 	}
-	free(last);
+	slowest[pos].duration_us = duration_us;
+	slowest[pos].status = status;
+	strncpy(slowest[pos].cmd, cmd, STATS_MAX_TEXT);
+	slowest[pos].cmd[STATS_MAX_TEXT] = '\0';
+}
 
+static void stats_accumulate(const char *name, const char *cmd, uint64_t duration_us, int status, uint32_t rss_kb) {
+	CmdStats *cs = stats_lookup(name);
+	if (cs) {
+		cs->runs++;
+		if (status != 0) cs->failures++;
+		cs->total_us += duration_us;
+		if (duration_us > cs->max_us) cs->max_us = duration_us;
+		if (rss_kb > cs->max_rss_kb) cs->max_rss_kb = rss_kb;
+		cs->hist[latency_bucket(duration_us)]++;
+	}
+	stats_note_slow(cmd, duration_us, status);
+}
 
-	// Load all and append, keeping max 15
-	char *lines[16];
-	for (int i = 0; i < 16; ++i) lines[i] = NULL;
-	count = 0;
-	f = fopen(path, "r");
-	buf = NULL; nb = 0;
-	if (f) {
-		while ((r = getline(&buf, &nb, f)) != -1) {
-			if (r > 0 && buf[r - 1] == '\n') buf[r - 1] = '\0';
-			if (count < 15) lines[count++] = strdup(buf);
+static unsigned char *put_le(unsigned char *o, uint64_t v, int bytes) {
+	for (int i = 0; i < bytes; ++i) *o++ = (unsigned char)(v >> (8 * i));
+	return o;
+}
+
+static unsigned char *put_text(unsigned char *o, const char *text, size_t len) {
+	o = put_le(o, len, 2);
+	memcpy(o, text, len);
+	return o + len;
+}
+
+static int get_le(FILE *f, int bytes, uint64_t *v) {
+	*v = 0;
+	for (int i = 0; i < bytes; ++i) {
+		int c = getc(f);
+		if (c == EOF) return -1;
+		*v |= (uint64_t)c << (8 * i);
+	}
+	return 0;
+}
+
+// A length-prefixed string into out (STATS_MAX_TEXT + 1 bytes)
+static int get_text(FILE *f, char *out) {
+	uint64_t len;
+	if (get_le(f, 2, &len) != 0 || len > STATS_MAX_TEXT) return -1;
+	if (fread(out, 1, (size_t)len, f) != (size_t)len) return -1;
+	out[len] = '\0';
+	return 0;
+}
+
+static int load_run(FILE *f) {
+	uint64_t start, duration, status, rss;
+	char name[STATS_MAX_TEXT + 1], cmd[STATS_MAX_TEXT + 1];
+	if (get_le(f, 8, &start) != 0 || get_le(f, 8, &duration) != 0 || get_le(f, 4, &status) != 0
+	    || get_le(f, 4, &rss) != 0 || get_text(f, name) != 0 || get_text(f, cmd) != 0) return -1;
+	stats_accumulate(name, cmd, duration, (int32_t)(uint32_t)status, (uint32_t)rss);
+	return 0;
+}
+
+static int load_aggregate(FILE *f) {
+	char name[STATS_MAX_TEXT + 1];
+	uint64_t runs, failures, total, max, rss, buckets;
+	if (get_text(f, name) != 0 || get_le(f, 8, &runs) != 0 || get_le(f, 8, &failures) != 0
+	    || get_le(f, 8, &total) != 0 || get_le(f, 8, &max) != 0 || get_le(f, 4, &rss) != 0
+	    || get_le(f, 2, &buckets) != 0) return -1;
+	CmdStats *cs = stats_lookup(name);
+	if (!cs) return -1;
+	cs->runs += runs;
+	cs->failures += failures;
+	cs->total_us += total;
+	if (max > cs->max_us) cs->max_us = max;
+	if (rss > cs->max_rss_kb) cs->max_rss_kb = (uint32_t)rss;
+	for (uint64_t i = 0; i < buckets; ++i) {
+		uint64_t idx, count;
+		if (get_le(f, 2, &idx) != 0 || idx >= STATS_BUCKETS || get_le(f, 4, &count) != 0) return -1;
+		cs->hist[idx] += (uint32_t)count;
+	}
+	return 0;
+}
+
+static int load_slow(FILE *f) {
+	uint64_t duration, status;
+	char cmd[STATS_MAX_TEXT + 1];
+	if (get_le(f, 8, &duration) != 0 || get_le(f, 4, &status) != 0 || get_text(f, cmd) != 0) return -1;
+	stats_note_slow(cmd, duration, (int32_t)(uint32_t)status);
+	return 0;
+}
+
+static void write_header(FILE *f) {
+	unsigned char buf[8];
+	put_le(put_le(buf, STATS_MAGIC, 4), STATS_VERSION, 4);
+	fwrite(buf, 1, sizeof(buf), f);
+}
+
+// Replace the sidecar with a snapshot of the in-memory aggregates
+static void stats_compact(const char *path) {
+	char tmp[PATH_MAX];
+	if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)) return;
+	FILE *f = fopen(tmp, "wb");
+	if (!f) return;
+	write_header(f);
+	unsigned char buf[STATS_RECORD_MAX];
+	for (size_t i = 0; i < stats_cap; ++i) {
+		const CmdStats *cs = &stats_table[i];
+		if (!cs->name) continue;
+		unsigned char *o = buf;
+		*o++ = 'A';
+		o = put_text(o, cs->name, strlen(cs->name));
+		o = put_le(o, cs->runs, 8);
+		o = put_le(o, cs->failures, 8);
+		o = put_le(o, cs->total_us, 8);
+		o = put_le(o, cs->max_us, 8);
+		o = put_le(o, cs->max_rss_kb, 4);
+		unsigned char *count = o;
+		o += 2;
+		uint64_t buckets = 0;
+		for (int b = 0; b < STATS_BUCKETS; ++b) {
+			if (cs->hist[b] == 0) continue;
+			o = put_le(put_le(o, (uint64_t)b, 2), cs->hist[b], 4);
+			buckets++;
 		}
-		free(buf);
-		fclose(f);
+		put_le(count, buckets, 2);
+		fwrite(buf, 1, (size_t)(o - buf), f);
 	}
-	if (count == 15) {
-		free(lines[0]);
-		for (int i = 1; i < 15; ++i) lines[i - 1] = lines[i];
-		count = 14;
+	for (int i = 0; i < slowest_count; ++i) {
+		unsigned char *o = buf;
+		*o++ = 'S';
+		o = put_le(o, slowest[i].duration_us, 8);
+		o = put_le(o, (uint32_t)slowest[i].status, 4);
+		o = put_text(o, slowest[i].cmd, strlen(slowest[i].cmd));
+		fwrite(buf, 1, (size_t)(o - buf), f);
 	}
-	lines[count++] = strdup(line);
+	if (fclose(f) != 0 || rename(tmp, path) != 0) remove(tmp);
+}
 
-	f = fopen(path, "w");
-	if (f) {
-		for (int i = 0; i < count; ++i) {
-			fprintf(f, "%s\n", lines[i]);
-			free(lines[i]);
+static void stats_load(void) {
+	if (stats_loaded) return;
+	stats_loaded = 1;
+	char path[PATH_MAX];
+	get_stats_file(path, sizeof(path));
+	FILE *f = fopen(path, "rb");
+	if (!f) return;
+	uint64_t magic, version;
+	int bad = 0, runs = 0;
+	if (get_le(f, 4, &magic) != 0 || get_le(f, 4, &version) != 0) {
+		bad = ftell(f) != 0;
+	} else if (magic != STATS_MAGIC || version != STATS_VERSION) {
+		bad = 1;
+	} else {
+		int tag;
+		while (!bad && (tag = getc(f)) != EOF) {
+			if (tag == 'R') { bad = load_run(f) != 0; runs++; }
+			else if (tag == 'A') bad = load_aggregate(f) != 0;
+			else if (tag == 'S') bad = load_slow(f) != 0;
+			else bad = 1;
 		}
-		fclose(f);
+	}
+	fclose(f);
+	// An unreadable tail is dropped along with the runs folded into the snapshot
+	stats_logged = runs;
+	if (bad || runs > STATS_COMPACT_RUNS) {
+		stats_compact(path);
+		stats_logged = 0;
 	}
 }
 
+void history_record_stats(const char *command, long long start_us, long long duration_us,
+                          int exit_status, long max_rss_kb) {
+	if (!command || command[0] == '\0') return;
+	stats_load();
+
+	// Command name is the first word of the pipeline
+	const char *p = command;
+	while (*p == ' ' || *p == '\t') p++;
+	size_t name_len = strcspn(p, " \t|");
+	size_t cmd_len = strlen(command);
+	if (name_len > STATS_MAX_TEXT) name_len = STATS_MAX_TEXT;
+	if (cmd_len > STATS_MAX_TEXT) cmd_len = STATS_MAX_TEXT;
+	char name[STATS_MAX_TEXT + 1], cmd[STATS_MAX_TEXT + 1];
+	memcpy(name, p, name_len);
+	name[name_len] = '\0';
+	memcpy(cmd, command, cmd_len);
+	cmd[cmd_len] = '\0';
 
+	if (duration_us < 0) duration_us = 0;
+	if (max_rss_kb < 0) max_rss_kb = 0;
+	stats_accumulate(name, cmd, (uint64_t)duration_us, exit_status, (uint32_t)max_rss_kb);
 
+	char path[PATH_MAX];
+	get_stats_file(path, sizeof(path));
+	if (++stats_logged > STATS_COMPACT_RUNS) {
+		stats_compact(path);
+		stats_logged = 0;
+		return;
+	}
+	FILE *f = fopen(path, "ab");
+	if (!f) return;
+	fseek(f, 0, SEEK_END);
+	if (ftell(f) == 0) write_header(f);
+	unsigned char buf[STATS_RECORD_MAX];
+	unsigned char *o = buf;
+	*o++ = 'R';
+	o = put_le(o, (uint64_t)start_us, 8);
+	o = put_le(o, (uint64_t)duration_us, 8);
+	o = put_le(o, (uint32_t)exit_status, 4);
+	o = put_le(o, (uint64_t)max_rss_kb, 4);
+	o = put_text(o, name, name_len);
+	o = put_text(o, cmd, cmd_len);
+	fwrite(buf, 1, (size_t)(o - buf), f);
+	fclose(f);
+}
+
+static void format_duration(uint64_t us, char *out, size_t out_sz) {
+	if (us < 1000) snprintf(out, out_sz, "%luus", (unsigned long)us);
+	else if (us < 1000000) snprintf(out, out_sz, "%.1fms", (double)us / 1e3);
+	else snprintf(out, out_sz, "%.2fs", (double)us / 1e6);
+}
+
+static uint64_t stats_percentile(const CmdStats *cs, double q) {
+	uint64_t target = (uint64_t)(q * (double)cs->runs + 0.999999);
+	if (target == 0) target = 1;
+	uint64_t seen = 0;
+	for (int i = 0; i < STATS_BUCKETS; ++i) {
+		seen += cs->hist[i];
+		if (seen >= target) {
+			uint64_t v = bucket_value(i);
+			return v < cs->max_us ? v : cs->max_us;
+		}
+	}
+	return cs->max_us;
+}
+
+static int compare_stats_by_name(const void *a, const void *b) {
+	const CmdStats *const *sa = (const CmdStats *const *)a;
+	const CmdStats *const *sb = (const CmdStats *const *)b;
+	return strcmp((*sa)->name, (*sb)->name);
+}
+
+void history_print_stats(void) {
+	stats_load();
+	if (stats_used == 0) {
+		printf("No stats recorded\n");
+		return;
+	}
+
+	char d[32];
+	printf("Slowest commands:\n");
+	for (int i = 0; i < slowest_count; ++i) {
+		format_duration(slowest[i].duration_us, d, sizeof(d));
+		printf("  %10s  exit %-3d  %s\n", d, slowest[i].status, slowest[i].cmd);
+	}
+
+	CmdStats **rows = (CmdStats **)malloc(stats_used * sizeof(CmdStats *));
+	if (!rows) return;
+	size_t n = 0;
+	for (size_t i = 0; i < stats_cap; ++i) {
+		if (stats_table[i].name) rows[n++] = &stats_table[i];
+	}
+	qsort(rows, n, sizeof(CmdStats *), compare_stats_by_name);
+
+	char p50[32], p95[32], mx[32];
+	printf("\n%-16s %6s %6s %10s %10s %10s %10s\n", "command", "runs", "fail%", "p50", "p95", "max", "maxrss");
+	for (size_t i = 0; i < n; ++i) {
+		const CmdStats *cs = rows[i];
+		format_duration(stats_percentile(cs, 0.50), p50, sizeof(p50));
+		format_duration(stats_percentile(cs, 0.95), p95, sizeof(p95));
+		format_duration(cs->max_us, mx, sizeof(mx));
+		printf("%-16s %6lu %5.1f%% %10s %10s %10s %8luKB\n", cs->name, (unsigned long)cs->runs,
+		       100.0 * (double)cs->failures / (double)cs->runs, p50, p95, mx, (unsigned long)cs->max_rss_kb);
+	}
+	free(rows);
+}
+
+void history_purge_stats(void) {
+	for (size_t i = 0; i < stats_cap; ++i) free(stats_table[i].name);
+	free(stats_table);
+	stats_table = NULL;
+	stats_cap = 0;
+	stats_used = 0;
+	slowest_count = 0;
+	stats_loaded = 1;
+	stats_logged = 0;
+
+	char path[PATH_MAX];
+	get_stats_file(path, sizeof(path));
+	FILE *f = fopen(path, "wb");
+	if (f) fclose(f);
+}
@@ -1,11 +1,25 @@
 #include "input.h"
+#include "complete.h"
+#include "events.h"
+#include "history.h"
+#include "jobs.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
 
-char *read_line(void) {
+// ---- Cooked-mode fallback (pipes, files, dumb terminals) ----
+
+static char *read_line_cooked(const char *prompt) {
+	if (prompt) {
+		fputs(prompt, stdout);
+		fflush(stdout);
+	}
 	char *lineptr = NULL;
 	size_t n = 0;
 	for (;;) {
@@ -29,5 +43,651 @@ char *read_line(void) {
 	return lineptr;
 }
 
+// ---- Raw-mode line editor ----
+// The editor keeps a copy of what is currently on screen (prompt + rendered
+// text) and on every refresh only rewrites from the first differing column,
+// clearing leftovers with a single ESC[J. All output produced while handling a
+// batch of input is collected in one buffer and sent with one write(), so a
+// keystroke costs one syscall and a long paste costs one redraw per read().
+
+typedef struct {
+	char *data;
+	size_t len;
+	size_t cap;
+} Buf;
+
+typedef struct {
+	Buf line;            // text being edited (no trailing NUL guaranteed; see buf_cstr)
+	size_t pos;          // cursor byte offset into line
+	const char *prompt;
+	size_t cols;         // terminal width
+	Buf shown;           // prompt + rendered text currently on screen
+	size_t shown_cursor; // cursor column offset on screen, counted from the prompt start
+	Buf out;             // pending terminal output
+	// History browsing (index == history_count() means the line being typed)
+	int hist_index;
+	Buf saved;
+	// Ctrl-R reverse incremental search
+	bool searching;
+	bool search_failed;
+	Buf query;
+	int search_index;
+	Buf search_saved;
+	size_t search_saved_pos;
+	bool last_was_tab;   // a second Tab in a row lists the candidates
+} Editor;
+
+enum {
+	KEY_INCOMPLETE = -1,
+	KEY_LEFT = 256, KEY_RIGHT, KEY_UP, KEY_DOWN, KEY_HOME, KEY_END, KEY_DELETE,
+	KEY_WORD_LEFT, KEY_WORD_RIGHT, KEY_ESCAPE, KEY_IGNORED
+};
+
+enum { EDIT_CONTINUE, EDIT_ACCEPT, EDIT_EOF, EDIT_CANCEL };
+
+#define KEY_CTRL(c) ((c) & 0x1f)
+#define ESC_TIMEOUT_MS 50
+#define COMPLETION_LIST_MAX 200
+
+// Input bytes read from the terminal but not yet consumed. Bytes after an
+// accepted line (e.g. a multi-line paste) stay here for the next read_line().
+static unsigned char pending[4096];
+static size_t pending_len = 0;
+
+static struct termios saved_termios;
+
+static bool buf_reserve(Buf *b, size_t extra) {
+	if (b->len + extra + 1 <= b->cap) return true;
+	size_t ncap = b->cap ? b->cap : 128;
+	while (ncap < b->len + extra + 1) ncap *= 2;
+	char *nd = (char *)realloc(b->data, ncap);
+	if (!nd) return false;
+	b->data = nd;
+	b->cap = ncap;
+	return true;
+}
+
+static void buf_insert(Buf *b, size_t at, const char *s, size_t n) {
+	if (n == 0 || !buf_reserve(b, n)) return;
+	memmove(b->data + at + n, b->data + at, b->len - at);
+	memcpy(b->data + at, s, n);
+	b->len += n;
+}
+
+static void buf_append(Buf *b, const char *s, size_t n) {
+	buf_insert(b, b->len, s, n);
+}
+
+static void buf_erase(Buf *b, size_t at, size_t n) {
+	memmove(b->data + at, b->data + at + n, b->len - at - n);
+	b->len -= n;
+}
+
+static void buf_set(Buf *b, const char *s, size_t n) {
+	b->len = 0;
+	buf_append(b, s, n);
+}
+
+static const char *buf_cstr(Buf *b) {
+	if (!buf_reserve(b, 0)) return "";
+	b->data[b->len] = '\0';
+	return b->data;
+}
+
+static bool is_cont(unsigned char c) { return (c & 0xc0) == 0x80; }
+static bool is_text(unsigned char c) { return c >= 0x20 && c != 0x7f; }
+static bool is_space(unsigned char c) { return c == ' ' || c == '\t'; }
+
+// Screen columns taken by s[0..n): control bytes show as ^X, UTF-8 continuation bytes take none
+static size_t text_width(const char *s, size_t n) {
+	size_t w = 0;
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (is_cont(c)) continue;
+		w += is_text(c) ? 1 : 2;
+	}
+	return w;
+}
+
+static void render_text(Buf *screen, const char *s, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		unsigned char c = (unsigned char)s[i];
+		if (is_text(c)) {
+			size_t j = i;
+			while (j < n && is_text((unsigned char)s[j])) j++;
+			buf_append(screen, s + i, j - i);
+			i = j - 1;
+		} else {
+			char caret[2] = { '^', (char)(c ^ 0x40) };
+			buf_append(screen, caret, 2);
+		}
+	}
+}
+
+static void emit(Editor *ed, const char *s) {
+	buf_append(&ed->out, s, strlen(s));
+}
+
+static void emit_move(Editor *ed, const char *fmt, size_t n) {
+	char seq[32];
+	snprintf(seq, sizeof(seq), fmt, n);
+	emit(ed, seq);
+}
+
+// Move the terminal cursor between two column offsets of the (possibly wrapped) line
+static void move_cursor(Editor *ed, size_t from, size_t to) {
+	size_t fr = from / ed->cols, fc = from % ed->cols;
+	size_t tr = to / ed->cols, tc = to % ed->cols;
+	if (fr > tr) emit_move(ed, "\x1b[%zuA", fr - tr);
+	else if (tr > fr) emit_move(ed, "\x1b[%zuB", tr - fr);
+	if (tc > fc) emit_move(ed, "\x1b[%zuC", tc - fc);
+	else if (tc < fc) {
+		if (tc == 0) emit(ed, "\r");
+		else emit_move(ed, "\x1b[%zuD", fc - tc);
+	}
+}
+
+static void flush_output(Editor *ed) {
+	size_t off = 0;
+	while (off < ed->out.len) {
+		ssize_t w = write(STDOUT_FILENO, ed->out.data + off, ed->out.len - off);
+		if (w < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		off += (size_t)w;
+	}
+	ed->out.len = 0;
+}
+
+static void refresh(Editor *ed) {
+	char search_prompt[512];
+	const char *prompt = ed->prompt;
+	if (ed->searching) {
+		snprintf(search_prompt, sizeof(search_prompt), "(%sreverse-i-search)`%s': ",
+		         ed->search_failed ? "failed " : "", buf_cstr(&ed->query));
+		prompt = search_prompt;
+	}
+
+	Buf screen = { NULL, 0, 0 };
+	size_t plen = strlen(prompt);
+	render_text(&screen, prompt, plen);
+	render_text(&screen, ed->line.data, ed->line.len);
+	size_t cursor = text_width(prompt, plen) + text_width(ed->line.data, ed->pos);
+	size_t new_width = text_width(screen.data, screen.len);
+
+	// First differing byte, backed up to a character boundary
+	size_t k = 0;
+	while (k < screen.len && k < ed->shown.len && screen.data[k] == ed->shown.data[k]) k++;
+	while (k > 0 && k < screen.len && is_cont((unsigned char)screen.data[k])) k--;
+
+	if (k < screen.len || screen.len != ed->shown.len) {
+		size_t old_width = text_width(ed->shown.data, ed->shown.len);
+		move_cursor(ed, ed->shown_cursor, text_width(screen.data, k));
+		buf_append(&ed->out, screen.data + k, screen.len - k);
+		size_t at = text_width(screen.data, k);
+		if (k < screen.len) {
+			at = new_width;
+			// Leave the pending-wrap state so cursor arithmetic stays exact
+			if (at > 0 && at % ed->cols == 0) emit(ed, "\r\n");
+		}
+		if (old_width > new_width) emit(ed, "\x1b[J");
+		move_cursor(ed, at, cursor);
+	} else {
+		move_cursor(ed, ed->shown_cursor, cursor);
+	}
 
+	free(ed->shown.data);
+	ed->shown = screen;
+	ed->shown_cursor = cursor;
+}
+
+static size_t prev_char(const Editor *ed, size_t i) {
+	if (i == 0) return 0;
+	i--;
+	while (i > 0 && is_cont((unsigned char)ed->line.data[i])) i--;
+	return i;
+}
+
+static size_t next_char(const Editor *ed, size_t i) {
+	if (i >= ed->line.len) return ed->line.len;
+	i++;
+	while (i < ed->line.len && is_cont((unsigned char)ed->line.data[i])) i++;
+	return i;
+}
+
+static size_t prev_word(const Editor *ed, size_t i) {
+	while (i > 0 && is_space((unsigned char)ed->line.data[i - 1])) i--;
+	while (i > 0 && !is_space((unsigned char)ed->line.data[i - 1])) i--;
+	return i;
+}
+
+static size_t next_word(const Editor *ed, size_t i) {
+	while (i < ed->line.len && is_space((unsigned char)ed->line.data[i])) i++;
+	while (i < ed->line.len && !is_space((unsigned char)ed->line.data[i])) i++;
+	return i;
+}
+
+static void history_move(Editor *ed, int delta) {
+	int count = history_count();
+	int target = ed->hist_index + delta;
+	if (target < 0 || target > count) return;
+	if (ed->hist_index == count) buf_set(&ed->saved, ed->line.data, ed->line.len);
+	ed->hist_index = target;
+	if (target == count) {
+		buf_set(&ed->line, ed->saved.data, ed->saved.len);
+	} else {
+		const char *entry = history_get(target);
+		buf_set(&ed->line, entry, strlen(entry));
+	}
+	ed->pos = ed->line.len;
+}
+
+// Search history entries from index 'from' downwards for the current query
+static void search_from(Editor *ed, int from) {
+	const char *q = buf_cstr(&ed->query);
+	if (ed->query.len == 0) {
+		ed->search_failed = false;
+		return;
+	}
+	for (int i = from; i >= 0; --i) {
+		const char *entry = history_get(i);
+		const char *hit = entry ? strstr(entry, q) : NULL;
+		if (hit) {
+			ed->search_index = i;
+			ed->search_failed = false;
+			buf_set(&ed->line, entry, strlen(entry));
+			ed->pos = (size_t)(hit - entry);
+			return;
+		}
+	}
+	ed->search_failed = true;
+}
+
+static void search_start(Editor *ed) {
+	ed->searching = true;
+	ed->search_failed = false;
+	ed->query.len = 0;
+	ed->search_index = history_count();
+	buf_set(&ed->search_saved, ed->line.data, ed->line.len);
+	ed->search_saved_pos = ed->pos;
+}
+
+static void search_cancel(Editor *ed) {
+	ed->searching = false;
+	buf_set(&ed->line, ed->search_saved.data, ed->search_saved.len);
+	ed->pos = ed->search_saved_pos;
+}
+
+// Returns true when the key was consumed by the search
+static bool search_key(Editor *ed, int key) {
+	if (key == KEY_CTRL('r')) {
+		search_from(ed, ed->search_index - 1);
+		return true;
+	}
+	if (key == 127 || key == KEY_CTRL('h')) {
+		if (ed->query.len > 0) {
+			size_t i = ed->query.len - 1;
+			while (i > 0 && is_cont((unsigned char)ed->query.data[i])) i--;
+			ed->query.len = i;
+			search_from(ed, history_count() - 1);
+		}
+		return true;
+	}
+	if (key == KEY_CTRL('g') || key == KEY_CTRL('c') || key == KEY_ESCAPE) {
+		search_cancel(ed);
+		return true;
+	}
+	// Any other key accepts the match and is handled as a normal edit key
+	ed->searching = false;
+	return false;
+}
 
+static void search_insert(Editor *ed, const char *s, size_t n) {
+	buf_append(&ed->query, s, n);
+	int from = ed->search_index < history_count() ? ed->search_index : history_count() - 1;
+	search_from(ed, from);
+}
+
+// Characters that must be escaped for an inserted completion to stay one word
+static void append_escaped(Buf *b, const char *s, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		if (strchr(" \t|&;<>()$`\\\"'*?[", s[i])) buf_append(b, "\\", 1);
+		buf_append(b, s + i, 1);
+	}
+}
+
+// Print candidates in columns below the line; the next refresh redraws the prompt under them
+static void list_candidates(Editor *ed, const Completion *c) {
+	size_t end = text_width(ed->shown.data, ed->shown.len);
+	move_cursor(ed, ed->shown_cursor, end);
+	if (end == 0 || end % ed->cols != 0) emit(ed, "\r\n");
+
+	size_t n = c->count < COMPLETION_LIST_MAX ? c->count : COMPLETION_LIST_MAX;
+	size_t width = 0;
+	for (size_t i = 0; i < n; ++i) {
+		size_t w = text_width(c->items[i], strlen(c->items[i]));
+		if (w > width) width = w;
+	}
+	width += 2;
+	size_t ncols = ed->cols / width ? ed->cols / width : 1;
+	size_t rows = (n + ncols - 1) / ncols;
+	for (size_t r = 0; r < rows; ++r) {
+		for (size_t col = 0; col < ncols; ++col) {
+			size_t i = col * rows + r;
+			if (i >= n) break;
+			const char *item = c->items[i];
+			render_text(&ed->out, item, strlen(item));
+			if (col + 1 < ncols && i + rows < n) {
+				for (size_t w = text_width(item, strlen(item)); w < width; ++w) emit(ed, " ");
+			}
+		}
+		emit(ed, "\r\n");
+	}
+	if (c->count > n) {
+		char more[64];
+		snprintf(more, sizeof(more), "... and %zu more\r\n", c->count - n);
+		emit(ed, more);
+	}
+	ed->shown.len = 0;
+	ed->shown_cursor = 0;
+}
+
+static void complete_word(Editor *ed) {
+	Completion c;
+	size_t n = complete_line(buf_cstr(&ed->line), ed->pos, &c);
+	if (n == 0) {
+		emit(ed, "\a");
+		completion_free(&c);
+		return;
+	}
+	const char *first = c.items[0];
+	size_t lcp = strlen(first);
+	for (size_t i = 1; i < n; ++i) {
+		size_t k = 0;
+		while (k < lcp && c.items[i][k] == first[k]) k++;
+		lcp = k;
+	}
+	while (lcp > 0 && is_cont((unsigned char)first[lcp])) lcp--;
+
+	if (n == 1 || lcp > c.prefix_len) {
+		Buf rep = { NULL, 0, 0 };
+		append_escaped(&rep, first, lcp);
+		// A unique match is finished with a space, unless it is a directory to descend into
+		if (n == 1 && first[lcp - 1] != '/') buf_append(&rep, " ", 1);
+		buf_erase(&ed->line, c.word_start, ed->pos - c.word_start);
+		buf_insert(&ed->line, c.word_start, rep.data, rep.len);
+		ed->pos = c.word_start + rep.len;
+		free(rep.data);
+	} else if (ed->last_was_tab) {
+		list_candidates(ed, &c);
+	} else {
+		emit(ed, "\a");
+	}
+	completion_free(&c);
+}
+
+static int handle_key(Editor *ed, int key) {
+	if (ed->searching && search_key(ed, key)) return EDIT_CONTINUE;
+
+	switch (key) {
+	case '\r':
+	case '\n':
+		return EDIT_ACCEPT;
+	case KEY_CTRL('c'):
+		return EDIT_CANCEL;
+	case KEY_CTRL('d'):
+		if (ed->line.len == 0) return EDIT_EOF;
+		// fall through
+	case KEY_DELETE:
+		if (ed->pos < ed->line.len) buf_erase(&ed->line, ed->pos, next_char(ed, ed->pos) - ed->pos);
+		break;
+	case 127:
+	case KEY_CTRL('h'):
+		if (ed->pos > 0) {
+			size_t p = prev_char(ed, ed->pos);
+			buf_erase(&ed->line, p, ed->pos - p);
+			ed->pos = p;
+		}
+		break;
+	case KEY_CTRL('a'):
+	case KEY_HOME:
+		ed->pos = 0;
+		break;
+	case KEY_CTRL('e'):
+	case KEY_END:
+		ed->pos = ed->line.len;
+		break;
+	case KEY_CTRL('b'):
+	case KEY_LEFT:
+		ed->pos = prev_char(ed, ed->pos);
+		break;
+	case KEY_CTRL('f'):
+	case KEY_RIGHT:
+		ed->pos = next_char(ed, ed->pos);
+		break;
+	case KEY_WORD_LEFT:
+		ed->pos = prev_word(ed, ed->pos);
+		break;
+	case KEY_WORD_RIGHT:
+		ed->pos = next_word(ed, ed->pos);
+		break;
+	case KEY_CTRL('p'):
+	case KEY_UP:
+		history_move(ed, -1);
+		break;
+	case KEY_CTRL('n'):
+	case KEY_DOWN:
+		history_move(ed, 1);
+		break;
+	case KEY_CTRL('k'):
+		ed->line.len = ed->pos;
+		break;
+	case KEY_CTRL('u'):
+		buf_erase(&ed->line, 0, ed->pos);
+		ed->pos = 0;
+		break;
+	case KEY_CTRL('w'): {
+		size_t p = prev_word(ed, ed->pos);
+		buf_erase(&ed->line, p, ed->pos - p);
+		ed->pos = p;
+		break;
+	}
+	case KEY_CTRL('l'):
+		emit(ed, "\x1b[H\x1b[2J");
+		ed->shown.len = 0;
+		ed->shown_cursor = 0;
+		break;
+	case KEY_CTRL('r'):
+		search_start(ed);
+		break;
+	case '\t':
+		complete_word(ed);
+		break;
+	default:
+		break;
+	}
+	return EDIT_CONTINUE;
+}
+
+// Decode one key from pending[i..]. Sets *used to the bytes consumed. Returns
+// KEY_INCOMPLETE when an escape sequence may still be arriving.
+static int decode_key(size_t i, bool esc_timed_out, size_t *used) {
+	const unsigned char *s = pending + i;
+	size_t n = pending_len - i;
+	*used = 1;
+	if (s[0] != 0x1b) return s[0];
+	if (n == 1) return esc_timed_out ? KEY_ESCAPE : KEY_INCOMPLETE;
+	if (s[1] == 'b' || s[1] == 'f') {
+		*used = 2;
+		return s[1] == 'b' ? KEY_WORD_LEFT : KEY_WORD_RIGHT;
+	}
+	if (s[1] != '[' && s[1] != 'O') {
+		*used = 2;
+		return KEY_IGNORED;
+	}
+	// CSI / SS3: parameters and intermediates, then a final byte in 0x40..0x7e
+	size_t j = 2;
+	while (j < n && (s[j] < 0x40 || s[j] > 0x7e)) j++;
+	if (j == n) return esc_timed_out ? KEY_ESCAPE : KEY_INCOMPLETE;
+	*used = j + 1;
+	bool ctrl_mod = (j - 2 == 3 && s[2] == '1' && s[3] == ';' && s[4] == '5');
+	switch (s[j]) {
+	case 'A': return KEY_UP;
+	case 'B': return KEY_DOWN;
+	case 'C': return ctrl_mod ? KEY_WORD_RIGHT : KEY_RIGHT;
+	case 'D': return ctrl_mod ? KEY_WORD_LEFT : KEY_LEFT;
+	case 'H': return KEY_HOME;
+	case 'F': return KEY_END;
+	case '~':
+		if (j == 3) {
+			if (s[2] == '1' || s[2] == '7') return KEY_HOME;
+			if (s[2] == '4' || s[2] == '8') return KEY_END;
+			if (s[2] == '3') return KEY_DELETE;
+		}
+		return KEY_IGNORED;
+	default:
+		return KEY_IGNORED;
+	}
+}
+
+// Read more terminal input into pending; timeout_ms < 0 blocks. Returns bytes read,
+// 0 on timeout or once signals were handled (see events_wait_fd), and -1 on EOF or error.
+static ssize_t fill_pending(int timeout_ms) {
+	if (pending_len == sizeof(pending)) return 0;
+	EventResult ev = events_wait_fd(STDIN_FILENO, timeout_ms);
+	if (ev == EVENT_TIMEOUT || ev == EVENT_HANDLED) return 0;
+	if (ev == EVENT_ERROR) return -1;
+	for (;;) {
+		ssize_t r = read(STDIN_FILENO, pending + pending_len, sizeof(pending) - pending_len);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return -1;
+		pending_len += (size_t)r;
+		return r;
+	}
+}
+
+static int query_columns(void) {
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+	return 80;
+}
+
+static bool enable_raw_mode(void) {
+	if (tcgetattr(STDIN_FILENO, &saved_termios) != 0) return false;
+	struct termios raw = saved_termios;
+	raw.c_iflag &= ~(tcflag_t)(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_cflag |= CS8;
+	// Output processing stays on so job notifications printed with "\n" still work
+	raw.c_lflag &= ~(tcflag_t)(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	// TCSANOW keeps anything typed ahead while the previous command ran
+	return tcsetattr(STDIN_FILENO, TCSANOW, &raw) == 0;
+}
+
+static void disable_raw_mode(void) {
+	tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+
+static void editor_free(Editor *ed) {
+	free(ed->line.data);
+	free(ed->shown.data);
+	free(ed->out.data);
+	free(ed->saved.data);
+	free(ed->query.data);
+	free(ed->search_saved.data);
+}
+
+// Report finished background jobs while a line is being edited: the prompt and
+// text are wiped, the notices printed where they stood, and the line redrawn below
+static void show_job_notifications(Editor *ed) {
+	move_cursor(ed, ed->shown_cursor, 0);
+	emit(ed, "\r\x1b[J");
+	flush_output(ed);
+	jobs_report_completed();
+	ed->shown.len = 0;
+	ed->shown_cursor = 0;
+	refresh(ed);
+	flush_output(ed);
+}
+
+static char *read_line_raw(const char *prompt) {
+	fflush(stdout);
+	if (!enable_raw_mode()) return read_line_cooked(prompt);
+
+	Editor ed;
+	memset(&ed, 0, sizeof(ed));
+	ed.prompt = prompt ? prompt : "";
+	ed.cols = (size_t)query_columns();
+	ed.hist_index = history_count();
+	ed.search_index = ed.hist_index;
+	refresh(&ed);
+	flush_output(&ed);
+
+	int result = EDIT_CONTINUE;
+	bool esc_timed_out = false;
+	while (result == EDIT_CONTINUE) {
+		if (jobs_have_completed()) show_job_notifications(&ed);
+		if (pending_len == 0) {
+			ssize_t r = fill_pending(-1);
+			if (r < 0) {
+				result = ed.line.len > 0 ? EDIT_ACCEPT : EDIT_EOF;
+				break;
+			}
+			if (r == 0) continue; // woken by a signal
+		}
+		size_t i = 0;
+		while (i < pending_len && result == EDIT_CONTINUE) {
+			unsigned char c = pending[i];
+			if (is_text(c)) {
+				// Insert the whole run of plain text at once so pastes stay linear
+				size_t j = i;
+				while (j < pending_len && is_text(pending[j])) j++;
+				if (ed.searching) {
+					search_insert(&ed, (const char *)pending + i, j - i);
+				} else {
+					buf_insert(&ed.line, ed.pos, (const char *)pending + i, j - i);
+					ed.pos += j - i;
+				}
+				i = j;
+				ed.last_was_tab = false;
+				continue;
+			}
+			size_t used;
+			int key = decode_key(i, esc_timed_out, &used);
+			if (key == KEY_INCOMPLETE) break;
+			esc_timed_out = false;
+			i += used;
+			result = handle_key(&ed, key);
+			ed.last_was_tab = key == '\t';
+		}
+		memmove(pending, pending + i, pending_len - i);
+		pending_len -= i;
+
+		if (result == EDIT_CONTINUE && pending_len > 0) {
+			// A partial escape sequence: give the rest a moment to arrive
+			if (fill_pending(ESC_TIMEOUT_MS) == 0) esc_timed_out = true;
+		}
+		refresh(&ed);
+		if (result != EDIT_CONTINUE && result != EDIT_EOF) {
+			size_t end = text_width(ed.shown.data, ed.shown.len);
+			move_cursor(&ed, ed.shown_cursor, end);
+			if (result == EDIT_CANCEL) emit(&ed, "^C");
+			if (end == 0 || end % ed.cols != 0 || result == EDIT_CANCEL) emit(&ed, "\r\n");
+		}
+		flush_output(&ed);
+	}
+	disable_raw_mode();
+
+	char *line = NULL;
+	if (result == EDIT_ACCEPT) line = strdup(buf_cstr(&ed.line));
+	else if (result == EDIT_CANCEL) line = strdup("");
+	editor_free(&ed);
+	return line;
+}
+
+char *read_line(const char *prompt) {
+	if (isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)) return read_line_raw(prompt);
+	return read_line_cooked(prompt);
+}
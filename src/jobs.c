@@ -1,4 +1,10 @@
+#define _GNU_SOURCE // wait4()
+
 #include "jobs.h"
+#include "events.h"
+#include "history.h"
+#include "procstat.h"
+#include "state.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,103 +13,256 @@
 #include <unistd.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdbool.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/time.h>
 
-static Job jobs[MAX_JOBS];
+static Job *jobs = NULL;
+static int job_slots = 0;
 static int next_job_number = 1;
 static int job_count = 0;
 
-void jobs_init(void) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        jobs[i].job_number = 0;
-        jobs[i].pid = 0;
-        jobs[i].command = NULL;
-        jobs[i].state = JOB_COMPLETED;
-        jobs[i].is_background = false;
+// Scratch arrays for polling the pidfds of many processes at once
+typedef struct {
+    int job;  // index into jobs
+    int proc; // index into that job's procs
+} ProcRef;
+
+static struct pollfd *poll_fds = NULL;
+static ProcRef *poll_refs = NULL;
+static size_t poll_cap = 0;
+
+static const char *const priority_names[] = { "low", "normal", "high" };
+static const int priority_nice[] = { 10, 0, 0 };
+
+// Events timer rechecking the load / memory limits, or 0
+static int admit_timer = 0;
+
+// Running, stopped or queued, i.e. not yet exited
+static bool job_live(const Job *job) {
+    return job->state == JOB_RUNNING || job->state == JOB_STOPPED || job->state == JOB_QUEUED;
+}
+
+static int status_code(int status) {
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+static long long clock_us(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Feed a finished job into the history stats store
+static void job_record_stats(const Job *job) {
+    if (!job->command) return;
+    char *cmd = strdup(job->command);
+    if (!cmd) return;
+    size_t len = strlen(cmd);
+    if (len >= 2 && strcmp(cmd + len - 2, " &") == 0) cmd[len - 2] = '\0';
+    history_record_stats(cmd, job->start_wall_us, clock_us(CLOCK_MONOTONIC) - job->start_mono_us,
+                         status_code(job->wait_status), job->max_rss_kb);
+    free(cmd);
+}
+
+static void job_proc_exited(Job *job, JobProc *p, int status, const struct rusage *ru) {
+    p->reaped = true;
+    if (p->pidfd >= 0) close(p->pidfd);
+    p->pidfd = -1;
+    job->nlive--;
+    if (ru && ru->ru_maxrss > job->max_rss_kb) job->max_rss_kb = ru->ru_maxrss;
+    // A pipeline's status is that of its last process
+    if (p == &job->procs[job->nprocs - 1]) job->wait_status = status;
+}
+
+// Live or done, i.e. anything still in the table
+static Job *find_job(int job_number) {
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].job_number == job_number && jobs[i].state != JOB_COMPLETED) return &jobs[i];
     }
+    return NULL;
+}
+
+static bool poll_reserve(size_t n) {
+    if (n <= poll_cap) return true;
+    size_t ncap = poll_cap ? poll_cap * 2 : 64;
+    while (ncap < n) ncap *= 2;
+    struct pollfd *fds = (struct pollfd *)realloc(poll_fds, ncap * sizeof(*fds));
+    if (!fds) return false;
+    poll_fds = fds;
+    ProcRef *refs = (ProcRef *)realloc(poll_refs, ncap * sizeof(*refs));
+    if (!refs) return false;
+    poll_refs = refs;
+    poll_cap = ncap;
+    return true;
+}
+
+// Queue the unreaped processes of jobs[i] for polling; false when out of memory
+static bool poll_add_job(int i, size_t *n) {
+    Job *job = &jobs[i];
+    if (!poll_reserve(*n + (size_t)job->nlive)) return false;
+    for (int k = 0; k < job->nprocs; k++) {
+        if (job->procs[k].reaped) continue;
+        poll_fds[*n] = (struct pollfd){ job->procs[k].pidfd, POLLIN, 0 };
+        poll_refs[*n] = (ProcRef){ i, k };
+        (*n)++;
+    }
+    return true;
+}
+
+void jobs_init(void) {
     next_job_number = 1;
     job_count = 0;
 }
 
-int jobs_add(pid_t pid, const char *command, bool is_background) {
-    if (job_count >= MAX_JOBS) {
-        return -1; // No space for more jobs
+int jobs_add(pid_t pgid, const pid_t *pids, int npids, const char *command, bool is_background) {
+    if (npids <= 0) return -1;
+    int slot = -1;
+    for (int i = 0; i < job_slots && slot < 0; i++) {
+        if (jobs[i].state == JOB_COMPLETED) slot = i;
     }
-    
-    // Find an empty slot
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].state == JOB_COMPLETED) {
-            jobs[i].job_number = next_job_number++;
-            jobs[i].pid = pid;
-            jobs[i].command = command ? strdup(command) : NULL;
-            jobs[i].state = is_background ? JOB_RUNNING : JOB_RUNNING;
-            jobs[i].is_background = is_background;
-            job_count++;
-            return jobs[i].job_number;
-        }
+    if (slot < 0) {
+        int nslots = job_slots ? job_slots * 2 : 16;
+        Job *tmp = (Job *)realloc(jobs, (size_t)nslots * sizeof(Job));
+        if (!tmp) return -1;
+        memset(tmp + job_slots, 0, (size_t)(nslots - job_slots) * sizeof(Job));
+        for (int i = job_slots; i < nslots; i++) tmp[i].state = JOB_COMPLETED;
+        jobs = tmp;
+        slot = job_slots;
+        job_slots = nslots;
     }
-    
-    return -1; // No empty slot found
+    JobProc *procs = (JobProc *)calloc((size_t)npids, sizeof(JobProc));
+    if (!procs) return -1;
+    for (int k = 0; k < npids; k++) {
+        procs[k].pid = pids[k];
+        procs[k].pidfd = events_pidfd_open(pids[k]);
+    }
+
+    Job *job = &jobs[slot];
+    memset(job, 0, sizeof(*job));
+    job->job_number = next_job_number++;
+    job->pid = pgid;
+    job->procs = procs;
+    job->nprocs = npids;
+    job->nlive = npids;
+    job->command = command ? strdup(command) : NULL;
+    job->state = JOB_RUNNING;
+    job->is_background = is_background;
+    job->start_wall_us = clock_us(CLOCK_REALTIME);
+    job->start_mono_us = clock_us(CLOCK_MONOTONIC);
+    job_count++;
+    return job->job_number;
 }
 
 void jobs_remove(int job_number) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].job_number == job_number) {
-            free(jobs[i].command);
-            jobs[i].job_number = 0;
-            jobs[i].pid = 0;
-            jobs[i].command = NULL;
-            jobs[i].state = JOB_COMPLETED;
-            jobs[i].is_background = false;
-            job_count--;
-            break;
-        }
+    Job *job = find_job(job_number);
+    if (!job) return;
+    for (int k = 0; k < job->nprocs; k++) {
+        if (job->procs[k].pidfd >= 0) close(job->procs[k].pidfd);
     }
+    // A timeout still armed for the job goes with it
+    if (job->timer_id > 0) free(events_timer_cancel(job->timer_id));
+    pipemon_free(job->monitor);
+    if (job->limits) free(job->limits->cpus_spec);
+    free(job->limits);
+    free(job->procs);
+    free(job->command);
+    memset(job, 0, sizeof(*job));
+    job->state = JOB_COMPLETED;
+    job_count--;
 }
 
 Job *jobs_get(int job_number) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].job_number == job_number) {
-            return &jobs[i];
-        }
+    Job *job = find_job(job_number);
+    return job && job_live(job) ? job : NULL;
+}
+
+int jobs_count(void) {
+    int n = 0;
+    for (int i = 0; i < job_slots; i++) {
+        if (job_live(&jobs[i])) n++;
     }
-    return NULL;
+    return n;
+}
+
+int jobs_list_numbers(int *out, int max) {
+    int n = 0;
+    for (int i = 0; i < job_slots && n < max; i++) {
+        if (job_live(&jobs[i])) out[n++] = jobs[i].job_number;
+    }
+    // Slots are reused, so numbers are not stored in order
+    for (int i = 1; i < n; i++) {
+        int v = out[i], j = i;
+        while (j > 0 && out[j - 1] > v) { out[j] = out[j - 1]; j--; }
+        out[j] = v;
+    }
+    return n;
 }
 
 Job *jobs_get_by_pid(pid_t pid) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].pid == pid && jobs[i].state != JOB_COMPLETED) {
-            return &jobs[i];
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state == JOB_COMPLETED) continue;
+        if (jobs[i].pid == pid) return &jobs[i];
+        for (int k = 0; k < jobs[i].nprocs; k++) {
+            if (jobs[i].procs[k].pid == pid) return &jobs[i];
         }
     }
     return NULL;
 }
 
-void jobs_check_completed(void) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].state == JOB_RUNNING && jobs[i].is_background) {
-            int status;
-            pid_t result = waitpid(jobs[i].pid, &status, WNOHANG);
-            
-            if (result > 0) {
-                // Process has completed
-                if (WIFEXITED(status)) {
-                    printf("%s with pid %d exited normally\n", 
-                           jobs[i].command ? jobs[i].command : "Command", 
-                           jobs[i].pid);
-                    fflush(stdout);
-                } else if (WIFSIGNALED(status)) {
-                    printf("%s with pid %d exited abnormally\n", 
-                           jobs[i].command ? jobs[i].command : "Command", 
-                           jobs[i].pid);
-                    fflush(stdout);
-                }
-                
-                // Remove the completed job
-                jobs_remove(jobs[i].job_number);
-            }
+void jobs_reap(void) {
+    size_t n = 0;
+    for (int i = 0; i < job_slots; i++) {
+        // A job brought back with 'fg' is waited for by jobs_bring_to_foreground()
+        if (!job_live(&jobs[i]) || jobs[i].pid == foreground_pgid) continue;
+        if (!poll_add_job(i, &n)) break;
+    }
+    if (n == 0) return;
+    // One poll() picks out the processes that exited and only those are
+    // waited for; a process without a pidfd is simply tried
+    if (poll(poll_fds, (nfds_t)n, 0) < 0) return;
+    bool finished = false;
+    for (size_t r = 0; r < n; r++) {
+        if (poll_fds[r].fd >= 0 && !poll_fds[r].revents) continue;
+        Job *job = &jobs[poll_refs[r].job];
+        JobProc *p = &job->procs[poll_refs[r].proc];
+        int status = 0;
+        struct rusage ru;
+        pid_t result = wait4(p->pid, &status, WNOHANG, &ru);
+        if (result == 0 || (result < 0 && errno != ECHILD)) continue;
+        // ECHILD: reaped elsewhere, so there is no status left to collect
+        job_proc_exited(job, p, status, result > 0 ? &ru : NULL);
+        if (job->nlive == 0) {
+            job_record_stats(job);
+            job->state = JOB_DONE;
+            finished = true;
+        }
+    }
+    // A finished job frees its place for a queued one
+    if (finished) jobs_admit();
+}
+
+bool jobs_have_completed(void) {
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state == JOB_DONE) return true;
+    }
+    return false;
+}
+
+void jobs_report_completed(void) {
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state != JOB_DONE) continue;
+        printf("%s with pid %d exited %s\n", jobs[i].command ? jobs[i].command : "Command", jobs[i].pid,
+               WIFEXITED(jobs[i].wait_status) ? "normally" : "abnormally");
+        if (jobs[i].monitor) {
+            fflush(stdout);
+            pipemon_finish(jobs[i].monitor);
         }
+        jobs_remove(jobs[i].job_number);
     }
+    fflush(stdout);
 }
 
 void jobs_print_job(int job_number, pid_t pid) {
@@ -115,52 +274,397 @@ int jobs_get_next_number(void) {
 }
 
 void jobs_cleanup(void) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        free(jobs[i].command);
-        jobs[i].command = NULL;
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state != JOB_COMPLETED) jobs_remove(jobs[i].job_number);
     }
+    free(jobs);
+    jobs = NULL;
+    job_slots = 0;
+    free(poll_fds);
+    free(poll_refs);
+    poll_fds = NULL;
+    poll_refs = NULL;
+    poll_cap = 0;
 }
 
 void jobs_kill_all(void) {
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].state != JOB_COMPLETED && jobs[i].pid > 0) {
-            kill(jobs[i].pid, SIGKILL);
+    for (int i = 0; i < job_slots; i++) {
+        if (!job_live(&jobs[i])) continue;
+        for (int k = 0; k < jobs[i].nprocs; k++) {
+            if (!jobs[i].procs[k].reaped) kill(jobs[i].procs[k].pid, SIGKILL);
+        }
+    }
+}
+
+static bool job_targeted(const Job *job, const int *job_numbers, int count) {
+    if (count == 0) return true;
+    for (int i = 0; i < count; i++) {
+        if (job_numbers[i] == job->job_number) return true;
+    }
+    return false;
+}
+
+int jobs_wait(const int *job_numbers, int count, bool any) {
+    for (int i = 0; i < count; i++) {
+        if (!find_job(job_numbers[i])) {
+            printf("wait: %%%d: no such job\n", job_numbers[i]);
+            return 127;
+        }
+    }
+    for (;;) {
+        jobs_reap();
+        size_t n = 0;
+        for (int i = 0; i < job_slots; i++) {
+            Job *job = &jobs[i];
+            if (job->state == JOB_COMPLETED || !job_targeted(job, job_numbers, count)) continue;
+            if (any && job->state == JOB_DONE && !job->waited) {
+                job->waited = true;
+                return status_code(job->wait_status);
+            }
+            // A stopped job would never finish on its own; a queued one is
+            // admitted meanwhile by the events this waits on
+            if ((job->state == JOB_RUNNING || job->state == JOB_QUEUED) && !poll_add_job(i, &n)) return 1;
         }
+        if (n == 0) break;
+        // Processes without a pidfd are looked at again every 100ms
+        int timeout = -1;
+        for (size_t r = 0; r < n; r++) {
+            if (poll_fds[r].fd < 0) timeout = 100;
+        }
+        EventResult ev = events_poll(poll_fds, n, timeout);
+        if (ev == EVENT_ERROR) return 1;
+        if (ev == EVENT_HANDLED && interrupt_received) return 130;
+    }
+    if (any) return 127;
+
+    int status = 0;
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state == JOB_DONE && count == 0) jobs[i].waited = true;
+    }
+    for (int i = 0; i < count; i++) {
+        Job *job = find_job(job_numbers[i]);
+        if (job && job->state == JOB_DONE) {
+            job->waited = true;
+            status = status_code(job->wait_status);
+        }
+    }
+    return status;
+}
+
+int jobs_priority_nice(int priority) {
+    return priority_nice[priority];
+}
+
+const char *jobs_priority_name(int priority) {
+    return priority_names[priority];
+}
+
+int jobs_parse_priority(const char *name) {
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, priority_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static int count_jobs(JobState state, bool background_only) {
+    int n = 0;
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state == state && (!background_only || jobs[i].is_background)) n++;
+    }
+    return n;
+}
+
+// MemAvailable in bytes, or -1 if /proc/meminfo does not say
+static long long mem_available(void) {
+    FILE *f = fopen("/proc/meminfo", "r");
+    if (!f) return -1;
+    char line[128];
+    long long kb = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "MemAvailable: %lld kB", &kb) == 1) break;
     }
+    fclose(f);
+    return kb < 0 ? -1 : kb * 1024;
+}
+
+// Whether one more background job may start right now
+static bool admission_open(void) {
+    int max_jobs = state_get_max_jobs();
+    if (max_jobs > 0 && count_jobs(JOB_RUNNING, true) >= max_jobs) return false;
+    double load;
+    if (state_get_max_load() > 0 && getloadavg(&load, 1) == 1 && load >= state_get_max_load()) return false;
+    if (state_get_min_mem() > 0) {
+        long long avail = mem_available();
+        if (avail >= 0 && avail < state_get_min_mem()) return false;
+    }
+    return true;
+}
+
+bool jobs_admission_full(void) {
+    // Nobody jumps the queue
+    return count_jobs(JOB_QUEUED, false) > 0 || !admission_open();
+}
+
+void jobs_set_queued(int job_number, int priority) {
+    Job *job = jobs_get(job_number);
+    if (!job) return;
+    job->priority = priority;
+    job->state = JOB_QUEUED;
+}
+
+// Let a queued job's processes, stopped before exec, go on at its priority
+static void job_start(Job *job) {
+    int nice = priority_nice[job->priority];
+    for (int k = 0; k < job->nprocs && nice != 0; k++) {
+        if (!job->procs[k].reaped) setpriority(PRIO_PROCESS, (id_t)job->procs[k].pid, nice);
+    }
+    if (kill(-job->pid, SIGCONT) != 0) {
+        for (int k = 0; k < job->nprocs; k++) {
+            if (!job->procs[k].reaped) kill(job->procs[k].pid, SIGCONT);
+        }
+    }
+    job->state = JOB_RUNNING;
+    // Its time in the queue does not count towards 'log stats'
+    job->start_wall_us = clock_us(CLOCK_REALTIME);
+    job->start_mono_us = clock_us(CLOCK_MONOTONIC);
+}
+
+static void admit_tick(void *arg) {
+    admit_timer = 0;
+    jobs_admit();
+}
+
+void jobs_admit(void) {
+    // Load and free memory only show a started job after a while, so with
+    // either limit set jobs are let go one per second
+    bool paced = state_get_max_load() > 0 || state_get_min_mem() > 0;
+    while (admission_open()) {
+        Job *best = NULL;
+        for (int i = 0; i < job_slots; i++) {
+            Job *job = &jobs[i];
+            if (job->state != JOB_QUEUED) continue;
+            if (!best || job->priority > best->priority ||
+                (job->priority == best->priority && job->job_number < best->job_number)) best = job;
+        }
+        if (!best) break;
+        job_start(best);
+        if (paced) break;
+    }
+    if (paced && admit_timer == 0 && count_jobs(JOB_QUEUED, false) > 0) {
+        admit_timer = events_timer_start(1.0, admit_tick, NULL);
+        if (admit_timer < 0) admit_timer = 0;
+    }
+}
+
+static int compare_queue_order(const void *a, const void *b) {
+    const Job *ja = *(const Job *const *)a;
+    const Job *jb = *(const Job *const *)b;
+    if (ja->priority != jb->priority) return jb->priority - ja->priority;
+    return ja->job_number - jb->job_number;
+}
+
+void jobs_print_queue(void) {
+    int n = count_jobs(JOB_QUEUED, false);
+    if (n == 0) return;
+    Job **queued = (Job **)malloc((size_t)n * sizeof(Job *));
+    if (!queued) return;
+    int k = 0;
+    for (int i = 0; i < job_slots; i++) {
+        if (jobs[i].state == JOB_QUEUED) queued[k++] = &jobs[i];
+    }
+    qsort(queued, (size_t)n, sizeof(Job *), compare_queue_order);
+    for (int i = 0; i < n; i++) {
+        printf("[%d] %s : %s\n", queued[i]->job_number, priority_names[queued[i]->priority],
+               queued[i]->command ? queued[i]->command : "unknown");
+    }
+    free(queued);
+}
+
+int jobs_set_priority(int job_number, int priority) {
+    Job *job = jobs_get(job_number);
+    if (!job) return -1;
+    job->priority = priority;
+    // Already running: only its niceness can still change
+    if (job->state != JOB_QUEUED) {
+        for (int k = 0; k < job->nprocs; k++) {
+            if (!job->procs[k].reaped) setpriority(PRIO_PROCESS, (id_t)job->procs[k].pid, priority_nice[priority]);
+        }
+    }
+    return 0;
+}
+
+void jobs_set_limits(int job_number, const JobLimits *limits) {
+    Job *job = jobs_get(job_number);
+    if (!job || !limits) return;
+    JobLimits *copy = (JobLimits *)malloc(sizeof(JobLimits));
+    if (!copy) return;
+    *copy = *limits;
+    copy->cpus_spec = limits->cpus_spec ? strdup(limits->cpus_spec) : NULL;
+    job->limits = copy;
+}
+
+// "cpus 0-3, nice 10, mem 2G" for 'activities'
+static void print_limits(const JobLimits *l) {
+    const char *sep = "    ";
+    if (l->cpus_spec) {
+        printf("%scpus %s", sep, l->cpus_spec);
+        sep = ", ";
+    }
+    if (l->set_nice) {
+        printf("%snice %d", sep, l->nice);
+        sep = ", ";
+    }
+    if (l->mem > 0) {
+        const char *units = "KMG";
+        long long v = l->mem;
+        int u = -1;
+        while (u < 2 && v % 1024 == 0) {
+            v /= 1024;
+            u++;
+        }
+        if (u < 0) printf("%smem %lld", sep, v);
+        else printf("%smem %lld%c", sep, v, units[u]);
+    }
+    printf("\n");
 }
 
 // Part E functions
 
-void jobs_list_activities(void) {
-    // Create array of active jobs for sorting
-    Job *active_jobs[MAX_JOBS];
-    int active_count = 0;
-    
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].state != JOB_COMPLETED) {
-            active_jobs[active_count++] = &jobs[i];
+static const char *const sort_names[] = { "cmd", "pid", "state", "cpu", "rss", "time" };
+
+int jobs_parse_sort_keys(const char *text, ActivitySort *keys, int max) {
+    int n = 0;
+    const char *p = text;
+    while (*p) {
+        size_t len = strcspn(p, ",");
+        int key = -1;
+        for (int k = 0; k < (int)(sizeof(sort_names) / sizeof(sort_names[0])); k++) {
+            if (strlen(sort_names[k]) == len && strncmp(p, sort_names[k], len) == 0) key = k;
         }
+        if (key < 0 || n == max) return -1;
+        keys[n++] = (ActivitySort)key;
+        p += len;
+        if (*p == ',') p++;
     }
-    
-    // Sort by command name (lexicographically)
-    for (int i = 0; i < active_count - 1; i++) {
-        for (int j = i + 1; j < active_count; j++) {
-            const char *name1 = active_jobs[i]->command ? active_jobs[i]->command : "unknown";
-            const char *name2 = active_jobs[j]->command ? active_jobs[j]->command : "unknown";
-            if (strcmp(name1, name2) > 0) {
-                Job *temp = active_jobs[i];
-                active_jobs[i] = active_jobs[j];
-                active_jobs[j] = temp;
+    return n;
+}
+
+// A live job as 'activities' lists it, with its processes sampled
+typedef struct {
+    Job *job;
+    ProcSample *samples; // one per process; pid 0 where it could not be read
+    double cpu;
+    long rss_kb;
+    double elapsed;
+} ActivityRow;
+
+// qsort() takes no context: the keys of the listing in progress
+static const ActivitySort *row_keys = NULL;
+static int row_nkeys = 0;
+
+static int compare_key(const ActivityRow *a, const ActivityRow *b, ActivitySort key) {
+    switch (key) {
+    case ACT_SORT_COMMAND:
+        return strcmp(a->job->command ? a->job->command : "unknown", b->job->command ? b->job->command : "unknown");
+    case ACT_SORT_PID:
+        return (a->job->pid > b->job->pid) - (a->job->pid < b->job->pid);
+    case ACT_SORT_STATE:
+        return (int)a->job->state - (int)b->job->state;
+    case ACT_SORT_CPU:
+        return (b->cpu > a->cpu) - (b->cpu < a->cpu);
+    case ACT_SORT_RSS:
+        return (b->rss_kb > a->rss_kb) - (b->rss_kb < a->rss_kb);
+    case ACT_SORT_TIME:
+        return (b->elapsed > a->elapsed) - (b->elapsed < a->elapsed);
+    }
+    return 0;
+}
+
+static int compare_rows(const void *pa, const void *pb) {
+    const ActivityRow *a = (const ActivityRow *)pa;
+    const ActivityRow *b = (const ActivityRow *)pb;
+    for (int k = 0; k < row_nkeys; k++) {
+        int c = compare_key(a, b, row_keys[k]);
+        if (c != 0) return c;
+    }
+    // Ties keep the order the jobs were started in
+    return a->job->job_number - b->job->job_number;
+}
+
+static void format_kb(char *buf, size_t size, long kb) {
+    if (kb >= 1024L * 1024) snprintf(buf, size, "%.1fG", (double)kb / (1024.0 * 1024.0));
+    else if (kb >= 1024) snprintf(buf, size, "%.1fM", (double)kb / 1024.0);
+    else snprintf(buf, size, "%ldK", kb);
+}
+
+static void format_elapsed(char *buf, size_t size, double seconds) {
+    long s = (long)seconds;
+    if (s >= 3600) snprintf(buf, size, "%ld:%02ld:%02ld", s / 3600, s / 60 % 60, s % 60);
+    else snprintf(buf, size, "%02ld:%02ld", s / 60, s % 60);
+}
+
+static void print_samples(const ActivityRow *row) {
+    for (int k = 0; k < row->job->nprocs; k++) {
+        const ProcSample *ps = &row->samples[k];
+        if (ps->pid == 0) continue;
+        char rss[16], elapsed[16];
+        format_kb(rss, sizeof(rss), ps->rss_kb);
+        format_elapsed(elapsed, sizeof(elapsed), ps->elapsed);
+        printf("    %-8d %-16s %c %6.1f %8s %4d %9s\n", (int)ps->pid, ps->comm, ps->state, ps->cpu_percent, rss,
+               ps->threads, elapsed);
+    }
+}
+
+void jobs_list_activities(const ActivitySort *keys, int nkeys, bool detailed) {
+    static const ActivitySort by_command = ACT_SORT_COMMAND;
+    if (nkeys == 0) {
+        keys = &by_command;
+        nkeys = 1;
+    }
+    bool sample = detailed;
+    for (int k = 0; k < nkeys; k++) {
+        if (keys[k] == ACT_SORT_CPU || keys[k] == ACT_SORT_RSS || keys[k] == ACT_SORT_TIME) sample = true;
+    }
+
+    ActivityRow *rows = (ActivityRow *)calloc((size_t)(job_slots ? job_slots : 1), sizeof(ActivityRow));
+    if (!rows) return;
+    int count = 0;
+    for (int i = 0; i < job_slots; i++) {
+        if (!job_live(&jobs[i])) continue;
+        ActivityRow *row = &rows[count++];
+        row->job = &jobs[i];
+        if (!sample) continue;
+        row->samples = (ProcSample *)calloc((size_t)jobs[i].nprocs, sizeof(ProcSample));
+        if (!row->samples) continue;
+        for (int k = 0; k < jobs[i].nprocs; k++) {
+            ProcSample *ps = &row->samples[k];
+            if (jobs[i].procs[k].reaped || !procstat_sample(jobs[i].procs[k].pid, ps)) {
+                ps->pid = 0;
+                continue;
             }
+            row->cpu += ps->cpu_percent;
+            row->rss_kb += ps->rss_kb;
+            if (ps->elapsed > row->elapsed) row->elapsed = ps->elapsed;
         }
     }
-    
-    // Print sorted results
-    for (int i = 0; i < active_count; i++) {
-        const char *state_str = (active_jobs[i]->state == JOB_RUNNING) ? "Running" : "Stopped";
-        const char *cmd_name = active_jobs[i]->command ? active_jobs[i]->command : "unknown";
-        printf("[%d] : %s - %s\n", active_jobs[i]->pid, cmd_name, state_str);
+    if (sample) procstat_sweep();
+
+    row_keys = keys;
+    row_nkeys = nkeys;
+    qsort(rows, (size_t)count, sizeof(ActivityRow), compare_rows);
+
+    if (detailed && count > 0) printf("    %-8s %-16s %s %6s %8s %4s %9s\n", "PID", "COMMAND", "S", "CPU%", "RSS", "THR", "ELAPSED");
+    for (int i = 0; i < count; i++) {
+        Job *job = rows[i].job;
+        const char *state_str = job->state == JOB_RUNNING ? "Running" : job->state == JOB_QUEUED ? "Queued" : "Stopped";
+        const char *cmd_name = job->command ? job->command : "unknown";
+        printf("[%d] : %s - %s\n", job->pid, cmd_name, state_str);
+        if (detailed && rows[i].samples) print_samples(&rows[i]);
+        if (job->limits) print_limits(job->limits);
+        if (job->monitor) pipemon_print_rates(job->monitor, "    ");
     }
+    for (int i = 0; i < count; i++) free(rows[i].samples);
+    free(rows);
 }
 
 int jobs_send_signal(int job_number, int signal_num) {
@@ -193,31 +697,48 @@ int jobs_bring_to_foreground(int job_number) {
     const char *cmd_name = job->command ? job->command : "unknown";
     printf("%s\n", cmd_name);
     
+    // A queued job starts now, ahead of its turn
+    if (job->state == JOB_QUEUED) job_start(job);
     // If job is stopped, resume it
     if (job->state == JOB_STOPPED) {
-        if (kill(job->pid, SIGCONT) != 0) {
+        // The job leads its process group: resume every process in it
+        if (kill(-job->pid, SIGCONT) != 0 && kill(job->pid, SIGCONT) != 0) {
             printf("No such job\n");
             return -1;
         }
         job->state = JOB_RUNNING;
     }
     
-    // Wait for the job to complete or stop again
-    int status;
-    pid_t result = waitpid(job->pid, &status, WUNTRACED);
-    
-    if (result > 0) {
-        if (WIFSTOPPED(status)) {
+    // Wait for every process to exit, or for the job to stop again; Ctrl-C /
+    // Ctrl-Z reaching the shell meanwhile are passed on to it
+    foreground_pgid = job->pid;
+    for (int k = 0; k < job->nprocs; k++) {
+        JobProc *p = &job->procs[k];
+        if (p->reaped) continue;
+        int status = 0;
+        struct rusage ru;
+        pid_t result = events_wait_child(p->pid, &status, WUNTRACED, &ru);
+        if (result > 0 && WIFSTOPPED(status)) {
             // Job was stopped again
+            foreground_pgid = 0;
             job->state = JOB_STOPPED;
             printf("[%d] Stopped %s\n", job->job_number, cmd_name);
-        } else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-            // Job completed
-            jobs_remove(job_number);
+            return 128 + WSTOPSIG(status);
         }
+        job_proc_exited(job, p, status, result > 0 ? &ru : NULL);
     }
-    
-    return 0;
+    foreground_pgid = 0;
+
+    // Job completed
+    job_record_stats(job);
+    if (job->monitor) {
+        fflush(stdout);
+        pipemon_finish(job->monitor);
+    }
+    int code = status_code(job->wait_status);
+    jobs_remove(job_number);
+    jobs_admit();
+    return code;
 }
 
 int jobs_resume_background(int job_number) {
@@ -232,8 +753,14 @@ int jobs_resume_background(int job_number) {
         return 0;
     }
     
+    if (job->state == JOB_QUEUED) {
+        job_start(job);
+        printf("[%d] %s &\n", job->job_number, job->command ? job->command : "unknown");
+        return 0;
+    }
+
     if (job->state == JOB_STOPPED) {
-        if (kill(job->pid, SIGCONT) == 0) {
+        if (kill(-job->pid, SIGCONT) == 0 || kill(job->pid, SIGCONT) == 0) {
             job->state = JOB_RUNNING;
             const char *cmd_name = job->command ? job->command : "unknown";
             printf("[%d] %s &\n", job->job_number, cmd_name);
@@ -251,8 +778,8 @@ int jobs_get_most_recent_job(void) {
     int most_recent = -1;
     int highest_job_num = 0;
     
-    for (int i = 0; i < MAX_JOBS; i++) {
-        if (jobs[i].state != JOB_COMPLETED && jobs[i].job_number > highest_job_num) {
+    for (int i = 0; i < job_slots; i++) {
+        if (job_live(&jobs[i]) && jobs[i].job_number > highest_job_num) {
             highest_job_num = jobs[i].job_number;
             most_recent = jobs[i].job_number;
         }
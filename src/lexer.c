@@ -0,0 +1,175 @@
+#include "lexer.h"
+
+#include <string.h>
+
+bool lex_is_delim(char c) {
+	return c == '|' || c == '&' || c == '>' || c == '<' || c == ';' || c == '(' || c == ')' ||
+	       c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+size_t lex_scan_fd(const char *s, size_t i, int *fd) {
+	size_t j = i;
+	int v = 0;
+	while (s[j] >= '0' && s[j] <= '9' && j - i < 9) v = v * 10 + (s[j++] - '0');
+	if (j == i || (s[j] >= '0' && s[j] <= '9')) return i;
+	*fd = v;
+	return j;
+}
+
+size_t lex_match_keyword(const char *s, size_t i, const char *kw) {
+	size_t n = strlen(kw);
+	if (strncmp(s + i, kw, n) != 0 || !(s[i + n] == '\0' || lex_is_delim(s[i + n]))) return i;
+	return i + n;
+}
+
+size_t lex_match_keywords(const char *s, size_t i, const char *kws) {
+	while (*kws) {
+		size_t n = strcspn(kws, " ");
+		if (strncmp(s + i, kws, n) == 0 && (s[i + n] == '\0' || lex_is_delim(s[i + n]))) return i + n;
+		kws += n;
+		if (*kws == ' ') kws++;
+	}
+	return i;
+}
+
+bool lex_starts_compound(const char *s, size_t i) {
+	return s[i] == '(' || lex_match_keywords(s, i, "{ if while until for") != i;
+}
+
+size_t lex_match_funcdef(const char *s, size_t i) {
+	unsigned flags = 0;
+	size_t end = lex_scan_word(s, i, &flags);
+	if (end == i || flags != 0 || memchr(s + i, '=', end - i)) return i;
+	size_t k = end;
+	while (s[k] == ' ' || s[k] == '\t') k++;
+	if (s[k] != '(') return i;
+	k++;
+	while (s[k] == ' ' || s[k] == '\t') k++;
+	return s[k] == ')' ? k + 1 : i;
+}
+
+static bool opens_subst(const char *s, size_t i) {
+	return s[i] == '`' || (s[i] == '$' && s[i + 1] == '(');
+}
+
+size_t lex_scan_subst(const char *s, size_t i) {
+	if (s[i] == '`') {
+		size_t j = i + 1;
+		while (s[j] != '\0' && s[j] != '`') j += (s[j] == '\\' && s[j + 1] != '\0') ? 2 : 1;
+		return s[j] == '`' ? j + 1 : i;
+	}
+	// "$(", "<(" or ">(": parentheses nest; quoted ones and those of inner
+	// substitutions do not count
+	size_t j = i + 2;
+	int depth = 1;
+	while (s[j] != '\0') {
+		char c = s[j];
+		if (c == '\'') {
+			const char *close = strchr(s + j + 1, '\'');
+			if (!close) return i;
+			j = (size_t)(close - s) + 1;
+		} else if (c == '"') {
+			j++;
+			while (s[j] != '\0' && s[j] != '"') {
+				if (s[j] == '\\' && s[j + 1] != '\0') {
+					j += 2;
+				} else if (opens_subst(s, j)) {
+					size_t end = lex_scan_subst(s, j);
+					if (end == j) return i;
+					j = end;
+				} else {
+					j++;
+				}
+			}
+			if (s[j] == '\0') return i;
+			j++;
+		} else if (c == '\\') {
+			j += s[j + 1] != '\0' ? 2 : 1;
+		} else if (opens_subst(s, j)) {
+			size_t end = lex_scan_subst(s, j);
+			if (end == j) return i;
+			j = end;
+		} else {
+			if (c == '(') depth++;
+			else if (c == ')' && --depth == 0) return j + 1;
+			j++;
+		}
+	}
+	return i;
+}
+
+bool lex_at_proc_subst(const char *s, size_t i) {
+	return (s[i] == '<' || s[i] == '>') && s[i + 1] == '(';
+}
+
+size_t lex_scan_word(const char *s, size_t i, unsigned *flags) {
+	unsigned f = 0;
+	size_t start = i;
+	while (s[i] != '\0' && (!lex_is_delim(s[i]) || (i == start && lex_at_proc_subst(s, i)))) {
+		char c = s[i];
+		if (opens_subst(s, i) || (i == start && lex_at_proc_subst(s, i))) {
+			size_t end = lex_scan_subst(s, i);
+			if (end == i) { f |= LEX_ERROR; i += strlen(s + i); break; }
+			f |= LEX_PARAM | LEX_SUBST;
+			i = end;
+		} else if (c == '\'') {
+			f |= LEX_QUOTED;
+			const char *close = strchr(s + i + 1, '\'');
+			if (!close) { f |= LEX_ERROR; i += strlen(s + i); break; }
+			i = (size_t)(close - s) + 1;
+		} else if (c == '"') {
+			f |= LEX_QUOTED;
+			i++;
+			while (s[i] != '\0' && s[i] != '"') {
+				if (opens_subst(s, i)) {
+					size_t end = lex_scan_subst(s, i);
+					if (end == i) { i += strlen(s + i); break; }
+					f |= LEX_PARAM | LEX_SUBST;
+					i = end;
+					continue;
+				}
+				if (s[i] == '\\' && s[i + 1] != '\0') i++;
+				else if (s[i] == '$') f |= LEX_PARAM;
+				i++;
+			}
+			if (s[i] == '\0') { f |= LEX_ERROR; break; }
+			i++;
+		} else if (c == '\\') {
+			f |= LEX_QUOTED;
+			i += (s[i + 1] != '\0') ? 2 : 1;
+		} else {
+			if (c == '$') f |= LEX_PARAM;
+			else if (c == '*' || c == '?' || c == '[') f |= LEX_GLOB;
+			i++;
+		}
+	}
+	*flags = f;
+	return i;
+}
+
+size_t lex_dequote(char *w) {
+	char *out = w;
+	const char *p = w;
+	while (*p) {
+		if (*p == '\'') {
+			p++;
+			while (*p && *p != '\'') *out++ = *p++;
+			if (*p) p++;
+		} else if (*p == '"') {
+			p++;
+			while (*p && *p != '"') {
+				// Inside double quotes a backslash only escapes $ ` " \ and newline
+				if (*p == '\\' && (p[1] == '$' || p[1] == '`' || p[1] == '"' || p[1] == '\\' || p[1] == '\n')) p++;
+				*out++ = *p++;
+			}
+			if (*p) p++;
+		} else if (*p == '\\' && p[1] != '\0') {
+			p++;
+			*out++ = *p++;
+		} else {
+			*out++ = *p++;
+		}
+	}
+	*out = '\0';
+	return (size_t)(out - w);
+}
@@ -0,0 +1,260 @@
+#include "parsecache.h"
+#include "builtins.h"
+#include "parser.h"
+#include "vars.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define CACHE_ENTRIES 64
+#define CACHE_BUCKETS 128 // power of two
+
+// Entries live in a fixed array, chained per hash bucket and linked into one
+// recency list (head = most recently used). Entries in use are never evicted.
+typedef struct {
+	uint64_t hash;
+	char *line;        // private copy of the key; NULL for a free slot
+	CmdSequence *seq;
+	int refs;          // acquisitions not yet released
+	int bucket_next;   // -1 at the end of the chain
+	int lru_prev;      // -1 at either end of the list
+	int lru_next;
+} CacheEntry;
+
+static CacheEntry entries[CACHE_ENTRIES];
+static int buckets[CACHE_BUCKETS];
+static int lru_head = -1;
+static int lru_tail = -1;
+static int entry_count = 0;
+static bool initialized = false;
+static char *resolved_path = NULL; // PATH every cached exec_path was looked up in
+static unsigned long hits = 0;
+static unsigned long misses = 0;
+
+static void cache_init(void) {
+	if (initialized) return;
+	for (int i = 0; i < CACHE_BUCKETS; ++i) buckets[i] = -1;
+	initialized = true;
+}
+
+// FNV-1a
+static uint64_t hash_line(const char *s) {
+	uint64_t h = 1469598103934665603ULL;
+	for (; *s; ++s) {
+		h ^= (unsigned char)*s;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static int find_entry(uint64_t hash, const char *line) {
+	for (int i = buckets[hash & (CACHE_BUCKETS - 1)]; i >= 0; i = entries[i].bucket_next) {
+		if (entries[i].hash == hash && strcmp(entries[i].line, line) == 0) return i;
+	}
+	return -1;
+}
+
+static void lru_unlink(int i) {
+	CacheEntry *e = &entries[i];
+	if (e->lru_prev >= 0) entries[e->lru_prev].lru_next = e->lru_next;
+	else lru_head = e->lru_next;
+	if (e->lru_next >= 0) entries[e->lru_next].lru_prev = e->lru_prev;
+	else lru_tail = e->lru_prev;
+}
+
+static void lru_push_front(int i) {
+	entries[i].lru_prev = -1;
+	entries[i].lru_next = lru_head;
+	if (lru_head >= 0) entries[lru_head].lru_prev = i;
+	lru_head = i;
+	if (lru_tail < 0) lru_tail = i;
+}
+
+static void remove_entry(int i) {
+	CacheEntry *e = &entries[i];
+	int *link = &buckets[e->hash & (CACHE_BUCKETS - 1)];
+	while (*link != i) link = &entries[*link].bucket_next;
+	*link = e->bucket_next;
+	lru_unlink(i);
+	free(e->line);
+	free_cmd_sequence(e->seq);
+	e->line = NULL;
+	e->seq = NULL;
+	entry_count--;
+}
+
+// A free slot, evicting the least recently used idle entry when full
+static int take_slot(void) {
+	if (entry_count < CACHE_ENTRIES) {
+		for (int i = 0; i < CACHE_ENTRIES; ++i) {
+			if (!entries[i].line) return i;
+		}
+	}
+	for (int i = lru_tail; i >= 0; i = entries[i].lru_prev) {
+		if (entries[i].refs == 0) {
+			remove_entry(i);
+			return i;
+		}
+	}
+	return -1;
+}
+
+static bool has_heredoc(const CmdSequence *seq) {
+	for (int i = 0; i < seq->count; ++i) {
+		const CmdPipeline *group = &seq->groups[i];
+		for (int j = 0; j < group->count; ++j) {
+			const Cmd *c = &group->cmds[j];
+			if ((c->cond && has_heredoc(c->cond)) || (c->body && has_heredoc(c->body)) ||
+			    (c->alt && has_heredoc(c->alt))) return true;
+			for (int k = 0; k < c->redir_count; ++k) {
+				if (c->redirs[k].op == REDIR_HEREDOC) return true;
+			}
+		}
+	}
+	return false;
+}
+
+static bool is_builtin_name(const char *name) {
+	for (size_t i = 0; builtin_name(i); ++i) {
+		if (strcmp(builtin_name(i), name) == 0) return true;
+	}
+	return false;
+}
+
+// The first executable path/name along PATH, as execvp() would find it. Only
+// absolute directories are looked at: a relative entry depends on the cwd.
+static char *search_path(const char *name, const char *path) {
+	size_t nlen = strlen(name);
+	char full[PATH_MAX];
+	for (const char *p = path;; ++p) {
+		size_t len = strcspn(p, ":");
+		if (len == 0 || p[0] != '/') return NULL;
+		if (len + nlen + 2 <= sizeof(full)) {
+			memcpy(full, p, len);
+			full[len] = '/';
+			memcpy(full + len + 1, name, nlen + 1);
+			struct stat st;
+			if (stat(full, &st) == 0 && S_ISREG(st.st_mode) && access(full, X_OK) == 0) return strdup(full);
+		}
+		p += len;
+		if (*p == '\0') return NULL;
+	}
+}
+
+// Look up every literal, external command name of seq once, up front
+static void resolve_sequence(CmdSequence *seq, const char *path) {
+	for (int i = 0; i < seq->count; ++i) {
+		CmdPipeline *group = &seq->groups[i];
+		for (int j = 0; j < group->count; ++j) {
+			Cmd *c = &group->cmds[j];
+			// A function body outlives the entry, and with it this PATH
+			if (c->kind == CMD_FUNCDEF) continue;
+			if (c->kind != CMD_SIMPLE) {
+				if (c->cond) resolve_sequence(c->cond, path);
+				if (c->body) resolve_sequence(c->body, path);
+				if (c->alt) resolve_sequence(c->alt, path);
+				continue;
+			}
+			// NAME=value prefixes may set PATH for this one command
+			if (!c->argv || !c->argv[0] || c->assigns || (c->word_flags && c->word_flags[0])) continue;
+			if (strchr(c->argv[0], '/') || is_builtin_name(c->argv[0])) continue;
+			c->exec_path = search_path(c->argv[0], path);
+		}
+	}
+}
+
+static void forget_resolutions(CmdSequence *seq) {
+	for (int i = 0; i < seq->count; ++i) {
+		CmdPipeline *group = &seq->groups[i];
+		for (int j = 0; j < group->count; ++j) {
+			Cmd *c = &group->cmds[j];
+			if (c->cond) forget_resolutions(c->cond);
+			if (c->body) forget_resolutions(c->body);
+			if (c->alt) forget_resolutions(c->alt);
+			free(c->exec_path);
+			c->exec_path = NULL;
+		}
+	}
+}
+
+void parse_cache_invalidate(void) {
+	for (int i = 0; i < CACHE_ENTRIES; ++i) {
+		if (!entries[i].line) continue;
+		// A line still running keeps its parse but drops its PATH lookups
+		if (entries[i].refs > 0) forget_resolutions(entries[i].seq);
+		else remove_entry(i);
+	}
+}
+
+CmdSequence *parse_cache_acquire(const char *line) {
+	cache_init();
+	const char *path = vars_get("PATH");
+	if (!path) path = "";
+	if (!resolved_path || strcmp(resolved_path, path) != 0) {
+		parse_cache_invalidate();
+		free(resolved_path);
+		resolved_path = strdup(path);
+	}
+
+	uint64_t hash = hash_line(line);
+	int i = find_entry(hash, line);
+	if (i >= 0) {
+		hits++;
+		lru_unlink(i);
+		lru_push_front(i);
+		entries[i].refs++;
+		return entries[i].seq;
+	}
+	misses++;
+
+	// Keyed by the line as typed: alias changes invalidate the whole cache
+	char *expanded = cmd_expand_aliases(line);
+	const char *text = expanded ? expanded : line;
+	CmdSequence *seq = parser_is_valid_command(text) ? parse_shell_cmd(text) : NULL;
+	free(expanded);
+	if (!seq || has_heredoc(seq)) return seq;
+	i = take_slot();
+	if (i < 0) return seq;
+	char *copy = strdup(line);
+	if (!copy) return seq;
+	if (resolved_path) resolve_sequence(seq, resolved_path);
+	CacheEntry *e = &entries[i];
+	e->hash = hash;
+	e->line = copy;
+	e->seq = seq;
+	e->refs = 1;
+	e->bucket_next = buckets[hash & (CACHE_BUCKETS - 1)];
+	buckets[hash & (CACHE_BUCKETS - 1)] = i;
+	lru_push_front(i);
+	entry_count++;
+	return seq;
+}
+
+void parse_cache_release(CmdSequence *seq) {
+	if (!seq) return;
+	for (int i = 0; i < CACHE_ENTRIES; ++i) {
+		if (entries[i].line && entries[i].seq == seq) {
+			entries[i].refs--;
+			return;
+		}
+	}
+	free_cmd_sequence(seq);
+}
+
+const char *parse_cache_exec_path(const Cmd *c) {
+	// PATH may have changed since the lookup, e.g. earlier on the same line
+	if (!c->exec_path || !resolved_path) return NULL;
+	const char *path = vars_get("PATH");
+	return strcmp(path ? path : "", resolved_path) == 0 ? c->exec_path : NULL;
+}
+
+void parse_cache_print_stats(void) {
+	unsigned long lookups = hits + misses;
+	printf("parse cache: %d/%d entries, %lu hits, %lu misses, %.1f%% hit rate\n", entry_count, CACHE_ENTRIES,
+	       hits, misses, lookups ? 100.0 * (double)hits / (double)lookups : 0.0);
+}
@@ -1,18 +1,36 @@
 #include "parser.h"
+#include "lexer.h"
+#include "vars.h"
 
 #include <ctype.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 // A small recursive-descent style validator for the provided grammar.
 // Grammar (whitespace can appear between tokens):
-// shell_cmd  ->  cmd_group ((& | ;) cmd_group)* &?
+// shell_cmd  ->  list
+// list       ->  and_or ((& | ;) and_or)* &?
+// and_or     ->  cmd_group ((&& | ||) cmd_group)*
 // cmd_group  ->  atomic (| atomic)*
-// atomic     ->  name (name | input | output)*
-// input      ->  < name | <name
+// atomic     ->  name (name | redirect)*
+//             |  ( list ;? ) redirect*
+//             |  { list (; | &) } redirect*
+//             |  if list then list (elif list then list)* (else list)? fi redirect*
+//             |  (while | until) list do list done redirect*
+//             |  for name (in name*)? ;? do list done redirect*
+//             |  name ( ) compound      (function definition; compound is
+//                                        any of the forms above but the first)
+// A list inside one of these ends at its closing reserved word, which must
+// follow a ';' or '&' (e.g. "if a; then b; fi").
+// redirect   ->  [n]input | [n]output | [n]>&m | [n]<&m | [n]>&- | &> name | &>> name
+// input      ->  < name | <name | << name | <<- name | <<< name
 // output     ->  > name | >name | >> name | >>name
-// name       ->  r"[^|&><;]+"
+// name       ->  r"[^|&><;()]+"  (quotes '...', "..." and \ escapes may protect
+//                 any of those characters; an unterminated quote is an error;
+//                 $( shell_cmd ) and `shell_cmd` are part of the name, and so
+//                 are <( shell_cmd ) and >( shell_cmd ) at its start)
 
 typedef struct {
 	const char *s;
@@ -25,29 +43,65 @@ static void skip_ws(Parser *p) {
 	}
 }
 
-static bool parse_name(Parser *p) {
-	skip_ws(p);
-	size_t start = p->i;
-	while (p->s[p->i] != '\0') {
-		char c = p->s[p->i];
-		if (c == '|' || c == '&' || c == '>' || c == '<' || c == ';' || c == '\n' || c == '\r' || c == '\t' || c == ' ') {
-			break;
+// The command text of a substitution must itself be a valid line (or blank)
+static bool valid_subst_body(const char *s, size_t len) {
+	char *text = strndup(s, len);
+	if (!text) return false;
+	bool ok = text[strspn(text, " \t\n\r")] == '\0' || parser_is_valid_command(text);
+	free(text);
+	return ok;
+}
+
+bool parser_valid_substitutions(const char *s, size_t i, size_t end) {
+	bool in_dq = false;
+	if (lex_at_proc_subst(s, i)) {
+		size_t close = lex_scan_subst(s, i);
+		if (!valid_subst_body(s + i + 2, close - 1 - (i + 2))) return false;
+		i = close;
+	}
+	while (i < end) {
+		char c = s[i];
+		if (c == '\\') {
+			i += 2;
+		} else if (c == '\'' && !in_dq) {
+			i = (size_t)(strchr(s + i + 1, '\'') - s) + 1;
+		} else if (c == '"') {
+			in_dq = !in_dq;
+			i++;
+		} else if (c == '`' || (c == '$' && s[i + 1] == '(')) {
+			size_t close = lex_scan_subst(s, i);
+			size_t from = i + (c == '`' ? 1 : 2);
+			if (!valid_subst_body(s + from, close - 1 - from)) return false;
+			i = close;
+		} else {
+			i++;
 		}
-		p->i++;
 	}
-	return p->i > start;
+	return true;
 }
 
-static bool parse_input(Parser *p) {
+static bool parse_name(Parser *p) {
 	skip_ws(p);
+	unsigned flags = 0;
+	size_t end = lex_scan_word(p->s, p->i, &flags);
+	if (end == p->i || (flags & LEX_ERROR)) return false;
+	if ((flags & LEX_SUBST) && !parser_valid_substitutions(p->s, p->i, end)) return false;
+	p->i = end;
+	return true;
+}
+
+static bool parse_input(Parser *p) {
 	if (p->s[p->i] != '<') return false;
 	p->i++;
+	if (p->s[p->i] == '<') {
+		p->i++; // << heredoc, <<- with tabs stripped, or <<< here-string
+		if (p->s[p->i] == '<' || p->s[p->i] == '-') p->i++;
+	}
 	// optional whitespace already handled by parse_name
 	return parse_name(p);
 }
 
 static bool parse_output(Parser *p) {
-	skip_ws(p);
 	if (p->s[p->i] != '>') return false;
 	p->i++;
 	if (p->s[p->i] == '>') {
@@ -56,19 +110,139 @@ static bool parse_output(Parser *p) {
 	return parse_name(p);
 }
 
+// [n] is a descriptor number written right against the operator; heredocs and
+// here-strings only take the plain form
+static bool parse_redirect(Parser *p) {
+	skip_ws(p);
+	int fd = -1;
+	size_t op = lex_scan_fd(p->s, p->i, &fd);
+	bool numbered = op != p->i && (p->s[op] == '<' || p->s[op] == '>');
+	if (numbered) p->i = op;
+	char c = p->s[p->i];
+	if (c == '&' && p->s[p->i + 1] == '>' && !numbered) {
+		p->i += 2;
+		if (p->s[p->i] == '>') p->i++;
+		return parse_name(p);
+	}
+	// <(...) and >(...) are words
+	if (lex_at_proc_subst(p->s, p->i)) return false;
+	if ((c == '<' || c == '>') && p->s[p->i + 1] == '&') {
+		p->i += 2;
+		if (p->s[p->i] == '-') p->i++;
+		else {
+			size_t end = lex_scan_fd(p->s, p->i, &fd);
+			if (end == p->i) return false;
+			p->i = end;
+		}
+		return p->s[p->i] == '\0' || lex_is_delim(p->s[p->i]);
+	}
+	if (numbered && c == '<' && p->s[p->i + 1] == '<') return false;
+	size_t at = p->i;
+	if (parse_input(p)) return true;
+	p->i = at;
+	return parse_output(p);
+}
+
+static bool parse_list(Parser *p, const char *close);
+
+// True when the closing token of the enclosing group is next: ')' or one of
+// the space-separated reserved words in close (NULL at the top level)
+static bool at_close(Parser *p, const char *close) {
+	skip_ws(p);
+	if (!close) return false;
+	if (close[0] == ')') return p->s[p->i] == ')';
+	return lex_match_keywords(p->s, p->i, close) != p->i;
+}
+
+static bool expect_keyword(Parser *p, const char *kw) {
+	skip_ws(p);
+	size_t end = lex_match_keyword(p->s, p->i, kw);
+	if (end == p->i) return false;
+	p->i = end;
+	return true;
+}
+
+// After 'if' (or 'elif', which shares the final 'fi')
+static bool parse_if(Parser *p) {
+	if (!parse_list(p, "then") || !expect_keyword(p, "then") || !parse_list(p, "elif else fi")) return false;
+	if (expect_keyword(p, "elif")) return parse_if(p);
+	if (expect_keyword(p, "else") && !parse_list(p, "fi")) return false;
+	return expect_keyword(p, "fi");
+}
+
+// After 'for': the variable, an optional word list, then the body
+static bool parse_for(Parser *p) {
+	skip_ws(p);
+	unsigned flags = 0;
+	size_t end = lex_scan_word(p->s, p->i, &flags);
+	if (end == p->i || flags != 0 || !vars_is_valid_name(p->s + p->i, end - p->i)) return false;
+	p->i = end;
+	if (expect_keyword(p, "in")) {
+		for (;;) {
+			size_t save = p->i;
+			if (parse_name(p)) continue;
+			p->i = save;
+			break;
+		}
+	}
+	skip_ws(p);
+	if (p->s[p->i] == ';') p->i++;
+	return expect_keyword(p, "do") && parse_list(p, "done") && expect_keyword(p, "done");
+}
+
+static bool parse_compound(Parser *p) {
+	const char *s = p->s;
+	size_t at = p->i, end;
+	bool ok;
+	if (s[at] == '(') {
+		p->i++;
+		ok = parse_list(p, ")") && at_close(p, ")");
+		p->i++;
+	} else if ((end = lex_match_keyword(s, at, "{")) != at) {
+		p->i = end;
+		ok = parse_list(p, "}") && expect_keyword(p, "}");
+	} else if ((end = lex_match_keyword(s, at, "if")) != at) {
+		p->i = end;
+		ok = parse_if(p);
+	} else if ((end = lex_match_keywords(s, at, "while until")) != at) {
+		p->i = end;
+		ok = parse_list(p, "do") && expect_keyword(p, "do") && parse_list(p, "done") && expect_keyword(p, "done");
+	} else if ((end = lex_match_keyword(s, at, "for")) != at) {
+		p->i = end;
+		ok = parse_for(p);
+	} else {
+		return false;
+	}
+	if (!ok) return false;
+	for (;;) {
+		size_t save = p->i;
+		if (parse_redirect(p)) continue;
+		p->i = save;
+		break;
+	}
+	return true;
+}
+
 static bool parse_atomic(Parser *p) {
+	skip_ws(p);
+	if (lex_starts_compound(p->s, p->i)) return parse_compound(p);
+	if (lex_match_keywords(p->s, p->i, LEX_CLOSING_WORDS) != p->i) return false; // ends a list
+	size_t def = lex_match_funcdef(p->s, p->i);
+	if (def != p->i) {
+		p->i = def;
+		skip_ws(p);
+		if (!lex_starts_compound(p->s, p->i)) return false;
+		return parse_compound(p);
+	}
 	if (!parse_name(p)) return false; // command name
 	for (;;) {
 		size_t save = p->i;
-		if (parse_name(p)) {
+		// Redirections first: '2' in "2>file" would otherwise scan as a name
+		if (parse_redirect(p)) {
 			continue;
 		}
 		p->i = save;
-		if (parse_input(p)) {
-			continue;
-		}
-		p->i = save;
-		if (parse_output(p)) {
+		if (parse_name(p)) {
 			continue;
 		}
 		p->i = save;
@@ -82,7 +256,7 @@ static bool parse_cmd_group(Parser *p) {
 	for (;;) {
 		size_t save = p->i;
 		skip_ws(p);
-		if (p->s[p->i] == '|') {
+		if (p->s[p->i] == '|' && p->s[p->i + 1] != '|') {
 			p->i++;
 			if (!parse_atomic(p)) return false;
 			continue;
@@ -93,30 +267,49 @@ static bool parse_cmd_group(Parser *p) {
 	return true;
 }
 
-static bool parse_shell_cmd(Parser *p) {
+// An operator only joins two groups when a group follows it; otherwise the
+// '&&' falls back to the background-marker reading below ("a && ; b").
+static bool parse_and_or(Parser *p) {
 	if (!parse_cmd_group(p)) return false;
 	for (;;) {
+		size_t save = p->i;
+		skip_ws(p);
+		char c = p->s[p->i];
+		if ((c == '&' || c == '|') && p->s[p->i + 1] == c) {
+			p->i += 2;
+			if (parse_cmd_group(p)) continue;
+		}
+		p->i = save;
+		break;
+	}
+	return true;
+}
+
+// Inside a group (close != NULL) the last and_or may also be followed by ';'
+static bool parse_list(Parser *p, const char *close) {
+	for (;;) {
+		if (!parse_and_or(p)) return false;
 		size_t save = p->i;
 		// Allow one or more '&' between groups (for background marker), then an optional ';'
+		bool saw_amp = false;
 		for (;;) {
 			skip_ws(p);
-			if (p->s[p->i] == '&') { p->i++; continue; }
+			if (p->s[p->i] == '&') { saw_amp = true; p->i++; continue; }
 			break;
 		}
-		skip_ws(p);
 		if (p->s[p->i] == ';') {
 			p->i++;
-			if (!parse_cmd_group(p)) return false;
+			if (at_close(p, close)) return true;
 			continue;
 		}
-		p->i = save;
-		break;
+		// Optional trailing &
+		if (!saw_amp) p->i = save;
+		return true;
 	}
+}
 
-	// Optional trailing &
-	skip_ws(p);
-	while (p->s[p->i] == '&') { p->i++; }
-
+static bool parse_shell_cmd(Parser *p) {
+	if (!parse_list(p, NULL)) return false;
 	// must consume all input (ignoring whitespace)
 	skip_ws(p);
 	return p->s[p->i] == '\0';
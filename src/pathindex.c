@@ -0,0 +1,289 @@
+#include "pathindex.h"
+#include "vars.h"
+#include "wildcard.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// ---- Trie ----
+// Nodes live in one growable array; children form a sibling list sorted by
+// byte, so a depth-first walk yields names in strcmp order. A name can come
+// from several PATH directories, so ends are reference counted, and 'below'
+// lets lookups skip subtrees whose names have all been removed.
+
+typedef struct {
+	unsigned char byte;
+	uint32_t child;    // first child, 0 if none
+	uint32_t sibling;  // next sibling, 0 if none
+	uint32_t terminal; // directories providing the name that ends here
+	uint32_t below;    // names ending at or below this node
+} TrieNode;
+
+static TrieNode *nodes = NULL;
+static uint32_t node_count = 0;
+static uint32_t node_cap = 0;
+
+static uint32_t node_new(unsigned char byte) {
+	if (node_count == node_cap) {
+		uint32_t ncap = node_cap ? node_cap * 2 : 1024;
+		TrieNode *nn = (TrieNode *)realloc(nodes, ncap * sizeof(TrieNode));
+		if (!nn) return 0;
+		nodes = nn;
+		node_cap = ncap;
+	}
+	TrieNode *n = &nodes[node_count];
+	memset(n, 0, sizeof(*n));
+	n->byte = byte;
+	return node_count++;
+}
+
+// Child of parent for byte, created in sorted position when create is set
+static uint32_t node_child(uint32_t parent, unsigned char byte, bool create) {
+	uint32_t prev = 0, cur = nodes[parent].child;
+	while (cur && nodes[cur].byte < byte) {
+		prev = cur;
+		cur = nodes[cur].sibling;
+	}
+	if (cur && nodes[cur].byte == byte) return cur;
+	if (!create) return 0;
+	uint32_t n = node_new(byte);
+	if (!n) return 0;
+	nodes[n].sibling = cur;
+	if (prev) nodes[prev].sibling = n;
+	else nodes[parent].child = n;
+	return n;
+}
+
+static void trie_add(const char *name, int delta) {
+	if (node_count == 0) node_new(0); // node 0 is the root
+	if (node_count == 0) return;
+	uint32_t path[NAME_MAX + 1];
+	size_t depth = 0;
+	uint32_t cur = 0;
+	path[depth++] = cur;
+	for (const char *p = name; *p && depth <= NAME_MAX; ++p) {
+		cur = node_child(cur, (unsigned char)*p, delta > 0);
+		if (!cur) return;
+		path[depth++] = cur;
+	}
+	if (delta < 0 && nodes[cur].terminal == 0) return;
+	nodes[cur].terminal += (uint32_t)delta;
+	for (size_t i = 0; i < depth; ++i) nodes[path[i]].below += (uint32_t)delta;
+}
+
+// ---- PATH directories ----
+
+typedef struct {
+	char *path;        // with a trailing '/'
+	bool scanned;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char *names;       // packed NUL-terminated executable names
+	size_t names_len;
+} PathDir;
+
+static PathDir *dirs = NULL;
+static size_t dir_count = 0;
+static char *indexed_path = NULL; // PATH value the directory list was built from
+
+static void dir_forget(PathDir *d) {
+	for (size_t off = 0; off < d->names_len; off += strlen(d->names + off) + 1) {
+		trie_add(d->names + off, -1);
+	}
+	free(d->names);
+	d->names = NULL;
+	d->names_len = 0;
+	d->scanned = false;
+}
+
+// A rescan merges the new (sorted) listing with the previous names, which were
+// stored in the same order: unchanged names are kept without touching the trie
+// or re-checking permissions, so only added and removed entries cost anything.
+typedef struct {
+	const char *old;   // previous packed names
+	size_t old_len;
+	size_t old_off;
+	char *names;       // new packed names
+	size_t names_len;
+	size_t cap;
+	char full[PATH_MAX];
+	size_t dlen;
+} ScanState;
+
+static bool keep_name(ScanState *ss, const char *name, size_t len) {
+	if (ss->names_len + len + 1 > ss->cap) {
+		size_t ncap = ss->cap ? ss->cap * 2 : 4096;
+		while (ncap < ss->names_len + len + 1) ncap *= 2;
+		char *nn = (char *)realloc(ss->names, ncap);
+		if (!nn) return false;
+		ss->names = nn;
+		ss->cap = ncap;
+	}
+	memcpy(ss->names + ss->names_len, name, len + 1);
+	ss->names_len += len + 1;
+	return true;
+}
+
+static int scan_entry(void *ctx, const char *name, size_t len, bool is_dir) {
+	ScanState *ss = (ScanState *)ctx;
+	if (is_dir) return 0;
+	int cmp = 1;
+	while (ss->old_off < ss->old_len) {
+		const char *old = ss->old + ss->old_off;
+		cmp = strcmp(old, name);
+		if (cmp >= 0) break;
+		trie_add(old, -1);
+		ss->old_off += strlen(old) + 1;
+	}
+	if (ss->old_off < ss->old_len && cmp == 0) {
+		ss->old_off += len + 1;
+		return keep_name(ss, name, len) ? 0 : 1;
+	}
+	if (ss->dlen + len >= sizeof(ss->full)) return 0;
+	memcpy(ss->full + ss->dlen, name, len + 1);
+	if (faccessat(AT_FDCWD, ss->full, X_OK, 0) != 0) return 0;
+	if (!keep_name(ss, name, len)) return 1;
+	trie_add(name, 1);
+	return 0;
+}
+
+static void dir_scan(PathDir *d, const struct stat *st) {
+	ScanState ss;
+	memset(&ss, 0, sizeof(ss));
+	ss.old = d->names;
+	ss.old_len = d->names_len;
+	ss.dlen = strlen(d->path);
+	if (ss.dlen >= sizeof(ss.full)) return;
+	memcpy(ss.full, d->path, ss.dlen + 1);
+	if (wildcard_list_dir(d->path, "", 0, scan_entry, &ss) < 0) {
+		free(ss.names);
+		dir_forget(d);
+		return;
+	}
+	// Whatever is left of the old list no longer exists
+	while (ss.old_off < ss.old_len) {
+		trie_add(ss.old + ss.old_off, -1);
+		ss.old_off += strlen(ss.old + ss.old_off) + 1;
+	}
+	free(d->names);
+	d->names = ss.names;
+	d->names_len = ss.names_len;
+	d->scanned = true;
+	d->dev = st->st_dev;
+	d->ino = st->st_ino;
+	d->mtime = st->st_mtim;
+}
+
+// Re-split PATH, keeping the state of directories that are still listed
+static void rebuild_dir_list(const char *path) {
+	size_t max = 1;
+	for (const char *p = path; *p; ++p) if (*p == ':') max++;
+	PathDir *nd = (PathDir *)calloc(max, sizeof(PathDir));
+	if (!nd) return;
+	size_t n = 0;
+	const char *p = path;
+	for (;;) {
+		size_t len = strcspn(p, ":");
+		// Empty entries mean the cwd; completion does not offer those
+		if (len > 0) {
+			char *dir = (char *)malloc(len + 2);
+			if (dir) {
+				size_t dlen = len;
+				memcpy(dir, p, len);
+				if (dir[dlen - 1] != '/') dir[dlen++] = '/';
+				dir[dlen] = '\0';
+				bool dup = false;
+				for (size_t i = 0; i < n && !dup; ++i) dup = strcmp(nd[i].path, dir) == 0;
+				for (size_t i = 0; i < dir_count && !dup; ++i) {
+					if (dirs[i].path && strcmp(dirs[i].path, dir) == 0) {
+						nd[n++] = dirs[i];
+						dirs[i].path = NULL;
+						free(dir);
+						dir = NULL;
+						break;
+					}
+				}
+				if (dup) free(dir);
+				else if (dir) nd[n++].path = dir;
+			}
+		}
+		p += len;
+		if (*p == '\0') break;
+		p++;
+	}
+	for (size_t i = 0; i < dir_count; ++i) {
+		if (!dirs[i].path) continue;
+		dir_forget(&dirs[i]);
+		free(dirs[i].path);
+	}
+	free(dirs);
+	dirs = nd;
+	dir_count = n;
+	free(indexed_path);
+	indexed_path = strdup(path);
+}
+
+static void path_index_refresh(void) {
+	const char *path = vars_get("PATH");
+	if (!path) path = "";
+	if (!indexed_path || strcmp(indexed_path, path) != 0) rebuild_dir_list(path);
+	for (size_t i = 0; i < dir_count; ++i) {
+		PathDir *d = &dirs[i];
+		struct stat st;
+		if (stat(d->path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+			if (d->scanned) dir_forget(d);
+			continue;
+		}
+		if (d->scanned && st.st_dev == d->dev && st.st_ino == d->ino &&
+		    st.st_mtim.tv_sec == d->mtime.tv_sec && st.st_mtim.tv_nsec == d->mtime.tv_nsec) continue;
+		dir_scan(d, &st);
+	}
+}
+
+typedef struct {
+	PathIndexEmit emit;
+	void *ctx;
+	char name[NAME_MAX + 1];
+	int count;
+	bool stop;
+} WalkState;
+
+static void walk(WalkState *ws, uint32_t node, size_t depth) {
+	if (nodes[node].terminal > 0) {
+		ws->count++;
+		if (ws->emit(ws->ctx, ws->name, depth) != 0) { ws->stop = true; return; }
+	}
+	for (uint32_t c = nodes[node].child; c && !ws->stop; c = nodes[c].sibling) {
+		if (nodes[c].below == 0 || depth >= NAME_MAX) continue;
+		ws->name[depth] = (char)nodes[c].byte;
+		ws->name[depth + 1] = '\0';
+		walk(ws, c, depth + 1);
+	}
+}
+
+int path_index_complete(const char *prefix, size_t len, PathIndexEmit emit, void *ctx) {
+	path_index_refresh();
+	if (node_count == 0 || len > NAME_MAX) return 0;
+	uint32_t cur = 0;
+	for (size_t i = 0; i < len; ++i) {
+		cur = node_child(cur, (unsigned char)prefix[i], false);
+		if (!cur) return 0;
+	}
+	if (nodes[cur].below == 0) return 0;
+	WalkState ws;
+	ws.emit = emit;
+	ws.ctx = ctx;
+	ws.count = 0;
+	ws.stop = false;
+	memcpy(ws.name, prefix, len);
+	ws.name[len] = '\0';
+	walk(&ws, cur, len);
+	return ws.count;
+}
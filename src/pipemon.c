@@ -0,0 +1,234 @@
+#define _GNU_SOURCE // splice()
+
+#include "pipemon.h"
+#include "events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+// Most bytes one splice() asks for, and most splices per wakeup so one busy
+// link cannot keep the shell from everything else
+#define RELAY_CHUNK (1 << 20)
+#define RELAY_BURST 16
+
+typedef enum {
+	LINK_FLOWING,
+	LINK_EMPTY,  // nothing to pass on: waiting for the upstream stage to write
+	LINK_FULL,   // downstream pipe full: waiting for the next stage to read
+	LINK_CLOSED
+} LinkState;
+
+typedef struct {
+	int up;
+	int down;
+	char *from;
+	char *to;
+	LinkState state;
+	long long since_us;     // when state was entered
+	long long end_us;       // when the link closed
+	long long bytes;
+	long long empty_us;
+	long long full_us;
+	long long sample_bytes; // as of the previous pipemon_print_rates()
+	long long sample_us;
+} PipeLink;
+
+struct PipeMon {
+	PipeLink **links; // each one is its fds' events argument, so it must not move
+	int count;
+	int cap;
+	long long start_us;
+};
+
+static long long now_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void link_enter(PipeLink *l, LinkState state) {
+	if (l->state == state) return;
+	long long now = now_us();
+	if (l->state == LINK_EMPTY) l->empty_us += now - l->since_us;
+	else if (l->state == LINK_FULL) l->full_us += now - l->since_us;
+	if (state == LINK_CLOSED) l->end_us = now;
+	l->state = state;
+	l->since_us = now;
+}
+
+static void link_close(PipeLink *l) {
+	if (l->up >= 0) {
+		events_fd_unwatch(l->up);
+		close(l->up);
+		l->up = -1;
+	}
+	if (l->down >= 0) {
+		events_fd_unwatch(l->down);
+		close(l->down);
+		l->down = -1;
+	}
+	link_enter(l, LINK_CLOSED);
+}
+
+static void link_relay(PipeLink *l) {
+	for (int burst = 0; burst < RELAY_BURST; ++burst) {
+		ssize_t r = splice(l->up, NULL, l->down, NULL, RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (r > 0) {
+			l->bytes += r;
+			link_enter(l, LINK_FLOWING);
+			continue;
+		}
+		if (r < 0 && errno == EINTR) continue;
+		if (r < 0 && errno == EAGAIN) {
+			// Either side may be the one that is not ready
+			int avail = 0;
+			bool full = ioctl(l->up, FIONREAD, &avail) == 0 && avail > 0;
+			link_enter(l, full ? LINK_FULL : LINK_EMPTY);
+			events_fd_modify(l->up, full ? 0 : POLLIN);
+			events_fd_modify(l->down, full ? POLLOUT : 0);
+			return;
+		}
+		// End of the upstream stage's output, or the downstream one is gone (EPIPE)
+		link_close(l);
+		return;
+	}
+}
+
+static void link_ready(int fd, short revents, void *arg) {
+	PipeLink *l = (PipeLink *)arg;
+	if (revents & POLLNVAL) {
+		// Closed under us (in a forked child): forget it without closing again
+		events_fd_unwatch(fd);
+		if (fd == l->up) l->up = -1;
+		if (fd == l->down) l->down = -1;
+		l->state = LINK_CLOSED;
+		return;
+	}
+	// POLLERR on the write end: the downstream stage closed its input, so the
+	// upstream one is to get SIGPIPE as it would without the relay
+	if (fd == l->down && (revents & POLLERR)) {
+		link_close(l);
+		return;
+	}
+	link_relay(l);
+}
+
+PipeMon *pipemon_new(void) {
+	PipeMon *mon = (PipeMon *)calloc(1, sizeof(PipeMon));
+	if (mon) mon->start_us = now_us();
+	return mon;
+}
+
+int pipemon_add_link(PipeMon *mon, int upstream, int downstream, const char *from, const char *to) {
+	if (mon->count == mon->cap) {
+		int ncap = mon->cap ? mon->cap * 2 : 4;
+		PipeLink **tmp = (PipeLink **)realloc(mon->links, (size_t)ncap * sizeof(*tmp));
+		if (!tmp) return -1;
+		mon->links = tmp;
+		mon->cap = ncap;
+	}
+	PipeLink *l = (PipeLink *)calloc(1, sizeof(PipeLink));
+	if (!l) return -1;
+	l->from = strdup(from);
+	l->to = strdup(to);
+	if (!l->from || !l->to || events_fd_watch(upstream, POLLIN, link_ready, l) != 0) {
+		free(l->from);
+		free(l->to);
+		free(l);
+		return -1;
+	}
+	if (events_fd_watch(downstream, 0, link_ready, l) != 0) {
+		events_fd_unwatch(upstream);
+		free(l->from);
+		free(l->to);
+		free(l);
+		return -1;
+	}
+	// Only the shell holds these ends
+	fcntl(upstream, F_SETFL, fcntl(upstream, F_GETFL) | O_NONBLOCK);
+	fcntl(downstream, F_SETFL, fcntl(downstream, F_GETFL) | O_NONBLOCK);
+	l->up = upstream;
+	l->down = downstream;
+	l->state = LINK_EMPTY;
+	l->since_us = mon->start_us;
+	l->sample_us = mon->start_us;
+	mon->links[mon->count++] = l;
+	return 0;
+}
+
+static void format_bytes(char *buf, size_t size, double bytes) {
+	const char *units = "BKMGT";
+	int u = 0;
+	while (bytes >= 1024.0 && u < 4) {
+		bytes /= 1024.0;
+		u++;
+	}
+	if (u == 0) snprintf(buf, size, "%.0fB", bytes);
+	else snprintf(buf, size, "%.1f%c", bytes, units[u]);
+}
+
+// Stall times including the state the link is in right now
+static void link_stalls(const PipeLink *l, long long now, long long *full, long long *empty) {
+	*full = l->full_us;
+	*empty = l->empty_us;
+	if (l->state == LINK_FULL) *full += now - l->since_us;
+	else if (l->state == LINK_EMPTY) *empty += now - l->since_us;
+}
+
+void pipemon_print_rates(PipeMon *mon, const char *indent) {
+	long long now = now_us();
+	for (int i = 0; i < mon->count; ++i) {
+		PipeLink *l = mon->links[i];
+		long long until = l->state == LINK_CLOSED ? l->end_us : now;
+		long long span = until - l->sample_us;
+		char rate[32], total[32];
+		format_bytes(rate, sizeof(rate), span > 0 ? (double)(l->bytes - l->sample_bytes) * 1e6 / (double)span : 0.0);
+		format_bytes(total, sizeof(total), (double)l->bytes);
+		long long full, empty;
+		link_stalls(l, until, &full, &empty);
+		long long life = until - mon->start_us;
+		if (life <= 0) life = 1;
+		printf("%s%s -> %s: %s/s, %s so far, full %d%%, empty %d%%%s\n", indent, l->from, l->to, rate, total,
+		       (int)(full * 100 / life), (int)(empty * 100 / life), l->state == LINK_CLOSED ? " (closed)" : "");
+		l->sample_bytes = l->bytes;
+		l->sample_us = until;
+	}
+}
+
+void pipemon_finish(PipeMon *mon) {
+	for (int i = 0; i < mon->count; ++i) {
+		PipeLink *l = mon->links[i];
+		if (l->state != LINK_CLOSED) link_relay(l);
+		if (l->state != LINK_CLOSED) link_close(l);
+	}
+	// Next to the pipeline's own diagnostics, not into its captured output
+	for (int i = 0; i < mon->count; ++i) {
+		const PipeLink *l = mon->links[i];
+		double secs = (double)(l->end_us - mon->start_us) / 1e6;
+		char total[32], rate[32];
+		format_bytes(total, sizeof(total), (double)l->bytes);
+		format_bytes(rate, sizeof(rate), secs > 0 ? (double)l->bytes / secs : 0.0);
+		fprintf(stderr, "pipemon: %s -> %s: %s in %.2fs (%s/s), full %.2fs, empty %.2fs\n", l->from, l->to, total,
+		        secs, rate, (double)l->full_us / 1e6, (double)l->empty_us / 1e6);
+	}
+}
+
+void pipemon_free(PipeMon *mon) {
+	if (!mon) return;
+	for (int i = 0; i < mon->count; ++i) {
+		PipeLink *l = mon->links[i];
+		link_close(l);
+		free(l->from);
+		free(l->to);
+		free(l);
+	}
+	free(mon->links);
+	free(mon);
+}
@@ -0,0 +1,118 @@
+#define _GNU_SOURCE // CLOCK_BOOTTIME
+
+#include "procstat.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// One process being followed: its open stat file and the previous sample
+typedef struct {
+	pid_t pid;
+	int fd;
+	unsigned long long ticks; // utime + stime at the previous sample
+	double at;                // CLOCK_BOOTTIME seconds of the previous sample
+	bool seen;                // sampled since the last sweep
+} StatEntry;
+
+static StatEntry *entries = NULL;
+static int entry_count = 0;
+static int entry_cap = 0;
+
+static double boottime_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_BOOTTIME, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void entry_remove(int i) {
+	close(entries[i].fd);
+	entries[i] = entries[--entry_count];
+}
+
+static StatEntry *entry_get(pid_t pid) {
+	for (int i = 0; i < entry_count; ++i) {
+		if (entries[i].pid == pid) return &entries[i];
+	}
+	if (entry_count == entry_cap) {
+		int ncap = entry_cap ? entry_cap * 2 : 16;
+		StatEntry *tmp = (StatEntry *)realloc(entries, (size_t)ncap * sizeof(StatEntry));
+		if (!tmp) return NULL;
+		entries = tmp;
+		entry_cap = ncap;
+	}
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return NULL;
+	entries[entry_count] = (StatEntry){ pid, fd, 0, 0.0, false };
+	return &entries[entry_count++];
+}
+
+bool procstat_sample(pid_t pid, ProcSample *out) {
+	static long hz = 0, page_kb = 0;
+	if (hz == 0) {
+		hz = sysconf(_SC_CLK_TCK);
+		page_kb = sysconf(_SC_PAGESIZE) / 1024;
+		if (hz <= 0) hz = 100;
+		if (page_kb <= 0) page_kb = 4;
+	}
+	StatEntry *e = entry_get(pid);
+	if (!e) return false;
+	char buf[1024];
+	// Reading the stat fd of a process that has exited fails with ESRCH, so a
+	// reused pid is never mistaken for the old process
+	ssize_t n = pread(e->fd, buf, sizeof(buf) - 1, 0);
+	if (n <= 0) {
+		entry_remove((int)(e - entries));
+		return false;
+	}
+	buf[n] = '\0';
+	// comm may hold spaces and parentheses; the fields resume after the last ')'
+	char *open_paren = strchr(buf, '(');
+	char *close_paren = strrchr(buf, ')');
+	if (!open_paren || !close_paren || close_paren < open_paren) return false;
+	char state;
+	unsigned long long utime, stime, starttime;
+	long threads, rss;
+	if (sscanf(close_paren + 2,
+	           "%c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %ld %*d %llu %*u %ld",
+	           &state, &utime, &stime, &threads, &starttime, &rss) != 6) {
+		return false;
+	}
+	memset(out, 0, sizeof(*out));
+	out->pid = pid;
+	size_t clen = (size_t)(close_paren - open_paren - 1);
+	if (clen >= sizeof(out->comm)) clen = sizeof(out->comm) - 1;
+	memcpy(out->comm, open_paren + 1, clen);
+	out->state = state;
+	out->threads = (int)threads;
+	out->rss_kb = rss * page_kb;
+
+	double now = boottime_now();
+	unsigned long long ticks = utime + stime;
+	out->elapsed = now - (double)starttime / (double)hz;
+	if (out->elapsed < 0) out->elapsed = 0;
+	// First look: the average over its life so far
+	double since = e->at > 0 ? now - e->at : out->elapsed;
+	unsigned long long used = e->at > 0 && ticks >= e->ticks ? ticks - e->ticks : ticks;
+	out->cpu_percent = since > 0 ? (double)used / (double)hz / since * 100.0 : 0.0;
+	e->ticks = ticks;
+	e->at = now;
+	e->seen = true;
+	return true;
+}
+
+void procstat_sweep(void) {
+	for (int i = 0; i < entry_count; ++i) {
+		if (!entries[i].seen) {
+			entry_remove(i);
+			i--;
+			continue;
+		}
+		entries[i].seen = false;
+	}
+}
@@ -31,7 +31,7 @@ static void get_user_host(char *user, size_t user_sz, char *host, size_t host_sz
 	}
 }
 
-void show_prompt(void) {
+void prompt_format(char *out, size_t out_sz) {
 	char cwd[PATH_MAX];
 	if (!getcwd(cwd, sizeof(cwd))) {
 		strncpy(cwd, "?", sizeof(cwd) - 1);
@@ -61,7 +61,13 @@ void show_prompt(void) {
 	char user[128], host[128];
 	get_user_host(user, sizeof(user), host, sizeof(host));
 
-	printf("<%s@%s:%s> ", user, host, display_path);
+	snprintf(out, out_sz, "<%s@%s:%s> ", user, host, display_path);
+}
+
+void show_prompt(void) {
+	char prompt[PROMPT_MAX];
+	prompt_format(prompt, sizeof(prompt));
+	fputs(prompt, stdout);
 	fflush(stdout);
 }
 
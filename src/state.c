@@ -6,6 +6,14 @@
 
 static char home_dir[PATH_MAX] = {0};
 static char prev_cwd[PATH_MAX] = {0};
+static int last_status = 0;
+static bool pipefail = false;
+static bool pipemon = false;
+static int pipe_size = 0;
+static int max_jobs = 0;
+static double max_load = 0.0;
+static long long min_mem = 0;
+static int job_priority = 1; // JOB_PRIO_NORMAL
 
 void state_init(void) {
 	if (getcwd(home_dir, sizeof(home_dir)) == NULL) {
@@ -29,5 +37,66 @@ void state_set_prev_cwd(const char *path) {
 	prev_cwd[sizeof(prev_cwd) - 1] = '\0';
 }
 
+int state_get_last_status(void) {
+	return last_status;
+}
+
+void state_set_last_status(int status) {
+	last_status = status;
+}
+
+bool state_get_pipefail(void) {
+	return pipefail;
+}
+
+void state_set_pipefail(bool on) {
+	pipefail = on;
+}
 
+bool state_get_pipemon(void) {
+	return pipemon;
+}
 
+void state_set_pipemon(bool on) {
+	pipemon = on;
+}
+
+int state_get_pipe_size(void) {
+	return pipe_size;
+}
+
+void state_set_pipe_size(int bytes) {
+	pipe_size = bytes;
+}
+
+int state_get_max_jobs(void) {
+	return max_jobs;
+}
+
+void state_set_max_jobs(int n) {
+	max_jobs = n;
+}
+
+double state_get_max_load(void) {
+	return max_load;
+}
+
+void state_set_max_load(double load) {
+	max_load = load;
+}
+
+long long state_get_min_mem(void) {
+	return min_mem;
+}
+
+void state_set_min_mem(long long bytes) {
+	min_mem = bytes;
+}
+
+int state_get_job_priority(void) {
+	return job_priority;
+}
+
+void state_set_job_priority(int level) {
+	job_priority = level;
+}
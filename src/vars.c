@@ -0,0 +1,223 @@
+#include "vars.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+extern char **environ;
+
+typedef struct Var {
+	char *name;
+	char *value;
+	char *env_entry;  // cached "NAME=value" for the packed envp, NULL until needed
+	bool exported;
+	struct Var *next;
+} Var;
+
+#define VARS_INITIAL_BUCKETS 64
+
+static Var **buckets = NULL;
+static size_t bucket_count = 0;
+static size_t var_count = 0;
+
+static char **envp_cache = NULL;
+static bool envp_dirty = true;
+
+static uint64_t hash_name(const char *s, size_t len) {
+	uint64_t h = 1469598103934665603ULL;
+	for (size_t i = 0; i < len; ++i) { h ^= (unsigned char)s[i]; h *= 1099511628211ULL; }
+	return h;
+}
+
+static void rehash(size_t ncount) {
+	Var **nb = (Var **)calloc(ncount, sizeof(Var *));
+	if (!nb) return;
+	for (size_t i = 0; i < bucket_count; ++i) {
+		Var *v = buckets[i];
+		while (v) {
+			Var *next = v->next;
+			size_t b = (size_t)hash_name(v->name, strlen(v->name)) & (ncount - 1);
+			v->next = nb[b];
+			nb[b] = v;
+			v = next;
+		}
+	}
+	free(buckets);
+	buckets = nb;
+	bucket_count = ncount;
+}
+
+static Var *lookup(const char *name, size_t len) {
+	if (!buckets) return NULL;
+	size_t b = (size_t)hash_name(name, len) & (bucket_count - 1);
+	for (Var *v = buckets[b]; v; v = v->next) {
+		if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0') return v;
+	}
+	return NULL;
+}
+
+static Var *lookup_or_create(const char *name, size_t len) {
+	Var *v = lookup(name, len);
+	if (v) return v;
+	if (!buckets) rehash(VARS_INITIAL_BUCKETS);
+	else if (var_count + 1 > bucket_count) rehash(bucket_count * 2);
+	if (!buckets) return NULL;
+	v = (Var *)calloc(1, sizeof(Var));
+	if (!v) return NULL;
+	v->name = strndup(name, len);
+	if (!v->name) { free(v); return NULL; }
+	size_t b = (size_t)hash_name(name, len) & (bucket_count - 1);
+	v->next = buckets[b];
+	buckets[b] = v;
+	var_count++;
+	return v;
+}
+
+static int assign(Var *v, const char *value) {
+	char *nv = strdup(value ? value : "");
+	if (!nv) return -1;
+	free(v->value);
+	v->value = nv;
+	free(v->env_entry);
+	v->env_entry = NULL;
+	if (v->exported) envp_dirty = true;
+	return 0;
+}
+
+void vars_init(void) {
+	for (char **e = environ; e && *e; ++e) {
+		const char *eq = strchr(*e, '=');
+		if (!eq || eq == *e) continue;
+		Var *v = lookup_or_create(*e, (size_t)(eq - *e));
+		if (!v) continue;
+		v->exported = true;
+		assign(v, eq + 1);
+	}
+	envp_dirty = true;
+}
+
+bool vars_is_valid_name(const char *s, size_t len) {
+	if (len == 0) return false;
+	if (!(s[0] == '_' || (s[0] >= 'A' && s[0] <= 'Z') || (s[0] >= 'a' && s[0] <= 'z'))) return false;
+	for (size_t i = 1; i < len; ++i) {
+		char c = s[i];
+		if (!(c == '_' || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))) return false;
+	}
+	return true;
+}
+
+const char *vars_get_n(const char *name, size_t len) {
+	Var *v = lookup(name, len);
+	return v ? v->value : NULL;
+}
+
+const char *vars_get(const char *name) {
+	return vars_get_n(name, strlen(name));
+}
+
+int vars_set(const char *name, const char *value) {
+	size_t len = strlen(name);
+	if (!vars_is_valid_name(name, len)) return -1;
+	Var *v = lookup_or_create(name, len);
+	if (!v) return -1;
+	return assign(v, value);
+}
+
+int vars_assign(const char *assignment) {
+	const char *eq = strchr(assignment, '=');
+	if (!eq || !vars_is_valid_name(assignment, (size_t)(eq - assignment))) return -1;
+	Var *v = lookup_or_create(assignment, (size_t)(eq - assignment));
+	if (!v) return -1;
+	return assign(v, eq + 1);
+}
+
+int vars_export(const char *name, const char *value) {
+	size_t len = strlen(name);
+	if (!vars_is_valid_name(name, len)) return -1;
+	Var *v = lookup_or_create(name, len);
+	if (!v) return -1;
+	if (value || !v->value) {
+		if (assign(v, value) != 0) return -1;
+	}
+	if (!v->exported) {
+		v->exported = true;
+		envp_dirty = true;
+	}
+	return 0;
+}
+
+static char *env_entry(Var *v) {
+	if (!v->env_entry) {
+		size_t nl = strlen(v->name), vl = strlen(v->value);
+		v->env_entry = (char *)malloc(nl + vl + 2);
+		if (!v->env_entry) return NULL;
+		memcpy(v->env_entry, v->name, nl);
+		v->env_entry[nl] = '=';
+		memcpy(v->env_entry + nl + 1, v->value, vl + 1);
+	}
+	return v->env_entry;
+}
+
+char **vars_environ(void) {
+	if (!envp_dirty && envp_cache) return envp_cache;
+	size_t n = 0;
+	for (size_t i = 0; i < bucket_count; ++i) {
+		for (Var *v = buckets[i]; v; v = v->next) if (v->exported) n++;
+	}
+	char **envp = (char **)malloc((n + 1) * sizeof(char *));
+	if (!envp) return envp_cache ? envp_cache : environ;
+	size_t k = 0;
+	for (size_t i = 0; i < bucket_count; ++i) {
+		for (Var *v = buckets[i]; v; v = v->next) {
+			if (!v->exported) continue;
+			char *entry = env_entry(v);
+			if (entry) envp[k++] = entry;
+		}
+	}
+	envp[k] = NULL;
+	// Entry strings are owned by the variables; only the pointer block is replaced
+	free(envp_cache);
+	envp_cache = envp;
+	envp_dirty = false;
+	return envp_cache;
+}
+
+char **vars_environ_with(char *const *overrides, int count) {
+	char **base = vars_environ();
+	if (count <= 0) return base;
+	size_t n = 0;
+	while (base[n]) n++;
+	char **envp = (char **)malloc((n + (size_t)count + 1) * sizeof(char *));
+	if (!envp) return base;
+	memcpy(envp, base, n * sizeof(char *));
+	for (int i = 0; i < count; ++i) {
+		size_t nl = strcspn(overrides[i], "=");
+		size_t j = 0;
+		for (; j < n; ++j) {
+			if (strncmp(envp[j], overrides[i], nl + 1) == 0) break;
+		}
+		envp[j] = overrides[i];
+		if (j == n) n++;
+	}
+	envp[n] = NULL;
+	return envp;
+}
+
+static int compare_var_names(const void *a, const void *b) {
+	const Var *const *va = (const Var *const *)a;
+	const Var *const *vb = (const Var *const *)b;
+	return strcmp((*va)->name, (*vb)->name);
+}
+
+void vars_print_exported(void) {
+	Var **list = (Var **)malloc((var_count ? var_count : 1) * sizeof(Var *));
+	if (!list) return;
+	size_t n = 0;
+	for (size_t i = 0; i < bucket_count; ++i) {
+		for (Var *v = buckets[i]; v; v = v->next) if (v->exported) list[n++] = v;
+	}
+	qsort(list, n, sizeof(Var *), compare_var_names);
+	for (size_t i = 0; i < n; ++i) printf("export %s=%s\n", list[i]->name, list[i]->value);
+	free(list);
+}
@@ -0,0 +1,527 @@
+#define _GNU_SOURCE // syscall(SYS_getdents64)
+
+#include "wildcard.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// ---- Compiled matcher ----
+// A pattern word is split on '/' into components. Components without magic stay
+// literal; the others become a short op list (literal runs, '?', '*', classes).
+
+typedef enum {
+	GOP_LITERAL,
+	GOP_ANY,
+	GOP_STAR,
+	GOP_CLASS
+} GlobOpKind;
+
+typedef struct {
+	GlobOpKind kind;
+	const char *lit;       // GOP_LITERAL: points into the component text
+	size_t lit_len;
+	unsigned char set[32]; // GOP_CLASS: 256-bit membership, negation already applied
+} GlobOp;
+
+typedef struct {
+	char *text;       // component as written (literal components use it verbatim)
+	GlobOp *ops;      // NULL for a literal component
+	int op_count;
+	bool match_dot;   // pattern starts with '.', so hidden names may match
+	const char *suffix; // literal tail after the last '*' (fast reject), may be NULL
+	size_t suffix_len;
+} GlobComponent;
+
+struct WildcardPattern {
+	bool absolute;
+	bool dir_only;    // trailing '/': only directories match
+	GlobComponent *comps;
+	int comp_count;
+};
+
+static bool component_has_magic(const char *s, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] == '\\') { i++; continue; }
+		if (s[i] == '*' || s[i] == '?') return true;
+		if (s[i] == '[' && memchr(s + i + 1, ']', len - i - 1)) return true;
+	}
+	return false;
+}
+
+bool wildcard_has_magic(const char *word) {
+	return word && component_has_magic(word, strlen(word));
+}
+
+static void set_bit(unsigned char *set, unsigned char c) {
+	set[c >> 3] |= (unsigned char)(1u << (c & 7));
+}
+
+static bool test_bit(const unsigned char *set, unsigned char c) {
+	return (set[c >> 3] >> (c & 7)) & 1u;
+}
+
+// Parse "[...]" starting at s[*i] == '['. Returns false if there is no closing ']'.
+static bool parse_class(const char *s, size_t len, size_t *i, unsigned char *set) {
+	size_t j = *i + 1;
+	bool negate = false;
+	if (j < len && (s[j] == '!' || s[j] == '^')) { negate = true; j++; }
+	memset(set, 0, 32);
+	bool first = true;
+	while (j < len && (s[j] != ']' || first)) {
+		first = false;
+		if (s[j] == '[' && j + 1 < len && s[j + 1] == ':') {
+			const char *end = strstr(s + j + 2, ":]");
+			if (end && (size_t)(end - s) < len) {
+				size_t nlen = (size_t)(end - (s + j + 2));
+				const char *name = s + j + 2;
+				int (*pred)(int) = NULL;
+				if (nlen == 5 && strncmp(name, "alpha", 5) == 0) pred = isalpha;
+				else if (nlen == 5 && strncmp(name, "digit", 5) == 0) pred = isdigit;
+				else if (nlen == 5 && strncmp(name, "alnum", 5) == 0) pred = isalnum;
+				else if (nlen == 5 && strncmp(name, "upper", 5) == 0) pred = isupper;
+				else if (nlen == 5 && strncmp(name, "lower", 5) == 0) pred = islower;
+				else if (nlen == 5 && strncmp(name, "space", 5) == 0) pred = isspace;
+				else if (nlen == 5 && strncmp(name, "punct", 5) == 0) pred = ispunct;
+				if (pred) {
+					for (int c = 1; c < 256; ++c) if (pred(c)) set_bit(set, (unsigned char)c);
+					j = (size_t)(end - s) + 2;
+					continue;
+				}
+			}
+		}
+		unsigned char lo = (unsigned char)s[j];
+		if (j + 2 < len && s[j + 1] == '-' && s[j + 2] != ']') {
+			unsigned char hi = (unsigned char)s[j + 2];
+			for (unsigned c = lo; c <= hi; ++c) set_bit(set, (unsigned char)c);
+			j += 3;
+		} else {
+			set_bit(set, lo);
+			j++;
+		}
+	}
+	if (j >= len) return false;
+	if (negate) {
+		for (int k = 0; k < 32; ++k) set[k] = (unsigned char)~set[k];
+	}
+	set[0] &= (unsigned char)~1u; // never match NUL
+	*i = j + 1;
+	return true;
+}
+
+static bool compile_component(GlobComponent *comp) {
+	const char *s = comp->text;
+	size_t len = strlen(s);
+	if (!component_has_magic(s, len)) {
+		// Literal component: only escapes to strip
+		char *o = comp->text;
+		for (const char *q = s; *q; ++q) {
+			if (*q == '\\' && q[1] != '\0') q++;
+			*o++ = *q;
+		}
+		*o = '\0';
+		return true;
+	}
+
+	comp->ops = (GlobOp *)calloc(len, sizeof(GlobOp));
+	if (!comp->ops) return false;
+	comp->match_dot = (s[0] == '.');
+	int n = 0;
+	size_t i = 0;
+	while (i < len) {
+		GlobOp *op = &comp->ops[n];
+		if (s[i] == '*') {
+			if (n == 0 || comp->ops[n - 1].kind != GOP_STAR) { op->kind = GOP_STAR; n++; }
+			i++;
+		} else if (s[i] == '?') {
+			op->kind = GOP_ANY; n++;
+			i++;
+		} else if (s[i] == '[' && parse_class(s, len, &i, op->set)) {
+			op->kind = GOP_CLASS; n++;
+		} else {
+			// A backslash makes the next character literal; drop it from the text
+			if (s[i] == '\\' && i + 1 < len) {
+				memmove(comp->text + i, comp->text + i + 1, len - i);
+				len--;
+			}
+			if (n > 0 && comp->ops[n - 1].kind == GOP_LITERAL) {
+				comp->ops[n - 1].lit_len++;
+			} else {
+				op->kind = GOP_LITERAL; op->lit = s + i; op->lit_len = 1; n++;
+			}
+			i++;
+		}
+	}
+	comp->op_count = n;
+	if (n >= 2 && comp->ops[n - 1].kind == GOP_LITERAL) {
+		comp->suffix = comp->ops[n - 1].lit;
+		comp->suffix_len = comp->ops[n - 1].lit_len;
+	}
+	return true;
+}
+
+WildcardPattern *wildcard_compile(const char *word) {
+	if (!wildcard_has_magic(word)) return NULL;
+	WildcardPattern *pat = (WildcardPattern *)calloc(1, sizeof(WildcardPattern));
+	if (!pat) return NULL;
+	size_t len = strlen(word);
+	pat->absolute = (word[0] == '/');
+	pat->dir_only = (len > 0 && word[len - 1] == '/');
+
+	int max_comps = 1;
+	for (size_t i = 0; i < len; ++i) if (word[i] == '/') max_comps++;
+	pat->comps = (GlobComponent *)calloc((size_t)max_comps, sizeof(GlobComponent));
+	if (!pat->comps) { free(pat); return NULL; }
+
+	const char *p = word;
+	while (*p) {
+		while (*p == '/') p++;
+		if (!*p) break;
+		size_t clen = strcspn(p, "/");
+		GlobComponent *comp = &pat->comps[pat->comp_count++];
+		comp->text = strndup(p, clen);
+		if (!comp->text || !compile_component(comp)) { wildcard_free(pat); return NULL; }
+		p += clen;
+	}
+	return pat;
+}
+
+void wildcard_free(WildcardPattern *pat) {
+	if (!pat) return;
+	for (int i = 0; i < pat->comp_count; ++i) {
+		free(pat->comps[i].text);
+		free(pat->comps[i].ops);
+	}
+	free(pat->comps);
+	free(pat);
+}
+
+// Iterative matcher with a single backtrack point at the most recent '*'.
+static bool component_match(const GlobComponent *comp, const char *s, size_t n) {
+	if (s[0] == '.' && !comp->match_dot) return false;
+	if (comp->suffix && (n < comp->suffix_len || memcmp(s + n - comp->suffix_len, comp->suffix, comp->suffix_len) != 0)) {
+		return false;
+	}
+	const GlobOp *ops = comp->ops;
+	int nops = comp->op_count;
+	int oi = 0, star_oi = -1;
+	size_t si = 0, star_si = 0;
+	while (oi < nops || si < n) {
+		if (oi < nops) {
+			const GlobOp *op = &ops[oi];
+			if (op->kind == GOP_STAR) {
+				star_oi = oi++;
+				star_si = si;
+				continue;
+			}
+			if (op->kind == GOP_ANY && si < n) { si++; oi++; continue; }
+			if (op->kind == GOP_CLASS && si < n && test_bit(op->set, (unsigned char)s[si])) { si++; oi++; continue; }
+			if (op->kind == GOP_LITERAL && n - si >= op->lit_len && memcmp(s + si, op->lit, op->lit_len) == 0) {
+				si += op->lit_len; oi++;
+				continue;
+			}
+		}
+		if (star_oi >= 0 && star_si < n) {
+			si = ++star_si;
+			oi = star_oi + 1;
+			continue;
+		}
+		return false;
+	}
+	return true;
+}
+
+// ---- Directory listing cache ----
+
+#define DIR_CACHE_SLOTS 8
+
+typedef struct {
+	const char *name;
+	size_t len;
+	unsigned char type; // DT_* from getdents64
+} DirEntry;
+
+typedef struct {
+	char *path;         // directory as it appears in the pattern ("" for cwd)
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	char *names;        // packed NUL-terminated names
+	DirEntry *entries;  // sorted by name
+	size_t count;
+	unsigned long last_use;
+} DirListing;
+
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+static DirListing dir_cache[DIR_CACHE_SLOTS];
+static unsigned long dir_cache_clock = 0;
+
+static void listing_clear(DirListing *dl) {
+	free(dl->path);
+	free(dl->names);
+	free(dl->entries);
+	memset(dl, 0, sizeof(*dl));
+}
+
+void wildcard_cache_reset(void) {
+	for (int i = 0; i < DIR_CACHE_SLOTS; ++i) listing_clear(&dir_cache[i]);
+}
+
+static int compare_entries(const void *a, const void *b) {
+	return strcmp(((const DirEntry *)a)->name, ((const DirEntry *)b)->name);
+}
+
+static bool listing_read(DirListing *dl, const char *path) {
+	int fd = openat(AT_FDCWD, path[0] ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0) { close(fd); return false; }
+
+	size_t names_cap = 4096, names_len = 0;
+	size_t cap = 64, count = 0;
+	char *names = (char *)malloc(names_cap);
+	size_t *offsets = (size_t *)malloc(cap * sizeof(size_t));
+	unsigned char *types = (unsigned char *)malloc(cap);
+	char *buf = (char *)malloc(65536);
+	bool ok = names && offsets && types && buf;
+
+	while (ok) {
+		long nread = syscall(SYS_getdents64, fd, buf, 65536);
+		if (nread <= 0) { ok = (nread == 0); break; }
+		for (long pos = 0; pos < nread;) {
+			struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+			pos += d->d_reclen;
+			const char *nm = d->d_name;
+			if (nm[0] == '.' && (nm[1] == '\0' || (nm[1] == '.' && nm[2] == '\0'))) continue;
+			size_t nl = strlen(nm) + 1;
+			if (names_len + nl > names_cap) {
+				while (names_len + nl > names_cap) names_cap *= 2;
+				char *tmp = (char *)realloc(names, names_cap);
+				if (!tmp) { ok = false; break; }
+				names = tmp;
+			}
+			if (count == cap) {
+				cap *= 2;
+				size_t *to = (size_t *)realloc(offsets, cap * sizeof(size_t));
+				if (to) offsets = to;
+				unsigned char *tt = (unsigned char *)realloc(types, cap);
+				if (tt) types = tt;
+				if (!to || !tt) { ok = false; break; }
+			}
+			memcpy(names + names_len, nm, nl);
+			offsets[count] = names_len;
+			types[count] = d->d_type;
+			count++;
+			names_len += nl;
+		}
+	}
+	close(fd);
+	free(buf);
+
+	DirEntry *entries = ok ? (DirEntry *)malloc((count ? count : 1) * sizeof(DirEntry)) : NULL;
+	if (!entries) {
+		free(names); free(offsets); free(types);
+		return false;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		entries[i].name = names + offsets[i];
+		entries[i].len = strlen(entries[i].name);
+		entries[i].type = types[i];
+	}
+	free(offsets);
+	free(types);
+	qsort(entries, count, sizeof(DirEntry), compare_entries);
+
+	listing_clear(dl);
+	dl->path = strdup(path);
+	dl->dev = st.st_dev;
+	dl->ino = st.st_ino;
+	dl->mtime = st.st_mtim;
+	dl->names = names;
+	dl->entries = entries;
+	dl->count = count;
+	return dl->path != NULL;
+}
+
+// Return a listing for path, reusing the cached copy while the directory is unchanged
+static const DirListing *listing_get(const char *path) {
+	DirListing *victim = &dir_cache[0];
+	for (int i = 0; i < DIR_CACHE_SLOTS; ++i) {
+		DirListing *dl = &dir_cache[i];
+		if (dl->path && strcmp(dl->path, path) == 0) {
+			struct stat st;
+			if (stat(path[0] ? path : ".", &st) == 0 && st.st_dev == dl->dev && st.st_ino == dl->ino &&
+			    st.st_mtim.tv_sec == dl->mtime.tv_sec && st.st_mtim.tv_nsec == dl->mtime.tv_nsec) {
+				dl->last_use = ++dir_cache_clock;
+				return dl;
+			}
+			victim = dl;
+			break;
+		}
+		if (!dl->path || dl->last_use < victim->last_use) victim = dl;
+	}
+	if (!listing_read(victim, path)) {
+		listing_clear(victim);
+		return NULL;
+	}
+	victim->last_use = ++dir_cache_clock;
+	return victim;
+}
+
+int wildcard_list_dir(const char *dir, const char *prefix, size_t prefix_len,
+                      WildcardListEmit emit, void *ctx) {
+	const DirListing *dl = listing_get(dir);
+	if (!dl) return -1;
+	// Entries are sorted, so the names sharing the prefix form one contiguous run
+	size_t lo = 0, hi = dl->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (strncmp(dl->entries[mid].name, prefix, prefix_len) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	int n = 0;
+	char path[PATH_MAX];
+	size_t dlen = strlen(dir);
+	for (size_t i = lo; i < dl->count; ++i) {
+		const DirEntry *e = &dl->entries[i];
+		if (strncmp(e->name, prefix, prefix_len) != 0) break;
+		bool is_dir = e->type == DT_DIR;
+		if ((e->type == DT_LNK || e->type == DT_UNKNOWN) && dlen + e->len < sizeof(path)) {
+			memcpy(path, dir, dlen);
+			memcpy(path + dlen, e->name, e->len + 1);
+			struct stat st;
+			is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+		}
+		n++;
+		if (emit(ctx, e->name, e->len, is_dir) != 0) break;
+	}
+	return n;
+}
+
+// ---- Expansion ----
+
+typedef struct {
+	const WildcardPattern *pat;
+	WildcardEmit emit;
+	void *ctx;
+	char path[PATH_MAX];
+	int matches;
+} ExpandState;
+
+static bool path_is_dir(const char *path, unsigned char type) {
+	if (type == DT_DIR) return true;
+	if (type != DT_LNK && type != DT_UNKNOWN) return false;
+	struct stat st;
+	return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// path[0..len) holds the directory prefix (with trailing '/' unless empty).
+// listed is true when the last component came from a directory listing, so it
+// is known to exist and needs no stat.
+static int expand_from(ExpandState *es, int ci, size_t len, bool listed) {
+	const WildcardPattern *pat = es->pat;
+	if (ci == pat->comp_count) {
+		struct stat st;
+		if (len == 0) return 0;
+		if (pat->dir_only) {
+			if (!listed && (stat(es->path, &st) != 0 || !S_ISDIR(st.st_mode))) return 0;
+		} else {
+			// Drop the '/' we appended after the final component
+			es->path[--len] = '\0';
+			if (!listed && lstat(es->path, &st) != 0) return 0;
+		}
+		es->matches++;
+		return es->emit(es->ctx, es->path, len) != 0 ? -1 : 0;
+	}
+
+	const GlobComponent *comp = &pat->comps[ci];
+	bool last = (ci + 1 == pat->comp_count);
+	if (!comp->ops) {
+		size_t cl = strlen(comp->text);
+		if (len + cl + 2 > sizeof(es->path)) return 0;
+		memcpy(es->path + len, comp->text, cl);
+		es->path[len + cl] = '/';
+		es->path[len + cl + 1] = '\0';
+		return expand_from(es, ci + 1, len + cl + 1, false);
+	}
+
+	es->path[len] = '\0';
+	const DirListing *dl = listing_get(es->path);
+	if (!dl) return 0;
+	size_t count = dl->count;
+	const DirEntry *entries = dl->entries;
+	bool need_dir = !last || pat->dir_only;
+	bool nested = !last;
+	DirEntry *snapshot = NULL;
+	char *snapshot_names = NULL;
+	if (nested) {
+		// Deeper components may evict this listing from the cache; copy the matches first
+		size_t names_sz = 0, m = 0;
+		for (size_t i = 0; i < count; ++i) {
+			if (component_match(comp, entries[i].name, entries[i].len)) { names_sz += entries[i].len + 1; m++; }
+		}
+		snapshot = (DirEntry *)malloc((m ? m : 1) * sizeof(DirEntry));
+		snapshot_names = (char *)malloc(names_sz ? names_sz : 1);
+		if (!snapshot || !snapshot_names) { free(snapshot); free(snapshot_names); return 0; }
+		size_t off = 0, k = 0;
+		for (size_t i = 0; i < count; ++i) {
+			if (!component_match(comp, entries[i].name, entries[i].len)) continue;
+			memcpy(snapshot_names + off, entries[i].name, entries[i].len + 1);
+			snapshot[k].name = snapshot_names + off;
+			snapshot[k].len = entries[i].len;
+			snapshot[k].type = entries[i].type;
+			off += entries[i].len + 1;
+			k++;
+		}
+		entries = snapshot;
+		count = m;
+	}
+
+	int rc = 0;
+	for (size_t i = 0; i < count && rc == 0; ++i) {
+		const DirEntry *e = &entries[i];
+		if (!nested && !component_match(comp, e->name, e->len)) continue;
+		if (len + e->len + 2 > sizeof(es->path)) continue;
+		memcpy(es->path + len, e->name, e->len);
+		es->path[len + e->len] = '\0';
+		if (need_dir && !path_is_dir(es->path, e->type)) continue;
+		es->path[len + e->len] = '/';
+		es->path[len + e->len + 1] = '\0';
+		rc = expand_from(es, ci + 1, len + e->len + 1, true);
+	}
+	free(snapshot);
+	free(snapshot_names);
+	return rc;
+}
+
+int wildcard_expand(const WildcardPattern *pat, WildcardEmit emit, void *ctx) {
+	if (!pat || !emit) return 0;
+	ExpandState *es = (ExpandState *)malloc(sizeof(ExpandState));
+	if (!es) return 0;
+	es->pat = pat;
+	es->emit = emit;
+	es->ctx = ctx;
+	es->matches = 0;
+	size_t len = 0;
+	if (pat->absolute) es->path[len++] = '/';
+	es->path[len] = '\0';
+	int rc = expand_from(es, 0, len, false);
+	int matches = es->matches;
+	free(es);
+	return rc < 0 ? -1 : matches;
+}